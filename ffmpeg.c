@@ -61,6 +61,9 @@
 #elif HAVE_CONIO_H
 #include <conio.h>
 #endif
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #undef time //needed because HAVE_AV_CONFIG_H is defined on top
 #include <time.h>
 
@@ -190,6 +193,8 @@ static char *vstats_filename;
 static FILE *vstats_file;
 static int opt_programid = 0;
 static int copy_initial_nonkeyframes = 0;
+static int playlist_prefetch = 0;
+static int playlist_window = -1;
 
 static int rate_emu = 0;
 
@@ -300,6 +305,8 @@ typedef struct AVInputStream {
                                 is not defined */
     int64_t       pts;       /* current pts */
     int is_start;            /* is 1 at the start and after a discontinuity */
+    int playlist_item;       /* playlist item the last audio was decoded from */
+    int64_t playlist_samples; /* number of samples decoded from that item */
 } AVInputStream;
 
 typedef struct AVInputFile {
@@ -398,6 +405,32 @@ static int decode_interrupt_cb(void)
     return q_pressed || (q_pressed = read_key() == 'q');
 }
 
+#if HAVE_PTHREADS
+/* playlist items are probed and prefetched by other threads, which open decoders */
+static int lockmgr(void **mutex, enum AVLockOp op)
+{
+    switch (op) {
+    case AV_LOCK_CREATE:
+        if (!(*mutex = av_malloc(sizeof(pthread_mutex_t))))
+            return 1;
+        if (pthread_mutex_init(*mutex, NULL)) {
+            av_freep(mutex);
+            return 1;
+        }
+        return 0;
+    case AV_LOCK_OBTAIN:
+        return !!pthread_mutex_lock(*mutex);
+    case AV_LOCK_RELEASE:
+        return !!pthread_mutex_unlock(*mutex);
+    case AV_LOCK_DESTROY:
+        pthread_mutex_destroy(*mutex);
+        av_freep(mutex);
+        return 0;
+    }
+    return 1;
+}
+#endif
+
 static int av_exit(int ret)
 {
     int i;
@@ -1234,6 +1267,38 @@ static void print_report(AVFormatContext **output_files,
     }
 }
 
+/* drop the decoded samples of a playlist item which are encoder delay or
+   padding, so that its audio follows the previous item without a gap */
+static void trim_playlist_audio(AVPlaylistContext *pl_ctx, AVInputStream *ist,
+                                int stream_index, uint8_t **buf, int *size)
+{
+    AVCodecContext *dec = ist->st->codec;
+    int frame_bytes = dec->channels * av_get_bits_per_sample_format(dec->sample_fmt) / 8;
+    int pos, delay;
+    int64_t nb_samples, skip, keep, n;
+
+    if (!frame_bytes ||
+        av_playlist_audio_trim(pl_ctx, stream_index, &pos, &delay, &nb_samples) < 0)
+        return;
+    if (pos != ist->playlist_item) {
+        ist->playlist_item    = pos;
+        ist->playlist_samples = 0;
+    }
+    n    = *size / frame_bytes;
+    skip = av_clip(delay - ist->playlist_samples, 0, n);
+    keep = n;
+    if (nb_samples != INT64_MAX)
+        keep = FFMAX(FFMIN(delay + nb_samples - ist->playlist_samples, n), 0);
+    ist->playlist_samples += n;
+    if (keep <= skip) {
+        *size = 0;
+        return;
+    }
+    ist->pts += av_rescale(skip, AV_TIME_BASE, dec->sample_rate);
+    *buf     += skip * frame_bytes;
+    *size     = (keep - skip) * frame_bytes;
+}
+
 /* pkt = NULL means EOF (needed to flush decoder buffers) */
 static int output_packet(AVInputStream *ist, int ist_index,
                          AVOutputStream **ost_table, int nb_ostreams,
@@ -1257,11 +1322,9 @@ static int output_packet(AVInputStream *ist, int ist_index,
         !strncmp(ic->iformat->long_name, "CONCAT", 6))
         pl_ctx = ic->priv_data;
     if (pl_ctx && pkt) {
-        unsigned int stream_total = 0;
-        for (i = 0; pkt->stream_index >= stream_total; ++i) {
-            stream_offset = stream_total;
-            stream_total = pl_ctx->nb_streams_list[i];
-        }
+        int local_stream_index;
+        if (av_playlist_item_from_stream_index(pl_ctx, pkt->stream_index, &local_stream_index) >= 0)
+            stream_offset = pkt->stream_index - local_stream_index;
         ist->st = ic->streams[pkt->stream_index];
     }
     if(ist->next_pts == AV_NOPTS_VALUE)
@@ -1318,6 +1381,11 @@ static int output_packet(AVInputStream *ist, int ist_index,
                 data_buf = (uint8_t *)samples;
                 ist->next_pts += ((int64_t)AV_TIME_BASE/2 * data_size) /
                     (ist->st->codec->sample_rate * ist->st->codec->channels);
+                if (pl_ctx && pkt)
+                    trim_playlist_audio(pl_ctx, ist, pkt->stream_index,
+                                        &data_buf, &data_size);
+                if (data_size <= 0)
+                    continue;
                 break;}
             case CODEC_TYPE_VIDEO:
                     data_size = (ist->st->codec->width * ist->st->codec->height * 3) / 2;
@@ -1481,6 +1549,9 @@ static int output_packet(AVInputStream *ist, int ist_index,
                             opkt.data = data_buf;
                             opkt.size = data_size;
                         }
+                        // an unchanged payload is shared with the input packet instead of copied by the muxer
+                        if (!opkt.destruct && opkt.data == pkt->data && opkt.size == pkt->size)
+                            av_ref_packet(&opkt, pkt);
 
                         write_frame(os, &opkt, ost->st->codec, bitstream_filters[ost->file_index][opkt.stream_index]);
                         ost->st->codec->frame_number++;
@@ -2256,7 +2327,7 @@ static int av_encode(AVFormatContext **output_files,
         !strncmp(is->iformat->long_name, "CONCAT", 6))
             pl_ctx = is->priv_data;
         if (pl_ctx) {
-            unsigned int stream_total = 0;
+            int local_stream_index;
             if (pkt.stream_index >= nb_istreams &&
                 pkt.stream_index < is->nb_streams &&
                 pkt.stream_index > 0 &&
@@ -2279,10 +2350,8 @@ static int av_encode(AVFormatContext **output_files,
                 ist->next_pts        = AV_NOPTS_VALUE;
                 input_files_ts_scale[file_index][pkt.stream_index] = 0.0L;
             }
-            for (i = 0; pkt.stream_index >= stream_total; ++i) {
-                stream_offset = stream_total;
-                stream_total = pl_ctx->nb_streams_list[i];
-            }
+            if (av_playlist_item_from_stream_index(pl_ctx, pkt.stream_index, &local_stream_index) >= 0)
+                stream_offset = pkt.stream_index - local_stream_index;
         }
 
         /* the following test is needed in case new streams appear
@@ -2923,6 +2992,12 @@ static void opt_input_file(const char *filename)
 
     ic->loop_input = loop_input;
 
+    if (ic->iformat->long_name && ic->priv_data &&
+        !strncmp(ic->iformat->long_name, "CONCAT", 6)) {
+        ((AVPlaylistContext *)ic->priv_data)->prefetch_packets  = playlist_prefetch;
+        ((AVPlaylistContext *)ic->priv_data)->open_items_behind = playlist_window;
+    }
+
     /* If not enough info to get the stream parameters, we decode the
        first frames to get it. (used in mpeg case for example) */
     ret = av_find_stream_info(ic);
@@ -3894,6 +3969,8 @@ static const OptionDef options[] = {
     { "shortest", OPT_BOOL | OPT_EXPERT, {(void*)&opt_shortest}, "finish encoding within shortest input" }, //
     { "dts_delta_threshold", HAS_ARG | OPT_FLOAT | OPT_EXPERT, {(void*)&dts_delta_threshold}, "timestamp discontinuity delta threshold", "threshold" },
     { "programid", HAS_ARG | OPT_INT | OPT_EXPERT, {(void*)&opt_programid}, "desired program number", "" },
+    { "playlist_prefetch", HAS_ARG | OPT_INT | OPT_EXPERT, {(void*)&playlist_prefetch}, "number of packets of the next playlist item to read ahead in the background", "packets" },
+    { "playlist_window", HAS_ARG | OPT_INT | OPT_EXPERT, {(void*)&playlist_window}, "number of previously played playlist items to keep open, -1 for all", "items" },
     { "xerror", OPT_BOOL, {(void*)&exit_on_error}, "exit on error", "error" },
     { "copyinkf", OPT_BOOL | OPT_EXPERT, {(void*)&copy_initial_nonkeyframes}, "copy initial non-keyframes" },
 
@@ -3989,6 +4066,9 @@ int main(int argc, char **argv)
     avcodec_register_all();
     avdevice_register_all();
     av_register_all();
+#if HAVE_PTHREADS
+    av_lockmgr_register(lockmgr);
+#endif
 
 #if HAVE_ISATTY
     if(isatty(STDIN_FILENO))
@@ -30,7 +30,7 @@
 #include "libavutil/avutil.h"
 
 #define LIBAVCODEC_VERSION_MAJOR 52
-#define LIBAVCODEC_VERSION_MINOR 32
+#define LIBAVCODEC_VERSION_MINOR 34
 #define LIBAVCODEC_VERSION_MICRO  0
 
 #define LIBAVCODEC_VERSION_INT  AV_VERSION_INT(LIBAVCODEC_VERSION_MAJOR, \
@@ -601,6 +601,12 @@ typedef struct RcOverride{
  * Codec can export data for HW decoding (VDPAU).
  */
 #define CODEC_CAP_HWACCEL_VDPAU    0x0080
+/**
+ * Codec supports frame-level multithreading.
+ * It must implement AVCodec.update_thread_context() and use the
+ * ff_thread_*() functions of thread.h for its reference frames.
+ */
+#define CODEC_CAP_FRAME_THREADS    0x0100
 
 //The following defines may change, don't expect compatibility if you use them.
 #define MB_TYPE_INTRA4x4   0x0001
@@ -880,6 +886,13 @@ typedef struct AVPanScan{
      * - decoding: Set by libavcodec\
      */\
     void *hwaccel_picture_private;\
+\
+    /**\
+     * decoding progress of the frame when frame threading is used\
+     * - encoding: unused\
+     * - decoding: Set by libavcodec\
+     */\
+    void *thread_opaque;\
 
 
 #define FF_QSCALE_TYPE_MPEG1 0
@@ -2518,6 +2531,48 @@ typedef struct AVCodecContext {
      * - decoding: Set by libavcodec
      */
      enum AVChromaLocation chroma_sample_location;
+
+    /**
+     * Which multithreading methods to use.
+     * Frame threading decodes several frames at once and delays the output
+     * by thread_count - 1 frames, slice threading decodes the slices of a
+     * frame at once. Frame threading is only used by decoders with
+     * CODEC_CAP_FRAME_THREADS when avcodec_thread_init() was called before
+     * avcodec_open() and neither draw_horiz_band() nor a custom get_format()
+     * is set.
+     * - encoding: unused
+     * - decoding: Set by user, otherwise the default is used.
+     */
+    int thread_type;
+#define FF_THREAD_FRAME   1 ///< Decode more than one frame at once
+#define FF_THREAD_SLICE   2 ///< Decode more than one part of a single frame at once
+
+    /**
+     * Which multithreading method is in use, a combination of FF_THREAD_*.
+     * - encoding: Set by libavcodec.
+     * - decoding: Set by libavcodec.
+     */
+    int active_thread_type;
+
+    /**
+     * Set by the user if get_buffer() and release_buffer() can be called
+     * from any thread at any time. Otherwise frame threading calls them
+     * from the thread that calls avcodec_decode_video2() only, which
+     * makes decoding less parallel.
+     * - encoding: unused
+     * - decoding: Set by user.
+     */
+    int thread_safe_callbacks;
+
+    /**
+     * Whether this is one of the copies of the context the frame threads
+     * decode with, rather than the context the user opened.
+     * Data shared by all the copies is freed by the first one, which is
+     * not a copy in this sense.
+     * - encoding: unused
+     * - decoding: Set by libavcodec.
+     */
+    int is_copy;
 } AVCodecContext;
 
 /**
@@ -2559,6 +2614,16 @@ typedef struct AVCodec {
     const int *supported_samplerates;       ///< array of supported audio samplerates, or NULL if unknown, array is terminated by 0
     const enum SampleFormat *sample_fmts;   ///< array of supported sample formats, or NULL if unknown, array is terminated by -1
     const int64_t *channel_layouts;         ///< array of support channel layouts, or NULL if unknown. array is terminated by 0
+    /**
+     * Copies the state the next frame depends on from the context of the
+     * thread that decoded the previous frame, for frame threading.
+     * Called before the next frame is decoded, once the thread decoding
+     * the previous one called ff_thread_finish_setup().
+     * @param dst context of the thread about to decode the next frame
+     * @param src context of the thread that decoded the previous frame
+     * @return 0 upon success, negative upon failure
+     */
+    int (*update_thread_context)(AVCodecContext *dst, const AVCodecContext *src);
 } AVCodec;
 
 /**
@@ -2759,6 +2824,10 @@ void av_init_packet(AVPacket *pkt);
 /**
  * Allocate the payload of a packet and initialize its fields with
  * default values.
+ * When built with pthreads, the payload comes from a pool of buffers and is
+ * reference counted; it must then only be released with av_free_packet()
+ * and resized with av_shrink_packet() or av_grow_packet(), never freed or
+ * reallocated directly.
  *
  * @param pkt packet
  * @param size wanted payload size
@@ -2774,6 +2843,28 @@ int av_new_packet(AVPacket *pkt, int size);
  */
 void av_shrink_packet(AVPacket *pkt, int size);
 
+/**
+ * Increase packet size, correctly zeroing padding
+ *
+ * @param pkt packet
+ * @param grow_by number of bytes by which to increase the size of the packet
+ * @return 0 if OK, AVERROR_xxx otherwise
+ */
+int av_grow_packet(AVPacket *pkt, int grow_by);
+
+/**
+ * Make the payload of a packet refer to the payload of another one, without
+ * copying it. If the payload of src is reference counted, dst holds a
+ * reference of its own and the payload is released once both packets are
+ * freed. Otherwise dst does not own its payload, which av_dup_packet() can
+ * then copy. Fields other than the payload are left alone.
+ *
+ * @param dst packet whose payload is set; a payload it had is not released
+ * @param src packet whose payload is referred to
+ * @return 0 if OK, AVERROR_xxx otherwise
+ */
+int av_ref_packet(AVPacket *dst, const AVPacket *src);
+
 /**
  * @warning This is a hack - the packet memory allocation stuff is broken. The
  * packet is allocated if it was not really allocated.
@@ -3142,6 +3233,12 @@ void avcodec_align_dimensions(AVCodecContext *s, int *width, int *height);
 int avcodec_check_dimensions(void *av_log_ctx, unsigned int w, unsigned int h);
 enum PixelFormat avcodec_default_get_format(struct AVCodecContext *s, const enum PixelFormat * fmt);
 
+/**
+ * Makes the codec of the context use thread_count threads once it is opened.
+ * With pthreads, the slice threads are workers shared by all the contexts of
+ * the process, whose number grows to the largest thread_count - 1 asked for,
+ * the thread calling execute() being one of the threads running its jobs.
+ */
 int avcodec_thread_init(AVCodecContext *s, int thread_count);
 void avcodec_thread_free(AVCodecContext *s);
 int avcodec_thread_execute(AVCodecContext *s, int (*func)(AVCodecContext *c2, void *arg2),void *arg, int *ret, int count, int size);
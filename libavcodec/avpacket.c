@@ -19,8 +19,121 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "config.h"
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include "avcodec.h"
 
+#if HAVE_PTHREADS
+/* Payloads are drawn from pools of buffers of a few sizes per power of two,
+ * and are shared between packets by reference counting. Buffers are only
+ * pooled where thread-safe reference counting is available. */
+
+#define POOL_MIN_BITS   10                  ///< log2 of the smallest buffer
+#define POOL_MAX_BITS   26                  ///< log2 of the largest pooled buffer
+#define POOL_CLASSES    (4 * (POOL_MAX_BITS - POOL_MIN_BITS) + 1)
+#define POOL_MAX_COUNT  64                  ///< free buffers kept per size class
+#define POOL_MAX_BYTES  (64 << 20)          ///< free bytes kept per size class
+
+typedef struct PacketBuffer {
+    struct PacketBuffer *next;              ///< next free buffer of the same size class
+    int refcount;                           ///< number of packets using the buffer
+    int size_class;                         ///< size class, -1 if the buffer is not pooled
+} PacketBuffer;
+
+/* the payload follows the header, keeping the alignment of av_malloc() */
+#define BUFFER_HEADER_SIZE ((sizeof(PacketBuffer) + 15) & ~15)
+#define BUFFER_DATA(b)     ((uint8_t *)(b) + BUFFER_HEADER_SIZE)
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PacketBuffer *pool[POOL_CLASSES];
+static int pool_count[POOL_CLASSES];
+
+static unsigned int class_size(int size_class)
+{
+    return (4 + (size_class & 3)) << (POOL_MIN_BITS - 2 + (size_class >> 2));
+}
+
+/**
+ * Get a buffer of at least size bytes with a reference count of one.
+ */
+static PacketBuffer *buffer_alloc(unsigned int size)
+{
+    PacketBuffer *b = NULL;
+    int size_class = 0;
+
+    // sizes of a class are at most a quarter above those requested
+    while (size_class < POOL_CLASSES && class_size(size_class) < size)
+        size_class++;
+    if (size_class < POOL_CLASSES) {
+        pthread_mutex_lock(&pool_mutex);
+        if ((b = pool[size_class])) {
+            pool[size_class] = b->next;
+            pool_count[size_class]--;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+        if (!b && (b = av_malloc(BUFFER_HEADER_SIZE + class_size(size_class))))
+            b->size_class = size_class;
+    } else if (size <= INT_MAX - BUFFER_HEADER_SIZE &&
+               (b = av_malloc(BUFFER_HEADER_SIZE + size))) {
+        b->size_class = -1;
+    }
+    if (b) {
+        b->next     = NULL;
+        b->refcount = 1;
+    }
+    return b;
+}
+
+static void buffer_unref(PacketBuffer *b)
+{
+    int size_class = b->size_class;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (--b->refcount) {
+        pthread_mutex_unlock(&pool_mutex);
+        return;
+    }
+    if (size_class >= 0 && pool_count[size_class] <
+        av_clip(POOL_MAX_BYTES / class_size(size_class), 1, POOL_MAX_COUNT)) {
+        b->next = pool[size_class];
+        pool[size_class] = b;
+        pool_count[size_class]++;
+        b = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    av_free(b);
+}
+
+static void destruct_pooled_packet(AVPacket *pkt)
+{
+    // packets are disowned by clearing their data, as with av_destruct_packet
+    if (pkt->data)
+        buffer_unref(pkt->priv);
+    pkt->priv = NULL;
+    pkt->data = NULL; pkt->size = 0;
+}
+
+/**
+ * Give a packet a buffer of its own for size bytes and the padding, which
+ * is zeroed.
+ */
+static int packet_alloc(AVPacket *pkt, int size)
+{
+    PacketBuffer *b;
+    if((unsigned)size > (unsigned)size + FF_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR(ENOMEM);
+    if (!(b = buffer_alloc(size + FF_INPUT_BUFFER_PADDING_SIZE)))
+        return AVERROR(ENOMEM);
+    memset(BUFFER_DATA(b) + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    pkt->data     = BUFFER_DATA(b);
+    pkt->size     = size;
+    pkt->priv     = b;
+    pkt->destruct = destruct_pooled_packet;
+    return 0;
+}
+#endif
 
 void av_destruct_packet_nofree(AVPacket *pkt)
 {
@@ -47,6 +160,10 @@ void av_init_packet(AVPacket *pkt)
 
 int av_new_packet(AVPacket *pkt, int size)
 {
+#if HAVE_PTHREADS
+    av_init_packet(pkt);
+    return packet_alloc(pkt, size);
+#else
     uint8_t *data;
     if((unsigned)size > (unsigned)size + FF_INPUT_BUFFER_PADDING_SIZE)
         return AVERROR(ENOMEM);
@@ -60,18 +177,107 @@ int av_new_packet(AVPacket *pkt, int size)
     pkt->size = size;
     pkt->destruct = av_destruct_packet;
     return 0;
+#endif
 }
 
 void av_shrink_packet(AVPacket *pkt, int size)
 {
     if (pkt->size <= size) return;
+#if HAVE_PTHREADS
+    if (pkt->destruct == destruct_pooled_packet &&
+        ((PacketBuffer *)pkt->priv)->refcount > 1) {
+        // the padding would overwrite data of the packets sharing the payload
+        AVPacket new_pkt;
+        if (packet_alloc(&new_pkt, size) < 0) {
+            pkt->size = size;
+            return;
+        }
+        memcpy(new_pkt.data, pkt->data, size);
+        buffer_unref(pkt->priv);
+        pkt->data = new_pkt.data;
+        pkt->priv = new_pkt.priv;
+        pkt->size = size;
+        return;
+    }
+#endif
     pkt->size = size;
     memset(pkt->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
 }
 
+int av_grow_packet(AVPacket *pkt, int grow_by)
+{
+    AVPacket new_pkt;
+    int size = pkt->size;
+
+    if ((unsigned)grow_by > INT_MAX - FF_INPUT_BUFFER_PADDING_SIZE - (unsigned)size)
+        return AVERROR(ENOMEM);
+    new_pkt = *pkt;
+#if HAVE_PTHREADS
+    if (pkt->destruct == destruct_pooled_packet) {
+        PacketBuffer *b = pkt->priv;
+        // a buffer used by this packet alone may have room left
+        if (b->refcount == 1 && pkt->data >= BUFFER_DATA(b) &&
+            b->size_class >= 0 && pkt->data - BUFFER_DATA(b) + size + grow_by +
+            FF_INPUT_BUFFER_PADDING_SIZE <= class_size(b->size_class)) {
+            pkt->size += grow_by;
+            memset(pkt->data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+            return 0;
+        }
+    }
+    if (packet_alloc(&new_pkt, size + grow_by) < 0)
+        return AVERROR(ENOMEM);
+#else
+    if (pkt->destruct == av_destruct_packet) {
+        uint8_t *data = av_realloc(pkt->data, size + grow_by + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!data)
+            return AVERROR(ENOMEM);
+        pkt->data  = data;
+        pkt->size += grow_by;
+        memset(pkt->data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+        return 0;
+    }
+    if (av_new_packet(&new_pkt, size + grow_by) < 0)
+        return AVERROR(ENOMEM);
+#endif
+    if (size)
+        memcpy(new_pkt.data, pkt->data, size);
+    av_free_packet(pkt);
+    pkt->data     = new_pkt.data;
+    pkt->size     = new_pkt.size;
+    pkt->priv     = new_pkt.priv;
+    pkt->destruct = new_pkt.destruct;
+    return 0;
+}
+
+int av_ref_packet(AVPacket *dst, const AVPacket *src)
+{
+    dst->data     = src->data;
+    dst->size     = src->size;
+    dst->priv     = NULL;
+    dst->destruct = NULL;
+#if HAVE_PTHREADS
+    if (src->destruct == destruct_pooled_packet) {
+        PacketBuffer *b = src->priv;
+        pthread_mutex_lock(&pool_mutex);
+        b->refcount++;
+        pthread_mutex_unlock(&pool_mutex);
+        dst->priv     = b;
+        dst->destruct = destruct_pooled_packet;
+    }
+#endif
+    return 0;
+}
+
 int av_dup_packet(AVPacket *pkt)
 {
     if (((pkt->destruct == av_destruct_packet_nofree) || (pkt->destruct == NULL)) && pkt->data) {
+#if HAVE_PTHREADS
+        uint8_t *data = pkt->data;
+        int ret;
+        if ((ret = packet_alloc(pkt, pkt->size)) < 0)
+            return ret;
+        memcpy(pkt->data, data, pkt->size);
+#else
         uint8_t *data;
         /* We duplicate the packet and don't forget to add the padding again. */
         if((unsigned)pkt->size > (unsigned)pkt->size + FF_INPUT_BUFFER_PADDING_SIZE)
@@ -84,6 +290,7 @@ int av_dup_packet(AVPacket *pkt)
         memset(data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
         pkt->data = data;
         pkt->destruct = av_destruct_packet;
+#endif
     }
     return 0;
 }
@@ -30,6 +30,7 @@
 #include "avcodec.h"
 #include "dsputil.h"
 #include "mpegvideo.h"
+#include "thread.h"
 
 static void decode_mb(MpegEncContext *s){
     s->dest[0] = s->current_picture.data[0] + (s->mb_y * 16* s->linesize  ) + s->mb_x * 16;
@@ -687,6 +688,14 @@ void ff_er_frame_end(MpegEncContext *s){
        s->avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU ||
        s->error_count==3*s->mb_width*(s->avctx->skip_top + s->avctx->skip_bottom)) return;
 
+    /* the concealment reads any part of the reference pictures */
+    if(s->avctx->active_thread_type&FF_THREAD_FRAME){
+        if(s->last_picture_ptr)
+            ff_thread_await_progress((AVFrame*)s->last_picture_ptr, INT_MAX);
+        if(s->pict_type == FF_B_TYPE && s->next_picture_ptr)
+            ff_thread_await_progress((AVFrame*)s->next_picture_ptr, INT_MAX);
+    }
+
     if(s->current_picture.motion_val[0] == NULL){
         av_log(s->avctx, AV_LOG_ERROR, "Warning MVs not available\n");
 
@@ -25,6 +25,7 @@
  * FF Video Codec 1 (an experimental lossless codec)
  */
 
+#include "libavutil/intreadwrite.h"
 #include "avcodec.h"
 #include "get_bits.h"
 #include "put_bits.h"
@@ -35,6 +36,7 @@
 
 #define MAX_PLANES 4
 #define CONTEXT_SIZE 32
+#define MAX_SLICES 32
 
 extern const uint8_t ff_log2_run[32];
 
@@ -219,6 +221,12 @@ typedef struct FFV1Context{
     int colorspace;
 
     DSPContext dsp;
+
+    int slice_count;                     ///< number of slices of the frames since the last keyframe
+    struct FFV1Context *slice_context[MAX_SLICES]; ///< context of each slice, with its own states and coder
+    int slice_y;                         ///< first luma line of the slice, set in the slice contexts
+    int slice_height;                    ///< number of luma lines of the slice
+    int key_frame_needed;                ///< set when a frame failed to encode, leaving the states out of step with the decoder
 }FFV1Context;
 
 static av_always_inline int fold(int diff, int bits){
@@ -486,7 +494,7 @@ static inline int encode_line(FFV1Context *s, int w, int_fast16_t *sample[2], in
     return 0;
 }
 
-static void encode_plane(FFV1Context *s, uint8_t *src, int w, int h, int stride, int plane_index){
+static int encode_plane(FFV1Context *s, uint8_t *src, int w, int h, int stride, int plane_index){
     int x,y,i;
     const int ring_size= s->avctx->context_model ? 3 : 2;
     int_fast16_t sample_buffer[ring_size][w+6], *sample[ring_size];
@@ -505,18 +513,21 @@ static void encode_plane(FFV1Context *s, uint8_t *src, int w, int h, int stride,
             for(x=0; x<w; x++){
                 sample[0][x]= src[x + stride*y];
             }
-            encode_line(s, w, sample, plane_index, 8);
+            if(encode_line(s, w, sample, plane_index, 8) < 0)
+                return -1;
         }else{
             for(x=0; x<w; x++){
                 sample[0][x]= ((uint16_t*)(src + stride*y))[x] >> (16 - s->avctx->bits_per_raw_sample);
             }
-            encode_line(s, w, sample, plane_index, s->avctx->bits_per_raw_sample);
+            if(encode_line(s, w, sample, plane_index, s->avctx->bits_per_raw_sample) < 0)
+                return -1;
         }
 //STOP_TIMER("encode line")}
     }
+    return 0;
 }
 
-static void encode_rgb_frame(FFV1Context *s, uint32_t *src, int w, int h, int stride){
+static int encode_rgb_frame(FFV1Context *s, uint32_t *src, int w, int h, int stride){
     int x, y, p, i;
     const int ring_size= s->avctx->context_model ? 3 : 2;
     int_fast16_t sample_buffer[3][ring_size][w+6], *sample[3][ring_size];
@@ -550,9 +561,11 @@ static void encode_rgb_frame(FFV1Context *s, uint32_t *src, int w, int h, int st
         for(p=0; p<3; p++){
             sample[p][0][-1]= sample[p][1][0  ];
             sample[p][1][ w]= sample[p][1][w-1];
-            encode_line(s, w, sample[p], FFMIN(p, 1), 9);
+            if(encode_line(s, w, sample[p], FFMIN(p, 1), 9) < 0)
+                return -1;
         }
     }
+    return 0;
 }
 
 static void write_quant_table(RangeCoder *c, int16_t *quant_table){
@@ -573,7 +586,7 @@ static void write_quant_table(RangeCoder *c, int16_t *quant_table){
 static void write_header(FFV1Context *f){
     uint8_t state[CONTEXT_SIZE];
     int i;
-    RangeCoder * const c= &f->c;
+    RangeCoder * const c= &f->slice_context[0]->c;
 
     memset(state, 128, sizeof(state));
 
@@ -589,6 +602,8 @@ static void write_header(FFV1Context *f){
 
     for(i=0; i<5; i++)
         write_quant_table(c, f->quant_table[i]);
+    if(f->version>1)
+        put_symbol(c, state, f->slice_count, 0);
 }
 #endif /* CONFIG_FFV1_ENCODER */
 
@@ -608,6 +623,49 @@ static av_cold int common_init(AVCodecContext *avctx){
     return 0;
 }
 
+/**
+ * Gives every slice context the parameters of the frame and its part of it,
+ * and allocates its states for the current number of contexts.
+ */
+static int init_slice_contexts(FFV1Context *f){
+    int i, j;
+
+    for(i=0; i<f->slice_count; i++){
+        FFV1Context *fs= f->slice_context[i];
+        PlaneContext planes[MAX_PLANES];
+
+        if(!fs && !(fs= f->slice_context[i]= av_mallocz(sizeof(FFV1Context))))
+            return -1;
+
+        memcpy(planes, fs->plane, sizeof(planes));
+        *fs= *f;
+        fs->slice_y     = f->height *  i    / f->slice_count;
+        fs->slice_height= f->height * (i+1) / f->slice_count - fs->slice_y;
+
+        for(j=0; j<MAX_PLANES; j++){
+            PlaneContext * const p= &fs->plane[j];
+
+            p->state    = planes[j].state;
+            p->vlc_state= planes[j].vlc_state;
+            if(planes[j].context_count != p->context_count){
+                av_freep(&p->state);
+                av_freep(&p->vlc_state);
+            }
+            if(j >= f->plane_count)
+                continue;
+
+            if(f->ac){
+                if(!p->state) p->state= av_malloc(CONTEXT_SIZE*p->context_count*sizeof(uint8_t));
+                if(!p->state) return -1;
+            }else{
+                if(!p->vlc_state) p->vlc_state= av_malloc(p->context_count*sizeof(VlcState));
+                if(!p->vlc_state) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
 #if CONFIG_FFV1_ENCODER
 static av_cold int encode_init(AVCodecContext *avctx)
 {
@@ -656,12 +714,6 @@ static av_cold int encode_init(AVCodecContext *avctx)
         }else{
             p->context_count= (11*11*5*5*5+1)/2;
         }
-
-        if(s->ac){
-            if(!p->state) p->state= av_malloc(CONTEXT_SIZE*p->context_count*sizeof(uint8_t));
-        }else{
-            if(!p->vlc_state) p->vlc_state= av_malloc(p->context_count*sizeof(VlcState));
-        }
     }
 
     avctx->coded_frame= &s->picture;
@@ -695,6 +747,18 @@ static av_cold int encode_init(AVCodecContext *avctx)
     }
     avcodec_get_chroma_sub_sample(avctx->pix_fmt, &s->chroma_h_shift, &s->chroma_v_shift);
 
+    s->slice_count= 1;
+    if(avctx->thread_count > 1){
+        if(avctx->strict_std_compliance > FF_COMPLIANCE_EXPERIMENTAL){
+            av_log(avctx, AV_LOG_INFO, "Slices are still experimental, use vstrict=-2 / -strict -2 to encode with one slice per thread\n");
+        }else{
+            s->slice_count= FFMIN(avctx->thread_count, MAX_SLICES);
+            s->version= 2;
+        }
+    }
+    if(init_slice_contexts(s) < 0)
+        return -1;
+
     s->picture_number=0;
 
     return 0;
@@ -725,28 +789,60 @@ static void clear_state(FFV1Context *f){
 }
 
 #if CONFIG_FFV1_ENCODER
+static int encode_slice(AVCodecContext *c, void *arg){
+    FFV1Context *fs= *(void**)arg;
+    FFV1Context *f= fs->avctx->priv_data;
+    AVFrame * const p= &f->picture;
+    const int width= f->width;
+    const int y= fs->slice_y;
+    const int height= fs->slice_height;
+    int ret= 0;
+
+    if(p->key_frame)
+        clear_state(fs);
+
+    if(f->colorspace==0){
+        const int chroma_width = -((-width )>>f->chroma_h_shift);
+        const int chroma_y     = -((-y     )>>f->chroma_v_shift);
+        const int chroma_height= -((-y-height)>>f->chroma_v_shift) - chroma_y;
+
+        if(   encode_plane(fs, p->data[0] + y*p->linesize[0], width, height, p->linesize[0], 0) < 0
+           || encode_plane(fs, p->data[1] + chroma_y*p->linesize[1], chroma_width, chroma_height, p->linesize[1], 1) < 0
+           || encode_plane(fs, p->data[2] + chroma_y*p->linesize[2], chroma_width, chroma_height, p->linesize[2], 1) < 0)
+            ret= -1;
+    }else{
+        ret= encode_rgb_frame(fs, (uint32_t*)(p->data[0] + y*p->linesize[0]), width, height, p->linesize[0]/4);
+    }
+    emms_c();
+
+    return ret;
+}
+
 static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
     FFV1Context *f = avctx->priv_data;
-    RangeCoder * const c= &f->c;
+    RangeCoder * const c= &f->slice_context[0]->c;
     AVFrame *pict = data;
-    const int width= f->width;
-    const int height= f->height;
     AVFrame * const p= &f->picture;
     int used_count= 0;
     uint8_t keystate=128;
-
-    ff_init_range_encoder(c, buf, buf_size);
+    uint8_t *buf_p;
+    int i, ret[MAX_SLICES];
+    /* Each slice is written to its part of buf, and from version 2 on
+     * ends with its size in 3 bytes so that they can be decoded separately. */
+    const int trailer= f->version>1 ? 3 : 0;
+    const int slice_buf_size= buf_size / f->slice_count;
+
+    ff_init_range_encoder(c, buf, slice_buf_size - trailer);
 //    ff_init_cabac_states(c, ff_h264_lps_range, ff_h264_mps_state, ff_h264_lps_state, 64);
     ff_build_rac_states(c, 0.05*(1LL<<32), 256-8);
 
     *p = *pict;
     p->pict_type= FF_I_TYPE;
 
-    if(avctx->gop_size==0 || f->picture_number % avctx->gop_size == 0){
+    if(avctx->gop_size==0 || f->picture_number % avctx->gop_size == 0 || f->key_frame_needed){
         put_rac(c, &keystate, 1);
         p->key_frame= 1;
         write_header(f);
-        clear_state(f);
     }else{
         put_rac(c, &keystate, 0);
         p->key_frame= 0;
@@ -755,42 +851,70 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
     if(!f->ac){
         used_count += ff_rac_terminate(c);
 //printf("pos=%d\n", used_count);
-        init_put_bits(&f->pb, buf + used_count, buf_size - used_count);
+        init_put_bits(&f->slice_context[0]->pb, buf + used_count, slice_buf_size - trailer - used_count);
     }
+    for(i=1; i<f->slice_count; i++){
+        FFV1Context *fs= f->slice_context[i];
+        uint8_t *start= buf + i*slice_buf_size;
 
-    if(f->colorspace==0){
-        const int chroma_width = -((-width )>>f->chroma_h_shift);
-        const int chroma_height= -((-height)>>f->chroma_v_shift);
+        if(f->ac){
+            ff_init_range_encoder(&fs->c, start, slice_buf_size - trailer);
+            ff_build_rac_states(&fs->c, 0.05*(1LL<<32), 256-8);
+        }else
+            init_put_bits(&fs->pb, start, slice_buf_size - trailer);
+    }
 
-        encode_plane(f, p->data[0], width, height, p->linesize[0], 0);
+    // a slice filling its part of buf stops before running into the next one
+    avctx->execute(avctx, encode_slice, &f->slice_context[0], ret, f->slice_count, sizeof(void*));
+    f->key_frame_needed= 0;
+    for(i=0; i<f->slice_count; i++)
+        if(ret[i] < 0)
+            f->key_frame_needed= 1;
+    if(f->key_frame_needed)
+        return -1;
 
-        encode_plane(f, p->data[1], chroma_width, chroma_height, p->linesize[1], 1);
-        encode_plane(f, p->data[2], chroma_width, chroma_height, p->linesize[2], 1);
-    }else{
-        encode_rgb_frame(f, (uint32_t*)(p->data[0]), width, height, p->linesize[0]/4);
+    buf_p= buf;
+    for(i=0; i<f->slice_count; i++){
+        FFV1Context *fs= f->slice_context[i];
+        int bytes;
+
+        if(f->ac){
+            bytes= ff_rac_terminate(&fs->c);
+        }else{
+            flush_put_bits(&fs->pb); //nicer padding FIXME
+            bytes= (i ? 0 : used_count) + (put_bits_count(&fs->pb)+7)/8;
+        }
+        if(i)
+            memmove(buf_p, buf + i*slice_buf_size, bytes);
+        buf_p += bytes;
+        if(trailer){
+            AV_WB24(buf_p, bytes);
+            buf_p += trailer;
+        }
     }
-    emms_c();
 
     f->picture_number++;
 
-    if(f->ac){
-        return ff_rac_terminate(c);
-    }else{
-        flush_put_bits(&f->pb); //nicer padding FIXME
-        return used_count + (put_bits_count(&f->pb)+7)/8;
-    }
+    return buf_p - buf;
 }
 #endif /* CONFIG_FFV1_ENCODER */
 
 static av_cold int common_end(AVCodecContext *avctx){
     FFV1Context *s = avctx->priv_data;
-    int i;
+    int i, j;
 
-    for(i=0; i<s->plane_count; i++){
-        PlaneContext *p= &s->plane[i];
+    for(j=0; j<MAX_SLICES; j++){
+        FFV1Context *fs= s->slice_context[j];
+
+        if(!fs)
+            continue;
+        for(i=0; i<MAX_PLANES; i++){
+            PlaneContext *p= &fs->plane[i];
 
-        av_freep(&p->state);
-        av_freep(&p->vlc_state);
+            av_freep(&p->state);
+            av_freep(&p->vlc_state);
+        }
+        av_freep(&s->slice_context[j]);
     }
 
     return 0;
@@ -968,6 +1092,10 @@ static int read_header(FFV1Context *f){
     memset(state, 128, sizeof(state));
 
     f->version= get_symbol(c, state, 0);
+    if(f->version>2){
+        av_log(f->avctx, AV_LOG_ERROR, "unsupported version %d\n", f->version);
+        return -1;
+    }
     f->ac= f->avctx->coder_type= get_symbol(c, state, 0);
     f->colorspace= get_symbol(c, state, 0); //YUV cs type
     if(f->version>0)
@@ -1023,19 +1151,19 @@ static int read_header(FFV1Context *f){
     }
     context_count= (context_count+1)/2;
 
-    for(i=0; i<f->plane_count; i++){
-        PlaneContext * const p= &f->plane[i];
-
-        p->context_count= context_count;
+    for(i=0; i<f->plane_count; i++)
+        f->plane[i].context_count= context_count;
 
-        if(f->ac){
-            if(!p->state) p->state= av_malloc(CONTEXT_SIZE*p->context_count*sizeof(uint8_t));
-        }else{
-            if(!p->vlc_state) p->vlc_state= av_malloc(p->context_count*sizeof(VlcState));
+    if(f->version>1){
+        f->slice_count= get_symbol(c, state, 0);
+        if(f->slice_count < 1 || f->slice_count > MAX_SLICES){
+            av_log(f->avctx, AV_LOG_ERROR, "invalid slice count %d\n", f->slice_count);
+            return -1;
         }
-    }
+    }else
+        f->slice_count= 1;
 
-    return 0;
+    return init_slice_contexts(f);
 }
 
 static av_cold int decode_init(AVCodecContext *avctx)
@@ -1047,16 +1175,44 @@ static av_cold int decode_init(AVCodecContext *avctx)
     return 0;
 }
 
+static int decode_slice(AVCodecContext *c, void *arg){
+    FFV1Context *fs= *(void**)arg;
+    FFV1Context *f= fs->avctx->priv_data;
+    AVFrame * const p= &f->picture;
+    const int width= f->width;
+    const int y= fs->slice_y;
+    const int height= fs->slice_height;
+
+    if(p->key_frame)
+        clear_state(fs);
+
+    if(f->colorspace==0){
+        const int chroma_width = -((-width )>>f->chroma_h_shift);
+        const int chroma_y     = -((-y     )>>f->chroma_v_shift);
+        const int chroma_height= -((-y-height)>>f->chroma_v_shift) - chroma_y;
+
+        decode_plane(fs, p->data[0] + y*p->linesize[0], width, height, p->linesize[0], 0);
+
+        decode_plane(fs, p->data[1] + chroma_y*p->linesize[1], chroma_width, chroma_height, p->linesize[1], 1);
+        decode_plane(fs, p->data[2] + chroma_y*p->linesize[2], chroma_width, chroma_height, p->linesize[2], 1);
+    }else{
+        decode_rgb_frame(fs, (uint32_t*)(p->data[0] + y*p->linesize[0]), width, height, p->linesize[0]/4);
+    }
+    emms_c();
+
+    return 0;
+}
+
 static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPacket *avpkt){
     const uint8_t *buf = avpkt->data;
     int buf_size = avpkt->size;
     FFV1Context *f = avctx->priv_data;
     RangeCoder * const c= &f->c;
-    const int width= f->width;
-    const int height= f->height;
     AVFrame * const p= &f->picture;
-    int bytes_read;
+    FFV1Context *fs;
+    int bytes_read, i;
     uint8_t keystate= 128;
+    const uint8_t *buf_p;
 
     AVFrame *picture = data;
 
@@ -1067,15 +1223,42 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
     p->pict_type= FF_I_TYPE; //FIXME I vs. P
     if(get_rac(c, &keystate)){
         p->key_frame= 1;
-        if(read_header(f) < 0)
+        if(read_header(f) < 0){
+            // no frame can be decoded before the next valid header
+            f->slice_count= 0;
             return -1;
-        clear_state(f);
+        }
     }else{
         p->key_frame= 0;
     }
-    if(!f->plane[0].state && !f->plane[0].vlc_state)
+    if(!f->slice_count)
         return -1;
 
+    // the slices are found from the end of the frame, each ending with its size
+    buf_p= buf + buf_size;
+    for(i=f->slice_count-1; i>0; i--){
+        int slice_size;
+
+        fs= f->slice_context[i];
+        if(buf_p - buf < 3 || (slice_size= AV_RB24(buf_p - 3)) > buf_p - 3 - buf){
+            av_log(avctx, AV_LOG_ERROR, "slice %d size is invalid\n", i);
+            return -1;
+        }
+        buf_p -= 3 + slice_size;
+        if(f->ac){
+            ff_init_range_decoder(&fs->c, buf_p, slice_size);
+            ff_build_rac_states(&fs->c, 0.05*(1LL<<32), 256-8);
+        }else
+            init_get_bits(&fs->gb, buf_p, slice_size*8);
+    }
+    if(f->version>1 && buf_p - buf >= 3)
+        buf_p -= 3;
+
+    // the first slice goes on after the header
+    fs= f->slice_context[0];
+    fs->c= *c;
+    fs->c.bytestream_end= fs->c.bytestream_start + (buf_p - buf);
+
     p->reference= 0;
     if(avctx->get_buffer(avctx, p) < 0){
         av_log(avctx, AV_LOG_ERROR, "get_buffer() failed\n");
@@ -1083,29 +1266,18 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
     }
 
     if(avctx->debug&FF_DEBUG_PICT_INFO)
-        av_log(avctx, AV_LOG_ERROR, "keyframe:%d coder:%d\n", p->key_frame, f->ac);
+        av_log(avctx, AV_LOG_ERROR, "keyframe:%d coder:%d slices:%d\n", p->key_frame, f->ac, f->slice_count);
 
     if(!f->ac){
         bytes_read = c->bytestream - c->bytestream_start - 1;
         if(bytes_read ==0) av_log(avctx, AV_LOG_ERROR, "error at end of AC stream\n"); //FIXME
 //printf("pos=%d\n", bytes_read);
-        init_get_bits(&f->gb, buf + bytes_read, buf_size - bytes_read);
+        init_get_bits(&fs->gb, buf + bytes_read, FFMAX(buf_p - buf - bytes_read, 0)*8);
     } else {
         bytes_read = 0; /* avoid warning */
     }
 
-    if(f->colorspace==0){
-        const int chroma_width = -((-width )>>f->chroma_h_shift);
-        const int chroma_height= -((-height)>>f->chroma_v_shift);
-        decode_plane(f, p->data[0], width, height, p->linesize[0], 0);
-
-        decode_plane(f, p->data[1], chroma_width, chroma_height, p->linesize[1], 1);
-        decode_plane(f, p->data[2], chroma_width, chroma_height, p->linesize[2], 1);
-    }else{
-        decode_rgb_frame(f, (uint32_t*)p->data[0], width, height, p->linesize[0]/4);
-    }
-
-    emms_c();
+    avctx->execute(avctx, decode_slice, &f->slice_context[0], NULL, f->slice_count, sizeof(void*));
 
     f->picture_number++;
 
@@ -1115,11 +1287,14 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
 
     *data_size = sizeof(AVFrame);
 
+    if(f->version>1)
+        return buf_size;
+
     if(f->ac){
-        bytes_read= c->bytestream - c->bytestream_start - 1;
+        bytes_read= fs->c.bytestream - fs->c.bytestream_start - 1;
         if(bytes_read ==0) av_log(f->avctx, AV_LOG_ERROR, "error at end of frame\n");
     }else{
-        bytes_read+= (get_bits_count(&f->gb)+7)/8;
+        bytes_read+= (get_bits_count(&fs->gb)+7)/8;
     }
 
     return bytes_read;
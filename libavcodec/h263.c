@@ -41,6 +41,7 @@
 #include "mpeg4data.h"
 #include "mathops.h"
 #include "unary.h"
+#include "thread.h"
 
 //#undef NDEBUG
 //#include <assert.h>
@@ -3192,7 +3193,12 @@ static int mpeg4_decode_video_packet_header(MpegEncContext *s)
         return -1;
     }
     if(s->pict_type == FF_B_TYPE){
-        while(s->next_picture.mbskip_table[ s->mb_index2xy[ mb_num ] ]) mb_num++;
+        for(;;){
+            ff_thread_await_progress((AVFrame*)s->next_picture_ptr, mb_num / s->mb_width);
+            if(!s->next_picture.mbskip_table[ s->mb_index2xy[ mb_num ] ])
+                break;
+            mb_num++;
+        }
         if(mb_num >= s->mb_num) return -1; // slice contains just skipped MBs which where already decoded
     }
 
@@ -4344,6 +4350,9 @@ int ff_mpeg4_decode_mb(MpegEncContext *s,
             }
         }
 
+        /* the row of the future P Frame is also read by the direct mode */
+        ff_thread_await_progress((AVFrame*)s->next_picture_ptr, s->mb_y);
+
         /* if we skipped it in the future P Frame than skip it now too */
         s->mb_skipped= s->next_picture.mbskip_table[s->mb_y * s->mb_stride + s->mb_x]; // Note, skiptab=0 if last was GMC
 
@@ -4521,8 +4530,12 @@ end:
     if(s->codec_id==CODEC_ID_MPEG4){
         if(mpeg4_is_resync(s)){
             const int delta= s->mb_x + 1 == s->mb_width ? 2 : 1;
-            if(s->pict_type==FF_B_TYPE && s->next_picture.mbskip_table[xy + delta])
-                return SLICE_OK;
+            if(s->pict_type==FF_B_TYPE){
+                ff_thread_await_progress((AVFrame*)s->next_picture_ptr,
+                                         FFMIN(s->mb_y + (delta == 2), s->mb_height-1));
+                if(s->next_picture.mbskip_table[xy + delta])
+                    return SLICE_OK;
+            }
             return SLICE_END;
         }
     }
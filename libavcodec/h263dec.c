@@ -32,6 +32,7 @@
 #include "h263_parser.h"
 #include "mpeg4video_parser.h"
 #include "msmpeg4.h"
+#include "thread.h"
 
 //#define DEBUG
 //#define PRINT_FRAME_TIME
@@ -238,6 +239,7 @@ static int decode_slice(MpegEncContext *s){
                     if(++s->mb_x >= s->mb_width){
                         s->mb_x=0;
                         ff_draw_horiz_band(s, s->mb_y*mb_size, mb_size);
+                        ff_mpeg_report_row_progress(s, s->mb_y);
                         s->mb_y++;
                     }
                     return 0;
@@ -258,6 +260,7 @@ static int decode_slice(MpegEncContext *s){
         }
 
         ff_draw_horiz_band(s, s->mb_y*mb_size, mb_size);
+        ff_mpeg_report_row_progress(s, s->mb_y);
 
         s->mb_x= 0;
     }
@@ -556,7 +559,8 @@ retry:
 #endif
 
 #if HAVE_MMX
-    if(s->codec_id == CODEC_ID_MPEG4 && s->xvid_build && avctx->idct_algo == FF_IDCT_AUTO && (mm_flags & FF_MM_MMX)){
+    if(s->codec_id == CODEC_ID_MPEG4 && s->xvid_build && avctx->idct_algo == FF_IDCT_AUTO && (mm_flags & FF_MM_MMX)
+       && !((avctx->active_thread_type&FF_THREAD_FRAME) && s->coded_picture_number)){
         avctx->idct_algo= FF_IDCT_XVIDMMX;
         avctx->coded_width= 0; // force reinit
 //        dsputil_init(&s->dsp, avctx);
@@ -569,6 +573,13 @@ retry:
         /* FIXME: By the way H263 decoder is evolving it should have */
         /* an H263EncContext                                         */
 
+    if ((avctx->active_thread_type&FF_THREAD_FRAME) && s->coded_picture_number
+        && (s->width != avctx->coded_width || s->height != avctx->coded_height)) {
+        /* the other threads still decode frames of the previous size */
+        av_log(avctx, AV_LOG_ERROR, "cannot change the picture size with frame threading\n");
+        return -1;
+    }
+
     if (   s->width  != avctx->coded_width
         || s->height != avctx->coded_height) {
         /* H.263 could change picture size any time */
@@ -622,6 +633,12 @@ retry:
     if(MPV_frame_start(s, avctx) < 0)
         return -1;
 
+    /* The next frame needs the bitstream left over from a packed frame and
+     * the field motion vectors of an interlaced P-frame, known once this one
+     * is decoded. */
+    if (!s->divx_packed && (s->progressive_sequence || s->pict_type == FF_B_TYPE))
+        ff_thread_finish_setup(avctx);
+
     if (avctx->hwaccel) {
         if (avctx->hwaccel->start_frame(avctx, buf, buf_size) < 0)
             return -1;
@@ -732,10 +749,11 @@ AVCodec mpeg4_decoder = {
     NULL,
     ff_h263_decode_end,
     ff_h263_decode_frame,
-    CODEC_CAP_DRAW_HORIZ_BAND | CODEC_CAP_DR1 | CODEC_CAP_TRUNCATED | CODEC_CAP_DELAY,
+    CODEC_CAP_DRAW_HORIZ_BAND | CODEC_CAP_DR1 | CODEC_CAP_TRUNCATED | CODEC_CAP_DELAY | CODEC_CAP_FRAME_THREADS,
     .flush= ff_mpeg_flush,
     .long_name= NULL_IF_CONFIG_SMALL("MPEG-4 part 2"),
     .pix_fmts= ff_hwaccel_pixfmt_list_420,
+    .update_thread_context= ff_mpeg_update_thread_context,
 };
 
 AVCodec h263_decoder = {
@@ -28,12 +28,14 @@
  * huffyuv codec for libavcodec.
  */
 
+#include "libavutil/intreadwrite.h"
 #include "avcodec.h"
 #include "get_bits.h"
 #include "put_bits.h"
 #include "dsputil.h"
 
 #define VLC_BITS 11
+#define MAX_STRIPES 32
 
 #if HAVE_BIGENDIAN
 #define B 3
@@ -77,6 +79,8 @@ typedef struct HYuvContext{
     uint8_t *bitstream_buffer;
     unsigned int bitstream_buffer_size;
     DSPContext dsp;
+    int stripe_count;                       ///< number of stripes of the frames, 0 in the stripe contexts
+    struct HYuvContext *stripe_context[MAX_STRIPES]; ///< context of each stripe when there are several
 }HYuvContext;
 
 static const unsigned char classic_shift_luma[] = {
@@ -464,10 +468,67 @@ static av_cold int common_init(AVCodecContext *avctx){
     s->width= avctx->width;
     s->height= avctx->height;
     assert(s->width>0 && s->height>0);
+    s->stripe_count= 1;
 
     return 0;
 }
 
+/**
+ * Returns the first line of a stripe, or the height of the frame for
+ * stripe_count. Stripes start at multiples of 4 lines so that they keep the
+ * field and chroma line parities of the frame.
+ */
+static int stripe_y(HYuvContext *s, int i){
+    if(i == s->stripe_count)
+        return s->height;
+    return (s->height * i / s->stripe_count) & ~3;
+}
+
+static av_cold int alloc_stripe_contexts(HYuvContext *s){
+    int i;
+
+    for(i=0; i<s->stripe_count; i++){
+        HYuvContext *ss= av_mallocz(sizeof(HYuvContext));
+        if(!ss)
+            return -1;
+        s->stripe_context[i]= ss;
+        ss->width= s->width;
+        ss->bitstream_bpp= s->bitstream_bpp;
+        alloc_temp(ss);
+    }
+    return 0;
+}
+
+/**
+ * Gives each stripe context the state of the frame and its part of the
+ * picture. The stripe contexts keep their own temporary buffers and start
+ * with empty statistics.
+ */
+static void update_stripe_contexts(HYuvContext *s, AVFrame *p){
+    int i, j;
+
+    for(i=0; i<s->stripe_count; i++){
+        HYuvContext *ss= s->stripe_context[i];
+        const int y= stripe_y(s, i);
+        const int cy= s->bitstream_bpp==12 ? y>>1 : y;
+        uint8_t *temp[3];
+
+        memcpy(temp, ss->temp, sizeof(temp));
+        *ss= *s;
+        memcpy(ss->temp, temp, sizeof(temp));
+        memset(ss->stats, 0, sizeof(ss->stats));
+        ss->stripe_count= 0;
+        ss->height= stripe_y(s, i+1) - y;
+
+        ss->picture= *p;
+        ss->picture.data[0] += y*p->linesize[0];
+        if(s->bitstream_bpp<24){
+            for(j=1; j<3; j++)
+                ss->picture.data[j] += cy*p->linesize[j];
+        }
+    }
+}
+
 #if CONFIG_HUFFYUV_DECODER || CONFIG_FFVHUFF_DECODER
 static av_cold int decode_init(AVCodecContext *avctx)
 {
@@ -502,6 +563,13 @@ s->bgr32=1;
         interlace= (((uint8_t*)avctx->extradata)[2] & 0x30) >> 4;
         s->interlaced= (interlace==1) ? 1 : (interlace==2) ? 0 : s->interlaced;
         s->context= ((uint8_t*)avctx->extradata)[2] & 0x40 ? 1 : 0;
+        if(avctx->codec_id == CODEC_ID_FFVHUFF && ((uint8_t*)avctx->extradata)[3] > 1){
+            s->stripe_count= ((uint8_t*)avctx->extradata)[3];
+            if(s->stripe_count > FFMIN(MAX_STRIPES, s->height/32)){
+                av_log(avctx, AV_LOG_ERROR, "invalid stripe count %d\n", s->stripe_count);
+                return -1;
+            }
+        }
 
         if(read_huffman_tables(s, ((uint8_t*)avctx->extradata)+4, avctx->extradata_size) < 0)
             return -1;
@@ -559,6 +627,8 @@ s->bgr32=1;
     }
 
     alloc_temp(s);
+    if(s->stripe_count > 1 && alloc_stripe_contexts(s) < 0)
+        return -1;
 
 //    av_log(NULL, AV_LOG_DEBUG, "pred:%d bpp:%d hbpp:%d il:%d\n", s->predictor, s->bitstream_bpp, avctx->bits_per_coded_sample, s->interlaced);
 
@@ -647,12 +717,21 @@ static av_cold int encode_init(AVCodecContext *avctx)
         return -1;
     }
 
+    if(avctx->thread_count > 1){
+        if(avctx->codec->id != CODEC_ID_FFVHUFF){
+            av_log(avctx, AV_LOG_INFO, "stripes are not supported by huffyuv; use vcodec=ffvhuff to encode with several threads\n");
+        }else if(avctx->strict_std_compliance > FF_COMPLIANCE_EXPERIMENTAL){
+            av_log(avctx, AV_LOG_INFO, "stripes are still experimental, use vstrict=-2 / -strict -2 to encode with one stripe per thread\n");
+        }else
+            s->stripe_count= av_clip(avctx->thread_count, 1, FFMAX(1, FFMIN(MAX_STRIPES, s->height/32)));
+    }
+
     ((uint8_t*)avctx->extradata)[0]= s->predictor | (s->decorrelate << 6);
     ((uint8_t*)avctx->extradata)[1]= s->bitstream_bpp;
     ((uint8_t*)avctx->extradata)[2]= s->interlaced ? 0x10 : 0x20;
     if(s->context)
         ((uint8_t*)avctx->extradata)[2]|= 0x40;
-    ((uint8_t*)avctx->extradata)[3]= 0;
+    ((uint8_t*)avctx->extradata)[3]= s->stripe_count > 1 ? s->stripe_count : 0;
     s->avctx->extradata_size= 4;
 
     if(avctx->stats_in){
@@ -711,6 +790,8 @@ static av_cold int encode_init(AVCodecContext *avctx)
 //    printf("pred:%d bpp:%d hbpp:%d il:%d\n", s->predictor, s->bitstream_bpp, avctx->bits_per_coded_sample, s->interlaced);
 
     alloc_temp(s);
+    if(s->stripe_count > 1 && alloc_stripe_contexts(s) < 0)
+        return -1;
 
     s->picture_number=0;
 
@@ -943,7 +1024,7 @@ static void draw_slice(HYuvContext *s, int y){
     int h, cy;
     int offset[4];
 
-    if(s->avctx->draw_horiz_band==NULL)
+    if(s->avctx->draw_horiz_band==NULL || !s->stripe_count)
         return;
 
     h= y - s->last_slice_end;
@@ -966,44 +1047,17 @@ static void draw_slice(HYuvContext *s, int y){
     s->last_slice_end= y + h;
 }
 
-static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPacket *avpkt){
-    const uint8_t *buf = avpkt->data;
-    int buf_size = avpkt->size;
-    HYuvContext *s = avctx->priv_data;
+/**
+ * Decodes the picture of the context from its bitstream reader, the whole
+ * frame or one stripe of it.
+ */
+static int decode_stripe(HYuvContext *s){
+    AVCodecContext *avctx= s->avctx;
     const int width= s->width;
     const int width2= s->width>>1;
     const int height= s->height;
     int fake_ystride, fake_ustride, fake_vstride;
     AVFrame * const p= &s->picture;
-    int table_size= 0;
-
-    AVFrame *picture = data;
-
-    av_fast_malloc(&s->bitstream_buffer, &s->bitstream_buffer_size, buf_size + FF_INPUT_BUFFER_PADDING_SIZE);
-    if (!s->bitstream_buffer)
-        return AVERROR(ENOMEM);
-
-    s->dsp.bswap_buf((uint32_t*)s->bitstream_buffer, (const uint32_t*)buf, buf_size/4);
-
-    if(p->data[0])
-        avctx->release_buffer(avctx, p);
-
-    p->reference= 0;
-    if(avctx->get_buffer(avctx, p) < 0){
-        av_log(avctx, AV_LOG_ERROR, "get_buffer() failed\n");
-        return -1;
-    }
-
-    if(s->context){
-        table_size = read_huffman_tables(s, s->bitstream_buffer, buf_size);
-        if(table_size < 0)
-            return -1;
-    }
-
-    if((unsigned)(buf_size-table_size) >= INT_MAX/8)
-        return -1;
-
-    init_get_bits(&s->gb, s->bitstream_buffer+table_size, (buf_size-table_size)*8);
 
     fake_ystride= s->interlaced ? p->linesize[0]*2  : p->linesize[0];
     fake_ustride= s->interlaced ? p->linesize[1]*2  : p->linesize[1];
@@ -1202,21 +1256,112 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
             return -1;
         }
     }
+    return 0;
+}
+
+static int decode_stripe_thread(AVCodecContext *avctx, void *arg){
+    HYuvContext *ss= *(void**)arg;
+    int ret= decode_stripe(ss);
+
+    emms_c();
+    return ret;
+}
+
+static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPacket *avpkt){
+    const uint8_t *buf = avpkt->data;
+    int buf_size = avpkt->size;
+    HYuvContext *s = avctx->priv_data;
+    AVFrame * const p= &s->picture;
+    int table_size= 0;
+    int ret, i;
+
+    AVFrame *picture = data;
+
+    av_fast_malloc(&s->bitstream_buffer, &s->bitstream_buffer_size, buf_size + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (!s->bitstream_buffer)
+        return AVERROR(ENOMEM);
+
+    s->dsp.bswap_buf((uint32_t*)s->bitstream_buffer, (const uint32_t*)buf, buf_size/4);
+
+    if(p->data[0])
+        avctx->release_buffer(avctx, p);
+
+    p->reference= 0;
+    if(avctx->get_buffer(avctx, p) < 0){
+        av_log(avctx, AV_LOG_ERROR, "get_buffer() failed\n");
+        return -1;
+    }
+
+    if(s->context){
+        table_size = read_huffman_tables(s, s->bitstream_buffer, buf_size);
+        if(table_size < 0)
+            return -1;
+    }
+
+    if((unsigned)(buf_size-table_size) >= INT_MAX/8)
+        return -1;
+
+    if(s->stripe_count > 1){
+        /* The stripes follow a table of their sizes in 32 bit words,
+         * which starts at the first word after the huffman tables. */
+        const uint8_t *table= s->bitstream_buffer + FFALIGN(table_size, 4);
+        const uint8_t *stripe= table + 4*s->stripe_count;
+        const uint8_t *end= s->bitstream_buffer + buf_size;
+        int rets[MAX_STRIPES];
+
+        if(stripe > end){
+            av_log(avctx, AV_LOG_ERROR, "stripe table is truncated\n");
+            return -1;
+        }
+        update_stripe_contexts(s, p);
+        for(i=0; i<s->stripe_count; i++){
+            unsigned int size= AV_RB32(table + 4*i);
+
+            if(size > end - stripe){
+                av_log(avctx, AV_LOG_ERROR, "stripe %d size is invalid\n", i);
+                return -1;
+            }
+            init_get_bits(&s->stripe_context[i]->gb, stripe, size*8);
+            stripe += size;
+        }
+
+        avctx->execute(avctx, decode_stripe_thread, s->stripe_context, rets, s->stripe_count, sizeof(void*));
+        for(i=0; i<s->stripe_count; i++)
+            if(rets[i] < 0)
+                return rets[i];
+
+        s->last_slice_end= 0;
+        draw_slice(s, s->height);
+        ret= buf_size;
+    }else{
+        init_get_bits(&s->gb, s->bitstream_buffer+table_size, (buf_size-table_size)*8);
+
+        if(decode_stripe(s) < 0)
+            return -1;
+        ret= (get_bits_count(&s->gb)+31)/32*4 + table_size;
+    }
     emms_c();
 
     *picture= *p;
     *data_size = sizeof(AVFrame);
 
-    return (get_bits_count(&s->gb)+31)/32*4 + table_size;
+    return ret;
 }
 #endif /* CONFIG_HUFFYUV_DECODER || CONFIG_FFVHUFF_DECODER */
 
 static int common_end(HYuvContext *s){
-    int i;
+    int i, j;
 
     for(i=0; i<3; i++){
         av_freep(&s->temp[i]);
     }
+    for(j=0; j<MAX_STRIPES; j++){
+        if(!s->stripe_context[j])
+            continue;
+        for(i=0; i<3; i++)
+            av_freep(&s->stripe_context[j]->temp[i]);
+        av_freep(&s->stripe_context[j]);
+    }
     return 0;
 }
 
@@ -1238,36 +1383,19 @@ static av_cold int decode_end(AVCodecContext *avctx)
 #endif /* CONFIG_HUFFYUV_DECODER || CONFIG_FFVHUFF_DECODER */
 
 #if CONFIG_HUFFYUV_ENCODER || CONFIG_FFVHUFF_ENCODER
-static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
-    HYuvContext *s = avctx->priv_data;
-    AVFrame *pict = data;
+/**
+ * Encodes the picture of the context with its bitstream writer, the whole
+ * frame or one stripe of it.
+ */
+static int encode_stripe(HYuvContext *s){
+    AVCodecContext *avctx= s->avctx;
+    AVFrame * const p= &s->picture;
     const int width= s->width;
     const int width2= s->width>>1;
     const int height= s->height;
-    const int fake_ystride= s->interlaced ? pict->linesize[0]*2  : pict->linesize[0];
-    const int fake_ustride= s->interlaced ? pict->linesize[1]*2  : pict->linesize[1];
-    const int fake_vstride= s->interlaced ? pict->linesize[2]*2  : pict->linesize[2];
-    AVFrame * const p= &s->picture;
-    int i, j, size=0;
-
-    *p = *pict;
-    p->pict_type= FF_I_TYPE;
-    p->key_frame= 1;
-
-    if(s->context){
-        for(i=0; i<3; i++){
-            generate_len_table(s->len[i], s->stats[i], 256);
-            if(generate_bits_table(s->bits[i], s->len[i])<0)
-                return -1;
-            size+= store_table(s, s->len[i], &buf[size]);
-        }
-
-        for(i=0; i<3; i++)
-            for(j=0; j<256; j++)
-                s->stats[i][j] >>= 1;
-    }
-
-    init_put_bits(&s->pb, buf+size, buf_size-size);
+    const int fake_ystride= s->interlaced ? p->linesize[0]*2  : p->linesize[0];
+    const int fake_ustride= s->interlaced ? p->linesize[1]*2  : p->linesize[1];
+    const int fake_vstride= s->interlaced ? p->linesize[2]*2  : p->linesize[2];
 
     if(avctx->pix_fmt == PIX_FMT_YUV422P || avctx->pix_fmt == PIX_FMT_YUV420P){
         int lefty, leftu, leftv, y, cy;
@@ -1281,7 +1409,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
         leftu= sub_left_prediction(s, s->temp[1], p->data[1], width2, 0);
         leftv= sub_left_prediction(s, s->temp[2], p->data[2], width2, 0);
 
-        encode_422_bitstream(s, 2, width-2);
+        if(encode_422_bitstream(s, 2, width-2) < 0)
+            return -1;
 
         if(s->predictor==MEDIAN){
             int lefttopy, lefttopu, lefttopv;
@@ -1291,7 +1420,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
                 leftu= sub_left_prediction(s, s->temp[1], p->data[1]+p->linesize[1], width2, leftu);
                 leftv= sub_left_prediction(s, s->temp[2], p->data[2]+p->linesize[2], width2, leftv);
 
-                encode_422_bitstream(s, 0, width);
+                if(encode_422_bitstream(s, 0, width) < 0)
+                    return -1;
                 y++; cy++;
             }
 
@@ -1299,7 +1429,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
             leftu= sub_left_prediction(s, s->temp[1], p->data[1]+fake_ustride, 2, leftu);
             leftv= sub_left_prediction(s, s->temp[2], p->data[2]+fake_vstride, 2, leftv);
 
-            encode_422_bitstream(s, 0, 4);
+            if(encode_422_bitstream(s, 0, 4) < 0)
+                return -1;
 
             lefttopy= p->data[0][3];
             lefttopu= p->data[1][1];
@@ -1307,7 +1438,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
             s->dsp.sub_hfyu_median_prediction(s->temp[0], p->data[0]+4, p->data[0] + fake_ystride+4, width-4 , &lefty, &lefttopy);
             s->dsp.sub_hfyu_median_prediction(s->temp[1], p->data[1]+2, p->data[1] + fake_ustride+2, width2-2, &leftu, &lefttopu);
             s->dsp.sub_hfyu_median_prediction(s->temp[2], p->data[2]+2, p->data[2] + fake_vstride+2, width2-2, &leftv, &lefttopv);
-            encode_422_bitstream(s, 0, width-4);
+            if(encode_422_bitstream(s, 0, width-4) < 0)
+                return -1;
             y++; cy++;
 
             for(; y<height; y++,cy++){
@@ -1317,7 +1449,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
                     while(2*cy > y){
                         ydst= p->data[0] + p->linesize[0]*y;
                         s->dsp.sub_hfyu_median_prediction(s->temp[0], ydst - fake_ystride, ydst, width , &lefty, &lefttopy);
-                        encode_gray_bitstream(s, width);
+                        if(encode_gray_bitstream(s, width) < 0)
+                            return -1;
                         y++;
                     }
                     if(y>=height) break;
@@ -1330,7 +1463,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
                 s->dsp.sub_hfyu_median_prediction(s->temp[1], udst - fake_ustride, udst, width2, &leftu, &lefttopu);
                 s->dsp.sub_hfyu_median_prediction(s->temp[2], vdst - fake_vstride, vdst, width2, &leftv, &lefttopv);
 
-                encode_422_bitstream(s, 0, width);
+                if(encode_422_bitstream(s, 0, width) < 0)
+                    return -1;
             }
         }else{
             for(cy=y=1; y<height; y++,cy++){
@@ -1347,7 +1481,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
                     }else{
                         lefty= sub_left_prediction(s, s->temp[0], ydst, width , lefty);
                     }
-                    encode_gray_bitstream(s, width);
+                    if(encode_gray_bitstream(s, width) < 0)
+                        return -1;
                     y++;
                     if(y>=height) break;
                 }
@@ -1370,7 +1505,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
                     leftv= sub_left_prediction(s, s->temp[2], vdst, width2, leftv);
                 }
 
-                encode_422_bitstream(s, 0, width);
+                if(encode_422_bitstream(s, 0, width) < 0)
+                    return -1;
             }
         }
     }else if(avctx->pix_fmt == PIX_FMT_RGB32){
@@ -1386,7 +1522,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
         put_bits(&s->pb, 8, 0);
 
         sub_left_prediction_bgr32(s, s->temp[0], data+4, width-1, &leftr, &leftg, &leftb);
-        encode_bgr_bitstream(s, width-1);
+        if(encode_bgr_bitstream(s, width-1) < 0)
+            return -1;
 
         for(y=1; y<s->height; y++){
             uint8_t *dst = data + y*stride;
@@ -1396,17 +1533,96 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
             }else{
                 sub_left_prediction_bgr32(s, s->temp[0], dst, width, &leftr, &leftg, &leftb);
             }
-            encode_bgr_bitstream(s, width);
+            if(encode_bgr_bitstream(s, width) < 0)
+                return -1;
         }
     }else{
         av_log(avctx, AV_LOG_ERROR, "Format not supported!\n");
+        return -1;
     }
+    return 0;
+}
+
+static int encode_stripe_thread(AVCodecContext *avctx, void *arg){
+    HYuvContext *ss= *(void**)arg;
+    int ret= encode_stripe(ss);
+
     emms_c();
+    return ret;
+}
+
+static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
+    HYuvContext *s = avctx->priv_data;
+    AVFrame *pict = data;
+    AVFrame * const p= &s->picture;
+    int i, j, k, size=0;
+    int rets[MAX_STRIPES];
+
+    *p = *pict;
+    p->pict_type= FF_I_TYPE;
+    p->key_frame= 1;
+
+    if(s->context){
+        for(i=0; i<3; i++){
+            generate_len_table(s->len[i], s->stats[i], 256);
+            if(generate_bits_table(s->bits[i], s->len[i])<0)
+                return -1;
+            size+= store_table(s, s->len[i], &buf[size]);
+        }
 
-    size+= (put_bits_count(&s->pb)+31)/8;
-    put_bits(&s->pb, 16, 0);
-    put_bits(&s->pb, 15, 0);
-    size/= 4;
+        for(i=0; i<3; i++)
+            for(j=0; j<256; j++)
+                s->stats[i][j] >>= 1;
+    }
+
+    if(s->stripe_count > 1){
+        /* Each stripe is written to its part of buf, then moved after the
+         * previous one, and its size is stored in the table before them. */
+        const int table= FFALIGN(size, 4);
+        const int stripes= table + 4*s->stripe_count;
+        const int stripe_buf_size= ((buf_size - stripes) / s->stripe_count) & ~3;
+        uint8_t *dst= buf + stripes;
+
+        memset(buf + size, 0, table - size);
+        update_stripe_contexts(s, p);
+        for(i=0; i<s->stripe_count; i++)
+            init_put_bits(&s->stripe_context[i]->pb, dst + i*stripe_buf_size, stripe_buf_size);
+
+        avctx->execute(avctx, encode_stripe_thread, s->stripe_context, rets, s->stripe_count, sizeof(void*));
+        for(i=0; i<s->stripe_count; i++)
+            if(rets[i] < 0)
+                return -1;
+
+        for(i=0; i<s->stripe_count; i++){
+            HYuvContext *ss= s->stripe_context[i];
+            const int bytes= (put_bits_count(&ss->pb)+31)/32*4;
+
+            put_bits(&ss->pb, 16, 0);
+            put_bits(&ss->pb, 15, 0);
+            flush_put_bits(&ss->pb);
+            memmove(dst, ss->pb.buf, bytes);
+            AV_WB32(buf + table + 4*i, bytes);
+            dst += bytes;
+
+            for(j=0; j<3; j++)
+                for(k=0; k<256; k++)
+                    s->stats[j][k] += ss->stats[j][k];
+        }
+        size= (dst - buf)/4;
+    }else{
+        init_put_bits(&s->pb, buf+size, buf_size-size);
+
+        if(encode_stripe(s) < 0){
+            emms_c();
+            return -1;
+        }
+
+        size+= (put_bits_count(&s->pb)+31)/8;
+        put_bits(&s->pb, 16, 0);
+        put_bits(&s->pb, 15, 0);
+        size/= 4;
+    }
+    emms_c();
 
     if((s->flags&CODEC_FLAG_PASS1) && (s->picture_number&31)==0){
         int j;
@@ -1424,7 +1640,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
     } else
         avctx->stats_out[0] = '\0';
     if(!(s->avctx->flags2 & CODEC_FLAG2_NO_OUTPUT)){
-        flush_put_bits(&s->pb);
+        if(s->stripe_count == 1)
+            flush_put_bits(&s->pb);
         s->dsp.bswap_buf((uint32_t*)buf, (uint32_t*)buf, size);
     }
 
@@ -42,4 +42,10 @@ int ff_is_hwaccel_pix_fmt(enum PixelFormat pix_fmt);
  */
 AVHWAccel *ff_find_hwaccel(enum CodecID codec_id, enum PixelFormat pix_fmt);
 
+/**
+ * Lock manager registered with av_lockmgr_register(), NULL if none is.
+ * Codecs may only be opened and closed by several threads at once if it is set.
+ */
+extern int (*ff_lockmgr_cb)(void **mutex, enum AVLockOp op);
+
 #endif /* AVCODEC_INTERNAL_H */
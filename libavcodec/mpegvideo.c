@@ -31,6 +31,7 @@
 #include "dsputil.h"
 #include "mpegvideo.h"
 #include "mpegvideo_common.h"
+#include "thread.h"
 #include "mjpegenc.h"
 #include "msmpeg4.h"
 #include "faandct.h"
@@ -170,8 +171,9 @@ void ff_copy_picture(Picture *dst, Picture *src){
  */
 static void free_frame_buffer(MpegEncContext *s, Picture *pic)
 {
-    s->avctx->release_buffer(s->avctx, (AVFrame*)pic);
+    ff_thread_release_buffer(s->avctx, (AVFrame*)pic);
     av_freep(&pic->hwaccel_picture_private);
+    pic->release_number= s->coded_picture_number;
 }
 
 /**
@@ -192,13 +194,14 @@ static int alloc_frame_buffer(MpegEncContext *s, Picture *pic)
         }
     }
 
-    r = s->avctx->get_buffer(s->avctx, (AVFrame*)pic);
+    r = ff_thread_get_buffer(s->avctx, (AVFrame*)pic);
 
     if (r<0 || !pic->age || !pic->type || !pic->data[0]) {
         av_log(s->avctx, AV_LOG_ERROR, "get_buffer() failed (%d %d %d %p)\n", r, pic->age, pic->type, pic->data[0]);
         av_freep(&pic->hwaccel_picture_private);
         return -1;
     }
+    pic->owner2= s;
 
     if (s->linesize && (s->linesize != pic->linesize[0] || s->uvlinesize != pic->linesize[1])) {
         av_log(s->avctx, AV_LOG_ERROR, "get_buffer() failed (stride changed)\n");
@@ -708,7 +711,9 @@ void MPV_common_end(MpegEncContext *s)
     av_freep(&s->reordered_input_picture);
     av_freep(&s->dct_offset);
 
-    if(s->picture){
+    /* with frame threading the pictures are shared with the other copies of
+     * the context and freed by the first one */
+    if(s->picture && !s->avctx->is_copy){
         for(i=0; i<MAX_PICTURE_COUNT; i++){
             free_picture(s, &s->picture[i]);
         }
@@ -817,6 +822,20 @@ void init_vlc_rl(RLTable *rl)
     }
 }
 
+/**
+ * Checks whether a picture can be allocated again. With frame threading the
+ * threads decoding the previous frames may still read the tables of a
+ * released picture, until as many pictures as there can be threads were
+ * allocated since.
+ */
+static inline int is_unused_picture(MpegEncContext *s, Picture *pic)
+{
+    if(pic->data[0])
+        return 0;
+    return !(s->avctx->active_thread_type&FF_THREAD_FRAME) || !pic->qscale_table
+           || s->coded_picture_number - pic->release_number >= MAX_FRAME_THREADS;
+}
+
 int ff_find_unused_picture(MpegEncContext *s, int shared){
     int i;
 
@@ -826,10 +845,10 @@ int ff_find_unused_picture(MpegEncContext *s, int shared){
         }
     }else{
         for(i=0; i<MAX_PICTURE_COUNT; i++){
-            if(s->picture[i].data[0]==NULL && s->picture[i].type!=0) return i; //FIXME
+            if(is_unused_picture(s, &s->picture[i]) && s->picture[i].type!=0) return i; //FIXME
         }
         for(i=0; i<MAX_PICTURE_COUNT; i++){
-            if(s->picture[i].data[0]==NULL) return i;
+            if(is_unused_picture(s, &s->picture[i])) return i;
         }
     }
 
@@ -871,6 +890,7 @@ static void update_noise_reduction(MpegEncContext *s){
  */
 int MPV_frame_start(MpegEncContext *s, AVCodecContext *avctx)
 {
+    const int frame_threading= avctx->active_thread_type&FF_THREAD_FRAME;
     int i;
     Picture *pic;
     s->mb_skipped = 0;
@@ -880,25 +900,38 @@ int MPV_frame_start(MpegEncContext *s, AVCodecContext *avctx)
     /* mark&release old frames */
     if (s->pict_type != FF_B_TYPE && s->last_picture_ptr && s->last_picture_ptr != s->next_picture_ptr && s->last_picture_ptr->data[0]) {
       if(s->out_format != FMT_H264 || s->codec_id == CODEC_ID_SVQ3){
-          free_frame_buffer(s, s->last_picture_ptr);
+          if(!frame_threading || s->last_picture_ptr->owner2 == s)
+              free_frame_buffer(s, s->last_picture_ptr);
 
         /* release forgotten pictures */
         /* if(mpeg124/h263) */
         if(!s->encoding){
             for(i=0; i<MAX_PICTURE_COUNT; i++){
-                if(s->picture[i].data[0] && &s->picture[i] != s->next_picture_ptr && s->picture[i].reference){
-                    av_log(avctx, AV_LOG_ERROR, "releasing zombie picture\n");
+                if(s->picture[i].data[0] && &s->picture[i] != s->next_picture_ptr && s->picture[i].reference
+                   && (!frame_threading || s->picture[i].owner2 == s)){
+                    if(!frame_threading)
+                        av_log(avctx, AV_LOG_ERROR, "releasing zombie picture\n");
                     free_frame_buffer(s, &s->picture[i]);
                 }
             }
         }
       }
+    }else if(frame_threading && !s->encoding){
+        /* The pictures are released by the thread that allocated them, the
+         * next time it decodes a frame, which can be a B-frame. */
+        for(i=0; i<MAX_PICTURE_COUNT; i++){
+            if(s->picture[i].data[0] && s->picture[i].reference && s->picture[i].owner2 == s
+               && &s->picture[i] != s->next_picture_ptr && &s->picture[i] != s->last_picture_ptr){
+                free_frame_buffer(s, &s->picture[i]);
+            }
+        }
     }
 alloc:
     if(!s->encoding){
         /* release non reference frames */
         for(i=0; i<MAX_PICTURE_COUNT; i++){
-            if(s->picture[i].data[0] && !s->picture[i].reference /*&& s->picture[i].type!=FF_BUFFER_TYPE_SHARED*/){
+            if(s->picture[i].data[0] && !s->picture[i].reference /*&& s->picture[i].type!=FF_BUFFER_TYPE_SHARED*/
+               && (!frame_threading || s->picture[i].owner2 == s)){
                 free_frame_buffer(s, &s->picture[i]);
             }
         }
@@ -952,6 +985,8 @@ alloc:
     if(s->pict_type != FF_I_TYPE && (s->last_picture_ptr==NULL || s->last_picture_ptr->data[0]==NULL) && !s->dropable && s->codec_id != CODEC_ID_H264){
         av_log(avctx, AV_LOG_ERROR, "warning: first frame is no keyframe\n");
         assert(s->pict_type != FF_B_TYPE); //these should have been dropped if we don't have a reference
+        /* nothing is decoded into the picture that replaces the reference */
+        ff_thread_report_progress((AVFrame*)s->current_picture_ptr, INT_MAX);
         goto alloc;
     }
 
@@ -1010,7 +1045,10 @@ void MPV_frame_end(MpegEncContext *s)
        && s->unrestricted_mv
        && s->current_picture.reference
        && !s->intra_only
-       && !(s->flags&CODEC_FLAG_EMU_EDGE)) {
+       && !(s->flags&CODEC_FLAG_EMU_EDGE)
+       && (!(s->avctx->active_thread_type&FF_THREAD_FRAME) || (s->error_recognition && s->error_count))) {
+            /* with frame threading the edges were drawn along with the rows
+             * by ff_mpeg_report_row_progress() unless there were errors */
             s->dsp.draw_edges(s->current_picture.data[0], s->linesize  , s->h_edge_pos   , s->v_edge_pos   , EDGE_WIDTH  );
             s->dsp.draw_edges(s->current_picture.data[1], s->uvlinesize, s->h_edge_pos>>1, s->v_edge_pos>>1, EDGE_WIDTH/2);
             s->dsp.draw_edges(s->current_picture.data[2], s->uvlinesize, s->h_edge_pos>>1, s->v_edge_pos>>1, EDGE_WIDTH/2);
@@ -1048,6 +1086,9 @@ void MPV_frame_end(MpegEncContext *s)
     memset(&s->current_picture, 0, sizeof(Picture));
 #endif
     s->avctx->coded_frame= (AVFrame*)s->current_picture_ptr;
+
+    if(s->avctx->active_thread_type&FF_THREAD_FRAME)
+        ff_thread_report_progress((AVFrame*)s->current_picture_ptr, INT_MAX);
 }
 
 /**
@@ -1769,6 +1810,39 @@ void ff_clean_intra_table_entries(MpegEncContext *s)
     s->mbintra_table[xy]= 0;
 }
 
+/**
+ * Returns the last macroblock row of the reference picture in the given
+ * direction that the motion compensation of the current macroblock reads,
+ * including the pixels the interpolation filters need.
+ */
+static int lowest_referenced_row(MpegEncContext *s, int dir)
+{
+    int my_max= INT_MIN, my_min= INT_MAX, qpel_shift= !s->quarter_sample;
+    int i, mvs, off;
+
+    if (s->picture_structure != PICT_FRAME || s->mcsel)
+        return s->mb_height-1;
+
+    switch (s->mv_type) {
+    case MV_TYPE_16X16: mvs= 1; break;
+    case MV_TYPE_16X8:  mvs= 2; break;
+    case MV_TYPE_8X8:   mvs= 4; break;
+    default:
+        return s->mb_height-1;
+    }
+
+    for (i = 0; i < mvs; i++) {
+        int my= s->mv[dir][i][1] << qpel_shift;
+        my_max= FFMAX(my_max, my);
+        my_min= FFMIN(my_min, my);
+    }
+
+    /* in quarter pixels, with 4 more pixels for the filter taps */
+    off= (FFMAX(-my_min, my_max) + 16 + 63) >> 6;
+
+    return FFMIN(s->mb_y + off, s->mb_height-1);
+}
+
 /* generic function called after a macroblock has been parsed by the
    decoder or after it has been encoded by the encoder.
 
@@ -1879,6 +1953,13 @@ void MPV_decode_mb_internal(MpegEncContext *s, DCTELEM block[12][64],
                         MPV_motion_lowres(s, dest_y, dest_cb, dest_cr, 1, s->next_picture.data, op_pix);
                     }
                 }else{
+                    if (s->avctx->active_thread_type&FF_THREAD_FRAME) {
+                        if (s->mv_dir & MV_DIR_FORWARD)
+                            ff_thread_await_progress((AVFrame*)s->last_picture_ptr, lowest_referenced_row(s, 0));
+                        if (s->mv_dir & MV_DIR_BACKWARD)
+                            ff_thread_await_progress((AVFrame*)s->next_picture_ptr, lowest_referenced_row(s, 1));
+                    }
+
                     op_qpix= s->me.qpel_put;
                     if ((!s->no_rounding) || s->pict_type==FF_B_TYPE){
                         op_pix = s->dsp.put_pixels_tab;
@@ -2095,6 +2176,157 @@ void ff_init_block_index(MpegEncContext *s){ //FIXME maybe rename
     }
 }
 
+/**
+ * Draws the edges of the rows y to y + h - 1 of a plane, the way
+ * DSPContext.draw_edges() does for the whole plane.
+ */
+static void draw_edges_rows(uint8_t *buf, int wrap, int width, int height, int w, int y, int h)
+{
+    uint8_t *ptr= buf + y*wrap;
+    int i;
+
+    h= FFMIN(h, height - y);
+    for(i=0; i<h; i++){
+        memset(ptr - w, ptr[0], w);
+        memset(ptr + width, ptr[width-1], w);
+        ptr += wrap;
+    }
+    if(y == 0){
+        for(i=0; i<w; i++)
+            memcpy(buf - (i+1)*wrap - w, buf - w, width + 2*w);
+    }
+    if(y + h >= height){
+        for(i=0; i<w; i++)
+            memcpy(buf + (height+i)*wrap - w, buf + (height-1)*wrap - w, width + 2*w);
+    }
+}
+
+/**
+ * Tells the threads decoding the next frames that the given macroblock row
+ * of the current picture is decoded, once its edges are drawn. Does
+ * nothing without frame threading, or after an error, in which case the
+ * picture is only usable once the error concealment is done.
+ */
+void ff_mpeg_report_row_progress(MpegEncContext *s, int mb_y)
+{
+    if(!(s->avctx->active_thread_type&FF_THREAD_FRAME) || !s->current_picture.reference
+       || (s->error_recognition && s->error_count == INT_MAX))
+        return;
+
+    if(s->unrestricted_mv && !s->intra_only && !(s->flags&CODEC_FLAG_EMU_EDGE)){
+        const int y= mb_y*16;
+
+        draw_edges_rows(s->current_picture.data[0], s->linesize  , s->h_edge_pos   , s->v_edge_pos   , EDGE_WIDTH  , y   , 16);
+        draw_edges_rows(s->current_picture.data[1], s->uvlinesize, s->h_edge_pos>>1, s->v_edge_pos>>1, EDGE_WIDTH/2, y>>1, 8);
+        draw_edges_rows(s->current_picture.data[2], s->uvlinesize, s->h_edge_pos>>1, s->v_edge_pos>>1, EDGE_WIDTH/2, y>>1, 8);
+    }
+
+    ff_thread_report_progress((AVFrame*)s->current_picture_ptr, mb_y);
+}
+
+/**
+ * Returns the picture of s at the same place as pic in the pictures of s1.
+ */
+static Picture *rebase_picture_ptr(MpegEncContext *s, MpegEncContext *s1, Picture *pic)
+{
+    return pic ? s->picture + (pic - s1->picture) : NULL;
+}
+
+/**
+ * Copies the state of the decoder from the context of the thread that
+ * decoded the previous frame, for frame threading.
+ */
+int ff_mpeg_update_thread_context(AVCodecContext *dst, const AVCodecContext *src)
+{
+    MpegEncContext *s= dst->priv_data, *s1= src->priv_data;
+
+    if(!s1->context_initialized)
+        return 0;
+
+    // the picture size or the IDCT changed at the first frame
+    if(s->context_initialized &&
+       (s->width != s1->width || s->height != s1->height ||
+        s->dsp.idct_permutation_type != s1->dsp.idct_permutation_type))
+        MPV_common_end(s);
+
+    if(!s->context_initialized){
+        memcpy(s, s1, sizeof(MpegEncContext));
+
+        s->avctx= dst;
+        s->bitstream_buffer= NULL;
+        s->bitstream_buffer_size= s->allocated_bitstream_buffer_size= 0;
+        s->parse_context.buffer= NULL;
+        s->parse_context.buffer_size= 0;
+        memset(s->visualization_buffer, 0, sizeof(s->visualization_buffer));
+
+        if(MPV_common_init(s) < 0)
+            return -1;
+    }
+
+    s->picture_number      = s1->picture_number;
+    s->coded_picture_number= s1->coded_picture_number;
+    s->input_picture_number= s1->input_picture_number;
+
+    memcpy(s->picture, s1->picture, MAX_PICTURE_COUNT*sizeof(Picture));
+    s->last_picture   = s1->last_picture;
+    s->current_picture= s1->current_picture;
+    s->next_picture   = s1->next_picture;
+
+    s->last_picture_ptr   = rebase_picture_ptr(s, s1, s1->last_picture_ptr);
+    s->current_picture_ptr= rebase_picture_ptr(s, s1, s1->current_picture_ptr);
+    s->next_picture_ptr   = rebase_picture_ptr(s, s1, s1->next_picture_ptr);
+
+    memcpy(s->prev_pict_types, s1->prev_pict_types, PREV_PICT_TYPES_BUFFER_SIZE);
+
+    // the previous frame may still be decoding, these are only set once it is done
+    s->last_pict_type= s1->pict_type;
+    if(s1->pict_type != FF_B_TYPE)
+        s->last_non_b_pict_type= s1->pict_type;
+    else
+        s->last_non_b_pict_type= s1->last_non_b_pict_type;
+
+    // MPEG-4 headers
+    memcpy(&s->time_increment_bits, &s1->time_increment_bits, (char*)&s1->mcsel - (char*)&s1->time_increment_bits);
+    memcpy(&s->quant_precision, &s1->quant_precision, (char*)&s1->tex_pb - (char*)&s1->quant_precision);
+    s->mpeg_quant= s1->mpeg_quant;
+    s->t_frame   = s1->t_frame;
+    memcpy(s->intra_matrix       , s1->intra_matrix       , sizeof(s->intra_matrix));
+    memcpy(s->chroma_intra_matrix, s1->chroma_intra_matrix, sizeof(s->chroma_intra_matrix));
+    memcpy(s->inter_matrix       , s1->inter_matrix       , sizeof(s->inter_matrix));
+    memcpy(s->chroma_inter_matrix, s1->chroma_inter_matrix, sizeof(s->chroma_inter_matrix));
+    s->progressive_sequence= s1->progressive_sequence;
+
+    s->divx_version= s1->divx_version;
+    s->divx_build  = s1->divx_build;
+    s->divx_packed = s1->divx_packed;
+    s->xvid_build  = s1->xvid_build;
+    s->lavc_build  = s1->lavc_build;
+
+    if(s1->bitstream_buffer_size){
+        av_fast_malloc(&s->bitstream_buffer, &s->allocated_bitstream_buffer_size,
+                       s1->bitstream_buffer_size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if(!s->bitstream_buffer)
+            return AVERROR(ENOMEM);
+        memcpy(s->bitstream_buffer, s1->bitstream_buffer, s1->bitstream_buffer_size);
+    }
+    s->bitstream_buffer_size= s1->bitstream_buffer_size;
+
+    // field motion vectors of the last P-frame, for direct mode in the next B-frames
+    if(!s1->progressive_sequence && s1->p_field_mv_table_base[0][0]){
+        const int mv_table_size= (s->mb_height+2) * s->mb_stride + 1;
+        const int mb_array_size= s->mb_height * s->mb_stride;
+        int i, j;
+
+        for(i=0; i<2; i++){
+            for(j=0; j<2; j++)
+                memcpy(s->p_field_mv_table_base[i][j], s1->p_field_mv_table_base[i][j], mv_table_size * 2 * sizeof(int16_t));
+            memcpy(s->p_field_select_table[i], s1->p_field_select_table[i], mb_array_size * 2 * sizeof(uint8_t));
+        }
+    }
+
+    return 0;
+}
+
 void ff_mpeg_flush(AVCodecContext *avctx){
     int i;
     MpegEncContext *s = avctx->priv_data;
@@ -131,6 +131,8 @@ typedef struct Picture{
     uint8_t *mb_mean;           ///< Table for MB luminance
     int32_t *mb_cmp_score;      ///< Table for MB cmp scores, for mb decision FIXME remove
     int b_frame_score;          /* */
+    struct MpegEncContext *owner2; ///< pointer to the context that allocated this picture
+    int release_number;         ///< coded_picture_number of the context when the picture was released
 } Picture;
 
 struct MpegEncContext;
@@ -694,6 +696,8 @@ void MPV_common_init_altivec(MpegEncContext *s);
 void ff_clean_intra_table_entries(MpegEncContext *s);
 void ff_draw_horiz_band(MpegEncContext *s, int y, int h);
 void ff_mpeg_flush(AVCodecContext *avctx);
+int ff_mpeg_update_thread_context(AVCodecContext *dst, const AVCodecContext *src);
+void ff_mpeg_report_row_progress(MpegEncContext *s, int mb_y);
 void ff_print_debug_info(MpegEncContext *s, AVFrame *pict);
 void ff_write_quant_matrix(PutBitContext *pb, uint16_t *matrix);
 int ff_find_unused_picture(MpegEncContext *s, int shared);
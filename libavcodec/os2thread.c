@@ -137,6 +137,7 @@ int avcodec_thread_init(AVCodecContext *s, int thread_count){
 //printf("init done\n"); fflush(stdout);
 
     s->execute= avcodec_thread_execute;
+    s->active_thread_type= FF_THREAD_SLICE;
 
     return 0;
 fail:
@@ -24,11 +24,28 @@
 #include <pthread.h>
 
 #include "avcodec.h"
+#include "thread.h"
 
 typedef int (action_func)(AVCodecContext *c, void *arg);
 
+/**
+ * Slice threading: the jobs given to execute() by all the contexts are run
+ * by one pool of worker threads shared by the whole process. Every context
+ * has its own queue of jobs, and an idle worker takes the next job of the
+ * context at the head of the queue of contexts, which is then moved to its
+ * end, so that concurrent contexts share the workers. The thread calling
+ * execute() runs jobs of its own context too, so it is never left waiting
+ * for workers busy with other contexts.
+ */
+
+/**
+ * Maximum number of worker threads of the pool, whatever the thread counts
+ * of the contexts are.
+ */
+#define MAX_POOL_THREADS 16
+
 typedef struct ThreadContext {
-    pthread_t *workers;
+    AVCodecContext *avctx;
     action_func *func;
     void *args;
     int *rets;
@@ -36,82 +53,128 @@ typedef struct ThreadContext {
     int job_count;
     int job_size;
 
-    pthread_cond_t last_job_cond;
-    pthread_cond_t current_job_cond;
-    pthread_mutex_t current_job_lock;
-    int current_job;
-    int done;
+    int next_job;                   ///< next job to be started
+    int jobs_done;                  ///< number of finished jobs
+    pthread_cond_t done_cond;       ///< signaled when all the jobs are finished
+    struct ThreadContext *next;     ///< next context in the queue of the pool
 } ThreadContext;
 
-static void* attribute_align_arg worker(void *v)
+typedef struct ThreadPool {
+    pthread_t workers[MAX_POOL_THREADS];
+    int nb_workers;
+    int idle_workers;               ///< number of workers waiting for jobs
+    int users;                      ///< number of contexts using the pool
+    int generation;                 ///< incremented when the workers must exit
+    ThreadContext *queue;           ///< contexts with jobs left to be started
+    pthread_cond_t work_cond;
+} ThreadPool;
+
+/** Protects the pool and the job state of all the contexts. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadPool pool = { .work_cond = PTHREAD_COND_INITIALIZER };
+
+static void queue_context(ThreadContext *c)
 {
-    AVCodecContext *avctx = v;
-    ThreadContext *c = avctx->thread_opaque;
-    int our_job = c->job_count;
-    int thread_count = avctx->thread_count;
-    int self_id;
-
-    pthread_mutex_lock(&c->current_job_lock);
-    self_id = c->current_job++;
-    for (;;){
-        while (our_job >= c->job_count) {
-            if (c->current_job == thread_count + c->job_count)
-                pthread_cond_signal(&c->last_job_cond);
-
-            pthread_cond_wait(&c->current_job_cond, &c->current_job_lock);
-            our_job = self_id;
-
-            if (c->done) {
-                pthread_mutex_unlock(&c->current_job_lock);
-                return NULL;
-            }
-        }
-        pthread_mutex_unlock(&c->current_job_lock);
+    ThreadContext **p = &pool.queue;
+    while (*p)
+        p = &(*p)->next;
+    c->next = NULL;
+    *p = c;
+}
 
-        c->rets[our_job%c->rets_count] = c->func(avctx, (char*)c->args + our_job*c->job_size);
+static void unqueue_context(ThreadContext *c)
+{
+    ThreadContext **p = &pool.queue;
+    while (*p && *p != c)
+        p = &(*p)->next;
+    if (*p)
+        *p = c->next;
+}
 
-        pthread_mutex_lock(&c->current_job_lock);
-        our_job = c->current_job++;
-    }
+static void run_job(ThreadContext *c, int job)
+{
+    c->rets[job%c->rets_count] = c->func(c->avctx, (char*)c->args + job*c->job_size);
 }
 
-static av_always_inline void avcodec_thread_park_workers(ThreadContext *c, int thread_count)
+static void* attribute_align_arg worker(void *v)
 {
-    pthread_cond_wait(&c->last_job_cond, &c->current_job_lock);
-    pthread_mutex_unlock(&c->current_job_lock);
+    int generation = (intptr_t)v;
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        ThreadContext *c;
+        int job;
+
+        while (!pool.queue && pool.generation == generation) {
+            pool.idle_workers++;
+            pthread_cond_wait(&pool.work_cond, &pool_lock);
+            pool.idle_workers--;
+        }
+        if (pool.generation != generation)
+            break;
+
+        c = pool.queue;
+        pool.queue = c->next;
+        job = c->next_job++;
+        if (c->next_job < c->job_count)
+            queue_context(c);
+        pthread_mutex_unlock(&pool_lock);
+
+        run_job(c, job);
+
+        pthread_mutex_lock(&pool_lock);
+        if (++c->jobs_done == c->job_count)
+            pthread_cond_signal(&c->done_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
 }
 
-void avcodec_thread_free(AVCodecContext *avctx)
+static void slice_thread_free(AVCodecContext *avctx)
 {
     ThreadContext *c = avctx->thread_opaque;
-    int i;
+    pthread_t workers[MAX_POOL_THREADS];
+    int i, nb_workers = 0;
 
-    pthread_mutex_lock(&c->current_job_lock);
-    c->done = 1;
-    pthread_cond_broadcast(&c->current_job_cond);
-    pthread_mutex_unlock(&c->current_job_lock);
+    pthread_mutex_lock(&pool_lock);
+    // the workers exit with the last context, so none are left running
+    // once libavcodec is not used any more
+    if (!--pool.users) {
+        nb_workers = pool.nb_workers;
+        memcpy(workers, pool.workers, nb_workers * sizeof(*workers));
+        pool.nb_workers = 0;
+        pool.generation++;
+        pthread_cond_broadcast(&pool.work_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
 
-    for (i=0; i<avctx->thread_count; i++)
-         pthread_join(c->workers[i], NULL);
+    for (i=0; i<nb_workers; i++)
+        pthread_join(workers[i], NULL);
 
-    pthread_mutex_destroy(&c->current_job_lock);
-    pthread_cond_destroy(&c->current_job_cond);
-    pthread_cond_destroy(&c->last_job_cond);
-    av_free(c->workers);
+    pthread_cond_destroy(&c->done_cond);
     av_freep(&avctx->thread_opaque);
 }
 
+void avcodec_thread_free(AVCodecContext *avctx)
+{
+    if (avctx->active_thread_type & FF_THREAD_FRAME)
+        ff_frame_thread_free(avctx);
+    else
+        slice_thread_free(avctx);
+}
+
 int avcodec_thread_execute(AVCodecContext *avctx, action_func* func, void *arg, int *ret, int job_count, int job_size)
 {
     ThreadContext *c= avctx->thread_opaque;
-    int dummy_ret;
+    int dummy_ret, job, i;
 
     if (job_count <= 0)
         return 0;
 
-    pthread_mutex_lock(&c->current_job_lock);
+    pthread_mutex_lock(&pool_lock);
 
-    c->current_job = avctx->thread_count;
+    c->next_job = 0;
+    c->jobs_done = 0;
     c->job_count = job_count;
     c->job_size = job_size;
     c->args = arg;
@@ -123,49 +186,687 @@ int avcodec_thread_execute(AVCodecContext *avctx, action_func* func, void *arg,
         c->rets = &dummy_ret;
         c->rets_count = 1;
     }
-    pthread_cond_broadcast(&c->current_job_cond);
+    // only wake as many workers as there are jobs left for them
+    if (job_count > 1 && pool.nb_workers) {
+        queue_context(c);
+        for (i=0; i<FFMIN(job_count - 1, pool.idle_workers); i++)
+            pthread_cond_signal(&pool.work_cond);
+    }
+
+    while (c->next_job < c->job_count) {
+        job = c->next_job++;
+        if (c->next_job == c->job_count)
+            unqueue_context(c);
+        pthread_mutex_unlock(&pool_lock);
+
+        run_job(c, job);
 
-    avcodec_thread_park_workers(c, avctx->thread_count);
+        pthread_mutex_lock(&pool_lock);
+        c->jobs_done++;
+    }
+    while (c->jobs_done < c->job_count)
+        pthread_cond_wait(&c->done_cond, &pool_lock);
 
+    pthread_mutex_unlock(&pool_lock);
     return 0;
 }
 
 int avcodec_thread_init(AVCodecContext *avctx, int thread_count)
 {
-    int i;
     ThreadContext *c;
+    // the thread calling execute() is one of the threads running the jobs
+    int nb_workers = av_clip(thread_count - 1, 0, MAX_POOL_THREADS);
 
     c = av_mallocz(sizeof(ThreadContext));
     if (!c)
         return -1;
 
-    c->workers = av_mallocz(sizeof(pthread_t)*thread_count);
-    if (!c->workers) {
-        av_free(c);
-        return -1;
+    c->avctx = avctx;
+    pthread_cond_init(&c->done_cond, NULL);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool.nb_workers < nb_workers) {
+        if (pthread_create(&pool.workers[pool.nb_workers], NULL, worker,
+                           (void*)(intptr_t)pool.generation)) {
+            // the pool works with fewer workers, or without any
+            av_log(avctx, AV_LOG_WARNING, "Could only start %d of %d threads\n",
+                   pool.nb_workers, nb_workers);
+            break;
+        }
+        pool.nb_workers++;
     }
+    pool.users++;
+    pthread_mutex_unlock(&pool_lock);
 
     avctx->thread_opaque = c;
     avctx->thread_count = thread_count;
-    c->current_job = 0;
-    c->job_count = 0;
-    c->job_size = 0;
-    c->done = 0;
-    pthread_cond_init(&c->current_job_cond, NULL);
-    pthread_cond_init(&c->last_job_cond, NULL);
-    pthread_mutex_init(&c->current_job_lock, NULL);
-    pthread_mutex_lock(&c->current_job_lock);
-    for (i=0; i<thread_count; i++) {
-        if(pthread_create(&c->workers[i], NULL, worker, avctx)) {
-           avctx->thread_count = i;
-           pthread_mutex_unlock(&c->current_job_lock);
-           avcodec_thread_free(avctx);
-           return -1;
+    avctx->execute = avcodec_thread_execute;
+    avctx->active_thread_type = FF_THREAD_SLICE;
+    return 0;
+}
+
+/**
+ * Frame threading: every thread decodes whole frames with its own copy of
+ * the AVCodecContext, the threads are given the packets in turn and the
+ * frames are returned in the same order, thread_count - 1 packets later.
+ */
+
+#define MAX_DELAYED_BUFFERS 32
+#define MAX_NEW_FRAMES       8
+
+/**
+ * Progress of a frame, shared by all the copies of its AVFrame.
+ */
+typedef struct FrameProgress {
+    int progress;                   ///< value given to the last ff_thread_report_progress()
+    AVCodecContext *owner;          ///< context of the thread that allocated the frame
+} FrameProgress;
+
+typedef struct PerThreadContext {
+    struct FrameThreadContext *parent;
+
+    pthread_t thread;
+    int thread_created;
+    int codec_opened;               ///< whether the codec's init() succeeded in avctx
+    pthread_cond_t input_cond;      ///< signaled when a packet was submitted or the thread must exit
+    pthread_cond_t progress_cond;   ///< signaled when the state or the progress of a frame changes
+    pthread_cond_t output_cond;     ///< signaled when the thread finished decoding its packet
+    pthread_mutex_t mutex;          ///< held by the thread while it decodes
+    pthread_mutex_t progress_mutex; ///< protects state and the progress of the frames the thread allocates
+
+    AVCodecContext *avctx;          ///< context the thread decodes with
+    AVPacket avpkt;                 ///< packet being decoded
+    AVFrame frame;                  ///< decoded frame
+    int got_frame;
+    int result;                     ///< return value of decode(), or of get_buffer() when it is called for the thread
+
+    enum {
+        STATE_INPUT_READY,          ///< waiting for a packet
+        STATE_SETTING_UP,           ///< decoding, before ff_thread_finish_setup()
+        STATE_GET_BUFFER,           ///< waiting for the main thread to call get_buffer()
+        STATE_SETUP_FINISHED        ///< decoding, after ff_thread_finish_setup()
+    } state;
+
+    AVFrame released_buffers[MAX_DELAYED_BUFFERS]; ///< frames released while other threads may still read them
+    int num_released_buffers;
+
+    AVFrame *requested_frame;       ///< frame get_buffer() is to be called for by the main thread
+
+    FrameProgress *new_frames[MAX_NEW_FRAMES]; ///< frames allocated while decoding the packet
+    int num_new_frames;
+} PerThreadContext;
+
+typedef struct FrameThreadContext {
+    PerThreadContext *threads;
+    PerThreadContext *prev_thread;  ///< thread the last packet was submitted to
+
+    pthread_mutex_t buffer_mutex;   ///< serializes get_buffer() and release_buffer()
+
+    int next_decoding;              ///< thread the next packet is submitted to
+    int next_finished;              ///< thread the next frame is returned from
+    int delaying;                   ///< set while the first thread_count - 1 packets are submitted
+    int die;                        ///< set when the threads must exit
+} FrameThreadContext;
+
+static void* attribute_align_arg frame_worker_thread(void *arg)
+{
+    PerThreadContext *p = arg;
+    FrameThreadContext *fctx = p->parent;
+    AVCodecContext *avctx = p->avctx;
+    AVCodec *codec = avctx->codec;
+    int i;
+
+    pthread_mutex_lock(&p->mutex);
+    for (;;) {
+        while (p->state == STATE_INPUT_READY && !fctx->die)
+            pthread_cond_wait(&p->input_cond, &p->mutex);
+        if (fctx->die)
+            break;
+
+        avcodec_get_frame_defaults(&p->frame);
+        p->got_frame = 0;
+        p->num_new_frames = 0;
+        p->result = codec->decode(avctx, &p->frame, &p->got_frame, &p->avpkt);
+
+        // decoders return early on errors, the next threads must not wait for them
+        if (p->state == STATE_SETTING_UP)
+            ff_thread_finish_setup(avctx);
+        for (i = 0; i < p->num_new_frames; i++) {
+            AVFrame f;
+            f.thread_opaque = p->new_frames[i];
+            ff_thread_report_progress(&f, INT_MAX);
         }
+
+        pthread_mutex_lock(&p->progress_mutex);
+        p->state = STATE_INPUT_READY;
+        pthread_cond_broadcast(&p->progress_cond);
+        pthread_cond_signal(&p->output_cond);
+        pthread_mutex_unlock(&p->progress_mutex);
     }
+    pthread_mutex_unlock(&p->mutex);
 
-    avcodec_thread_park_workers(c, thread_count);
+    return NULL;
+}
+
+/**
+ * Copies the fields the user reads, or with for_user == 0 the state of
+ * the codec, from the context of the thread that decoded the previous
+ * frame.
+ */
+static int update_context_from_thread(AVCodecContext *dst, AVCodecContext *src, int for_user)
+{
+    int err = 0;
+
+    if (dst != src) {
+        dst->time_base              = src->time_base;
+        dst->width                  = src->width;
+        dst->height                 = src->height;
+        dst->pix_fmt                = src->pix_fmt;
+        dst->coded_width            = src->coded_width;
+        dst->coded_height           = src->coded_height;
+        dst->has_b_frames           = src->has_b_frames;
+        dst->idct_algo              = src->idct_algo;
+        dst->bits_per_coded_sample  = src->bits_per_coded_sample;
+        dst->sample_aspect_ratio    = src->sample_aspect_ratio;
+        dst->dtg_active_format      = src->dtg_active_format;
+        dst->profile                = src->profile;
+        dst->level                  = src->level;
+        dst->bits_per_raw_sample    = src->bits_per_raw_sample;
+        dst->ticks_per_frame        = src->ticks_per_frame;
+        dst->color_primaries        = src->color_primaries;
+        dst->color_trc              = src->color_trc;
+        dst->colorspace             = src->colorspace;
+        dst->color_range            = src->color_range;
+        dst->chroma_sample_location = src->chroma_sample_location;
+    }
+
+    if (for_user) {
+        dst->coded_frame   = src->coded_frame;
+        dst->has_b_frames += dst->thread_count - 1;
+    } else if (dst != src) {
+        err = dst->codec->update_thread_context(dst, src);
+    }
+
+    return err;
+}
+
+/**
+ * Copies the settings the user may change between packets to the context
+ * of a thread.
+ */
+static void update_context_from_user(AVCodecContext *dst, AVCodecContext *src)
+{
+    dst->flags                 = src->flags;
+    dst->flags2                = src->flags2;
+    dst->get_buffer            = src->get_buffer;
+    dst->release_buffer        = src->release_buffer;
+    dst->opaque                = src->opaque;
+    dst->thread_safe_callbacks = src->thread_safe_callbacks;
+    dst->hurry_up              = src->hurry_up;
+    dst->debug                 = src->debug;
+    dst->debug_mv              = src->debug_mv;
+    dst->error_recognition     = src->error_recognition;
+    dst->error_concealment     = src->error_concealment;
+    dst->skip_top              = src->skip_top;
+    dst->skip_bottom           = src->skip_bottom;
+    dst->skip_loop_filter      = src->skip_loop_filter;
+    dst->skip_idct             = src->skip_idct;
+    dst->skip_frame            = src->skip_frame;
+    dst->frame_number          = src->frame_number;
+    dst->reordered_opaque      = src->reordered_opaque;
+}
+
+static void release_frame(AVFrame *f)
+{
+    FrameProgress *progress = f->thread_opaque;
+    AVCodecContext *owner = progress->owner;
+
+    owner->release_buffer(owner, f);
+    av_free(progress);
+}
+
+/**
+ * Releases the frames the thread freed while decoding its last packet,
+ * which the threads decoding the packets before it may have read.
+ * Must only be called when none of those threads is decoding.
+ */
+static void release_delayed_buffers(PerThreadContext *p)
+{
+    FrameThreadContext *fctx = p->parent;
+
+    while (p->num_released_buffers > 0) {
+        AVFrame *f = &p->released_buffers[--p->num_released_buffers];
+
+        pthread_mutex_lock(&fctx->buffer_mutex);
+        release_frame(f);
+        pthread_mutex_unlock(&fctx->buffer_mutex);
+    }
+}
+
+static int submit_packet(PerThreadContext *p, AVPacket *avpkt)
+{
+    FrameThreadContext *fctx = p->parent;
+    PerThreadContext *prev_thread = fctx->prev_thread;
+    AVCodecContext *avctx = p->avctx;
+    int err;
+
+    if (!avpkt->size && !(avctx->codec->capabilities & CODEC_CAP_DELAY))
+        return 0;
+
+    pthread_mutex_lock(&p->mutex);
+
+    release_delayed_buffers(p);
+
+    if (prev_thread) {
+        pthread_mutex_lock(&prev_thread->progress_mutex);
+        while (prev_thread->state == STATE_SETTING_UP)
+            pthread_cond_wait(&prev_thread->progress_cond, &prev_thread->progress_mutex);
+        pthread_mutex_unlock(&prev_thread->progress_mutex);
+
+        if ((err = update_context_from_thread(avctx, prev_thread->avctx, 0)) < 0) {
+            pthread_mutex_unlock(&p->mutex);
+            return err;
+        }
+    }
+
+    av_free_packet(&p->avpkt);
+    p->avpkt = *avpkt;
+    if ((err = av_ref_packet(&p->avpkt, avpkt)) < 0 ||
+        (err = av_dup_packet(&p->avpkt)) < 0) {
+        av_init_packet(&p->avpkt);
+        p->avpkt.data = NULL;
+        p->avpkt.size = 0;
+        pthread_mutex_unlock(&p->mutex);
+        return err;
+    }
+
+    p->state = STATE_SETTING_UP;
+    pthread_cond_signal(&p->input_cond);
+    pthread_mutex_unlock(&p->mutex);
+
+    /* Callbacks that are not thread safe are called from this thread,
+     * which waits for the setup of the frame to finish. */
+    if (!avctx->thread_safe_callbacks && avctx->get_buffer != avcodec_default_get_buffer) {
+        pthread_mutex_lock(&p->progress_mutex);
+        while (p->state != STATE_SETUP_FINISHED && p->state != STATE_INPUT_READY) {
+            if (p->state == STATE_GET_BUFFER) {
+                p->result = avctx->get_buffer(avctx, p->requested_frame);
+                p->state  = STATE_SETTING_UP;
+                pthread_cond_broadcast(&p->progress_cond);
+            }
+            pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+        }
+        pthread_mutex_unlock(&p->progress_mutex);
+    }
+
+    fctx->prev_thread = p;
 
-    avctx->execute = avcodec_thread_execute;
     return 0;
 }
+
+int ff_thread_decode_frame(AVCodecContext *avctx, AVFrame *picture,
+                           int *got_picture_ptr, AVPacket *avpkt)
+{
+    FrameThreadContext *fctx = avctx->thread_opaque;
+    int finished = fctx->next_finished;
+    PerThreadContext *p;
+    int err;
+
+    p = &fctx->threads[fctx->next_decoding];
+    update_context_from_user(p->avctx, avctx);
+    if ((err = submit_packet(p, avpkt)) < 0)
+        return err;
+
+    fctx->next_decoding++;
+
+    // no frame is returned until all the threads were given a packet
+    if (fctx->delaying && avpkt->size) {
+        if (fctx->next_decoding >= avctx->thread_count - 1)
+            fctx->delaying = 0;
+
+        *got_picture_ptr = 0;
+        return avpkt->size;
+    }
+
+    /* Return the frame of the oldest thread. At the end of the stream the
+     * threads without a frame are skipped, for a call without a frame
+     * would tell the user that all the frames were returned. */
+    do {
+        p = &fctx->threads[finished++];
+
+        pthread_mutex_lock(&p->progress_mutex);
+        while (p->state != STATE_INPUT_READY)
+            pthread_cond_wait(&p->output_cond, &p->progress_mutex);
+        pthread_mutex_unlock(&p->progress_mutex);
+
+        *picture         = p->frame;
+        *got_picture_ptr = p->got_frame;
+        // later calls at the end of the stream must not return it again
+        p->got_frame     = 0;
+
+        if (finished >= avctx->thread_count)
+            finished = 0;
+    } while (!avpkt->size && !*got_picture_ptr && finished != fctx->next_finished);
+
+    update_context_from_thread(avctx, p->avctx, 1);
+
+    if (fctx->next_decoding >= avctx->thread_count)
+        fctx->next_decoding = 0;
+
+    fctx->next_finished = finished;
+
+    return p->result < 0 ? p->result : avpkt->size;
+}
+
+void ff_thread_finish_setup(AVCodecContext *avctx)
+{
+    PerThreadContext *p = avctx->thread_opaque;
+
+    if (!(avctx->active_thread_type & FF_THREAD_FRAME))
+        return;
+
+    pthread_mutex_lock(&p->progress_mutex);
+    p->state = STATE_SETUP_FINISHED;
+    pthread_cond_broadcast(&p->progress_cond);
+    pthread_mutex_unlock(&p->progress_mutex);
+}
+
+void ff_thread_report_progress(AVFrame *f, int n)
+{
+    FrameProgress *progress = f->thread_opaque;
+    PerThreadContext *p;
+
+    if (!progress || progress->progress >= n)
+        return;
+
+    p = progress->owner->thread_opaque;
+
+    pthread_mutex_lock(&p->progress_mutex);
+    progress->progress = n;
+    pthread_cond_broadcast(&p->progress_cond);
+    pthread_mutex_unlock(&p->progress_mutex);
+}
+
+void ff_thread_await_progress(AVFrame *f, int n)
+{
+    FrameProgress *progress = f->thread_opaque;
+    PerThreadContext *p;
+
+    if (!progress)
+        return;
+
+    p = progress->owner->thread_opaque;
+
+    pthread_mutex_lock(&p->progress_mutex);
+    while (progress->progress < n)
+        pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+    pthread_mutex_unlock(&p->progress_mutex);
+}
+
+int ff_thread_get_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    PerThreadContext *p = avctx->thread_opaque;
+    FrameProgress *progress;
+    int err;
+
+    f->thread_opaque = NULL;
+
+    if (!(avctx->active_thread_type & FF_THREAD_FRAME))
+        return avctx->get_buffer(avctx, f);
+
+    if (p->state != STATE_SETTING_UP || p->num_new_frames >= MAX_NEW_FRAMES) {
+        av_log(avctx, AV_LOG_ERROR, "get_buffer() cannot be called after ff_thread_finish_setup()\n");
+        return -1;
+    }
+
+    progress = av_malloc(sizeof(FrameProgress));
+    if (!progress)
+        return AVERROR(ENOMEM);
+    progress->progress = -1;
+    progress->owner    = avctx;
+
+    if (avctx->thread_safe_callbacks || avctx->get_buffer == avcodec_default_get_buffer) {
+        pthread_mutex_lock(&p->parent->buffer_mutex);
+        err = avctx->get_buffer(avctx, f);
+        pthread_mutex_unlock(&p->parent->buffer_mutex);
+    } else {
+        pthread_mutex_lock(&p->progress_mutex);
+        p->requested_frame = f;
+        p->state = STATE_GET_BUFFER;
+        pthread_cond_broadcast(&p->progress_cond);
+
+        while (p->state != STATE_SETTING_UP)
+            pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+
+        err = p->result;
+        pthread_mutex_unlock(&p->progress_mutex);
+    }
+
+    if (err < 0) {
+        av_free(progress);
+        return err;
+    }
+
+    f->thread_opaque = progress;
+    p->new_frames[p->num_new_frames++] = progress;
+    // the buffers are reused by each thread, out of the order of the frames
+    f->age = INT_MAX;
+
+    return err;
+}
+
+void ff_thread_release_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    PerThreadContext *p = avctx->thread_opaque;
+
+    if (!(avctx->active_thread_type & FF_THREAD_FRAME)) {
+        avctx->release_buffer(avctx, f);
+        return;
+    }
+
+    if (p->parent->die) {
+        // closing the codec, no thread decodes any more
+        release_frame(f);
+    } else if (p->num_released_buffers < MAX_DELAYED_BUFFERS) {
+        p->released_buffers[p->num_released_buffers++] = *f;
+    } else {
+        av_log(avctx, AV_LOG_ERROR, "too many frames released at once\n");
+        return;
+    }
+
+    memset(f->data, 0, sizeof(f->data));
+    f->thread_opaque = NULL;
+}
+
+/**
+ * Waits for all the threads to finish decoding their packets.
+ */
+static void park_frame_worker_threads(FrameThreadContext *fctx, int thread_count)
+{
+    int i;
+
+    for (i = 0; i < thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+
+        pthread_mutex_lock(&p->progress_mutex);
+        while (p->state != STATE_INPUT_READY)
+            pthread_cond_wait(&p->output_cond, &p->progress_mutex);
+        pthread_mutex_unlock(&p->progress_mutex);
+        p->got_frame = 0;
+    }
+}
+
+void ff_thread_flush(AVCodecContext *avctx)
+{
+    FrameThreadContext *fctx = avctx->thread_opaque;
+    int i;
+
+    park_frame_worker_threads(fctx, avctx->thread_count);
+
+    // the first thread goes on with the state of the last one
+    if (fctx->prev_thread) {
+        if (fctx->prev_thread != &fctx->threads[0])
+            update_context_from_thread(fctx->threads[0].avctx, fctx->prev_thread->avctx, 0);
+        if (avctx->codec->flush)
+            avctx->codec->flush(fctx->threads[0].avctx);
+    }
+
+    fctx->next_decoding = fctx->next_finished = 0;
+    fctx->delaying = 1;
+    fctx->prev_thread = NULL;
+
+    for (i = 0; i < avctx->thread_count; i++)
+        release_delayed_buffers(&fctx->threads[i]);
+}
+
+int ff_thread_can_frame_thread(AVCodecContext *avctx)
+{
+    AVCodec *codec = avctx->codec;
+
+    return avctx->active_thread_type == FF_THREAD_SLICE && avctx->thread_count > 1 &&
+           avctx->thread_type & FF_THREAD_FRAME &&
+           codec->decode && codec->capabilities & CODEC_CAP_FRAME_THREADS &&
+           codec->update_thread_context &&
+           !(avctx->flags & (CODEC_FLAG_TRUNCATED | CODEC_FLAG_LOW_DELAY)) &&
+           !(avctx->flags2 & CODEC_FLAG2_CHUNKS) &&
+           !avctx->lowres && !avctx->draw_horiz_band &&
+           avctx->get_format == avcodec_default_get_format;
+}
+
+int ff_frame_thread_init(AVCodecContext *avctx)
+{
+    int thread_count = FFMIN(avctx->thread_count, MAX_FRAME_THREADS);
+    AVCodec *codec = avctx->codec;
+    FrameThreadContext *fctx;
+    int i, err = 0;
+
+    // the slice threads are not used by the copies of the context
+    slice_thread_free(avctx);
+    avctx->execute = avcodec_default_execute;
+    avctx->active_thread_type = 0;
+
+    fctx = av_mallocz(sizeof(FrameThreadContext));
+    if (!fctx)
+        return AVERROR(ENOMEM);
+    fctx->threads = av_mallocz(sizeof(PerThreadContext) * thread_count);
+    if (!fctx->threads) {
+        av_free(fctx);
+        return AVERROR(ENOMEM);
+    }
+    pthread_mutex_init(&fctx->buffer_mutex, NULL);
+    fctx->delaying = 1;
+
+    avctx->thread_opaque = fctx;
+    avctx->thread_count = thread_count;
+    avctx->active_thread_type = FF_THREAD_FRAME;
+
+    for (i = 0; i < thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+        AVCodecContext *copy;
+
+        pthread_mutex_init(&p->mutex, NULL);
+        pthread_mutex_init(&p->progress_mutex, NULL);
+        pthread_cond_init(&p->input_cond, NULL);
+        pthread_cond_init(&p->progress_cond, NULL);
+        pthread_cond_init(&p->output_cond, NULL);
+        p->parent = fctx;
+
+        copy = p->avctx = av_malloc(sizeof(AVCodecContext));
+        if (!copy) {
+            err = AVERROR(ENOMEM);
+            break;
+        }
+        *copy = *avctx;
+        copy->thread_opaque      = p;
+        copy->thread_count       = 1;
+        copy->execute            = avcodec_default_execute;
+        copy->internal_buffer    = NULL;
+        copy->internal_buffer_count = 0;
+        copy->is_copy            = i > 0;
+        // the first thread uses the private context of the user's context
+        if (i && codec->priv_data_size > 0) {
+            copy->priv_data = av_mallocz(codec->priv_data_size);
+            if (!copy->priv_data) {
+                err = AVERROR(ENOMEM);
+                break;
+            }
+        }
+
+        if (codec->init && (err = codec->init(copy)) < 0)
+            break;
+        p->codec_opened = 1;
+
+        if (pthread_create(&p->thread, NULL, frame_worker_thread, p)) {
+            err = -1;
+            break;
+        }
+        p->thread_created = 1;
+    }
+
+    if (err < 0) {
+        avctx->thread_count = i + 1;
+        ff_frame_thread_free(avctx);
+        return err;
+    }
+
+    return 0;
+}
+
+void ff_frame_thread_free(AVCodecContext *avctx)
+{
+    FrameThreadContext *fctx = avctx->thread_opaque;
+    AVCodec *codec = avctx->codec;
+    int i;
+
+    park_frame_worker_threads(fctx, avctx->thread_count);
+
+    if (fctx->prev_thread && fctx->prev_thread != &fctx->threads[0])
+        update_context_from_thread(fctx->threads[0].avctx, fctx->prev_thread->avctx, 0);
+
+    for (i = 0; i < avctx->thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+
+        pthread_mutex_lock(&p->mutex);
+        fctx->die = 1;
+        pthread_cond_signal(&p->input_cond);
+        pthread_mutex_unlock(&p->mutex);
+
+        if (p->thread_created)
+            pthread_join(p->thread, NULL);
+    }
+
+    for (i = 0; i < avctx->thread_count; i++)
+        release_delayed_buffers(&fctx->threads[i]);
+
+    /* The first thread frees the frames, which the threads that allocated
+     * them release right away, so it must be closed first. */
+    for (i = 0; i < avctx->thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+
+        if (p->codec_opened && codec->close)
+            codec->close(p->avctx);
+    }
+
+    for (i = 0; i < avctx->thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+
+        if (p->avctx) {
+            avcodec_default_free_buffers(p->avctx);
+            if (i)
+                av_freep(&p->avctx->priv_data);
+            av_freep(&p->avctx);
+        }
+        av_free_packet(&p->avpkt);
+
+        pthread_mutex_destroy(&p->mutex);
+        pthread_mutex_destroy(&p->progress_mutex);
+        pthread_cond_destroy(&p->input_cond);
+        pthread_cond_destroy(&p->progress_cond);
+        pthread_cond_destroy(&p->output_cond);
+    }
+
+    pthread_mutex_destroy(&fctx->buffer_mutex);
+    av_freep(&fctx->threads);
+    av_freep(&avctx->thread_opaque);
+    avctx->active_thread_type = 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Multithreading support
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file libavcodec/thread.h
+ * Multithreading support functions for decoders.
+ *
+ * With frame threading every thread decodes whole frames with its own copy
+ * of the AVCodecContext, and the frames are returned in the order their
+ * packets were given. A decoder supporting it has CODEC_CAP_FRAME_THREADS
+ * and splits decoding a frame in two parts:
+ * - setting up, which reads the headers and allocates the frame, and which
+ *   ends with ff_thread_finish_setup(); the next frame only starts decoding
+ *   after it, with the state AVCodec.update_thread_context() copies from
+ *   this thread
+ * - decoding the picture, during which ff_thread_report_progress() tells
+ *   the threads decoding the next frames which part of it they may read
+ *   from, and ff_thread_await_progress() waits for such a part of the
+ *   reference frames.
+ * Frames must be allocated with ff_thread_get_buffer() before the setup is
+ * finished and freed with ff_thread_release_buffer().
+ *
+ * These functions also work when frame threading is not used, in which
+ * case they do what the decoder would have done without them.
+ */
+
+#ifndef AVCODEC_THREAD_H
+#define AVCODEC_THREAD_H
+
+#include "avcodec.h"
+
+/**
+ * Maximum number of frames decoded at the same time. More threads would
+ * delay the output more than they speed the decoding up.
+ */
+#define MAX_FRAME_THREADS 8
+
+/**
+ * Whether avcodec_open() should use frame threading for the context.
+ * The context's codec must be set.
+ */
+int ff_thread_can_frame_thread(AVCodecContext *avctx);
+
+/**
+ * Starts the frame threads, which open the codec in their contexts.
+ * Called by avcodec_open() instead of the codec's init().
+ * @return 0 upon success, negative upon failure, in which case the codec
+ *         is not open in any context
+ */
+int ff_frame_thread_init(AVCodecContext *avctx);
+
+/**
+ * Stops the frame threads and closes the codec in all their contexts.
+ * Called by avcodec_close() instead of the codec's close().
+ */
+void ff_frame_thread_free(AVCodecContext *avctx);
+
+/**
+ * Submits a packet to the next decoding thread and returns the oldest
+ * decoded frame, if any. Called by avcodec_decode_video2() instead of the
+ * codec's decode().
+ */
+int ff_thread_decode_frame(AVCodecContext *avctx, AVFrame *picture,
+                           int *got_picture_ptr, AVPacket *avpkt);
+
+/**
+ * Waits for the frame threads to finish and flushes the codec.
+ * Called by avcodec_flush_buffers() instead of the codec's flush().
+ */
+void ff_thread_flush(AVCodecContext *avctx);
+
+/**
+ * Tells the thread decoding the next frame that this thread does not
+ * change its state any more, so that it can start decoding.
+ * Must be called after all the frames were allocated and before the
+ * decoder reads any reference frame.
+ */
+void ff_thread_finish_setup(AVCodecContext *avctx);
+
+/**
+ * Tells the threads waiting for a part of the frame that it was decoded
+ * up to and including the given value, whose meaning is up to the
+ * decoder, typically a macroblock row. INT_MAX means the whole frame.
+ * Must be called by the thread that allocated the frame, with increasing
+ * values.
+ */
+void ff_thread_report_progress(AVFrame *f, int progress);
+
+/**
+ * Waits until the frame was decoded up to the given value, see
+ * ff_thread_report_progress().
+ */
+void ff_thread_await_progress(AVFrame *f, int progress);
+
+/**
+ * Allocates a frame with get_buffer(), from the thread that calls
+ * avcodec_decode_video2() if the user's callbacks are not thread safe.
+ * Must be called before ff_thread_finish_setup().
+ */
+int ff_thread_get_buffer(AVCodecContext *avctx, AVFrame *f);
+
+/**
+ * Frees a frame with release_buffer(), once the frames decoded at the
+ * same time cannot read from it any more.
+ */
+void ff_thread_release_buffer(AVCodecContext *avctx, AVFrame *f);
+
+#endif /* AVCODEC_THREAD_H */
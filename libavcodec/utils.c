@@ -37,6 +37,7 @@
 #include "imgconvert.h"
 #include "audioconvert.h"
 #include "internal.h"
+#include "thread.h"
 #include <stdlib.h>
 #include <stdarg.h>
 #include <limits.h>
@@ -480,7 +481,14 @@ int attribute_align_arg avcodec_open(AVCodecContext *avctx, AVCodec *codec)
     avctx->codec = codec;
     avctx->codec_id = codec->id;
     avctx->frame_number = 0;
-    if(avctx->codec->init){
+    if (HAVE_PTHREADS && ff_thread_can_frame_thread(avctx)) {
+        ret = ff_frame_thread_init(avctx);
+        if (ret < 0) {
+            av_freep(&avctx->priv_data);
+            avctx->codec= NULL;
+            goto end;
+        }
+    }else if(avctx->codec->init){
         ret = avctx->codec->init(avctx);
         if (ret < 0) {
             av_freep(&avctx->priv_data);
@@ -573,7 +581,12 @@ int attribute_align_arg avcodec_decode_video2(AVCodecContext *avctx, AVFrame *pi
     *got_picture_ptr= 0;
     if((avctx->coded_width||avctx->coded_height) && avcodec_check_dimensions(avctx,avctx->coded_width,avctx->coded_height))
         return -1;
-    if((avctx->codec->capabilities & CODEC_CAP_DELAY) || avpkt->size){
+    if (avctx->active_thread_type & FF_THREAD_FRAME) {
+        ret = ff_thread_decode_frame(avctx, picture, got_picture_ptr, avpkt);
+
+        if (*got_picture_ptr)
+            avctx->frame_number++;
+    }else if((avctx->codec->capabilities & CODEC_CAP_DELAY) || avpkt->size){
         ret = avctx->codec->decode(avctx, picture, got_picture_ptr,
                                 avpkt);
 
@@ -657,6 +670,8 @@ int avcodec_decode_subtitle2(AVCodecContext *avctx, AVSubtitle *sub,
 
 int avcodec_close(AVCodecContext *avctx)
 {
+    int frame_threaded;
+
     /* If there is a user-supplied mutex locking routine, call it. */
     if (ff_lockmgr_cb) {
         if ((*ff_lockmgr_cb)(&codec_mutex, AV_LOCK_OBTAIN))
@@ -670,9 +685,12 @@ int avcodec_close(AVCodecContext *avctx)
         return -1;
     }
 
+    // with frame threading the codec is closed in the contexts of the threads
+    frame_threaded = avctx->active_thread_type & FF_THREAD_FRAME;
     if (HAVE_THREADS && avctx->thread_opaque)
         avcodec_thread_free(avctx);
-    if (avctx->codec->close)
+    avctx->active_thread_type = 0;
+    if (avctx->codec->close && !frame_threaded)
         avctx->codec->close(avctx);
     avcodec_default_free_buffers(avctx);
     av_freep(&avctx->priv_data);
@@ -915,7 +933,9 @@ void avcodec_init(void)
 
 void avcodec_flush_buffers(AVCodecContext *avctx)
 {
-    if(avctx->codec->flush)
+    if (avctx->active_thread_type & FF_THREAD_FRAME)
+        ff_thread_flush(avctx);
+    else if(avctx->codec->flush)
         avctx->codec->flush(avctx);
 }
 
@@ -1014,6 +1034,55 @@ int avcodec_thread_init(AVCodecContext *s, int thread_count){
 }
 #endif
 
+#if !HAVE_PTHREADS
+int ff_thread_can_frame_thread(AVCodecContext *avctx)
+{
+    return 0;
+}
+
+int ff_frame_thread_init(AVCodecContext *avctx)
+{
+    return -1;
+}
+
+void ff_frame_thread_free(AVCodecContext *avctx)
+{
+}
+
+int ff_thread_decode_frame(AVCodecContext *avctx, AVFrame *picture,
+                           int *got_picture_ptr, AVPacket *avpkt)
+{
+    return -1;
+}
+
+void ff_thread_flush(AVCodecContext *avctx)
+{
+}
+
+void ff_thread_finish_setup(AVCodecContext *avctx)
+{
+}
+
+void ff_thread_report_progress(AVFrame *f, int progress)
+{
+}
+
+void ff_thread_await_progress(AVFrame *f, int progress)
+{
+}
+
+int ff_thread_get_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    f->thread_opaque = NULL;
+    return avctx->get_buffer(avctx, f);
+}
+
+void ff_thread_release_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    avctx->release_buffer(avctx, f);
+}
+#endif
+
 unsigned int av_xiphlacing(unsigned char *s, unsigned int v)
 {
     unsigned int n = 0;
@@ -889,6 +889,7 @@ static int ff_asf_parse_packet(AVFormatContext *s, ByteIOContext *pb, AVPacket *
                 uint8_t *newdata = av_malloc(asf_st->pkt.size);
                 if (newdata) {
                     int offset = 0;
+                    int size = asf_st->pkt.size;
                     while (offset < asf_st->pkt.size) {
                         int off = offset / asf_st->ds_chunk_size;
                         int row = off / asf_st->ds_span;
@@ -903,8 +904,10 @@ static int ff_asf_parse_packet(AVFormatContext *s, ByteIOContext *pb, AVPacket *
                                asf_st->ds_chunk_size);
                         offset += asf_st->ds_chunk_size;
                     }
-                    av_free(asf_st->pkt.data);
+                    av_free_packet(&asf_st->pkt);
                     asf_st->pkt.data = newdata;
+                    asf_st->pkt.size = size;
+                    asf_st->pkt.destruct = av_destruct_packet;
                 }
               }
             }
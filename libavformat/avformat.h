@@ -22,7 +22,7 @@
 #define AVFORMAT_AVFORMAT_H
 
 #define LIBAVFORMAT_VERSION_MAJOR 52
-#define LIBAVFORMAT_VERSION_MINOR 38
+#define LIBAVFORMAT_VERSION_MINOR 56
 #define LIBAVFORMAT_VERSION_MICRO  0
 
 #define LIBAVFORMAT_VERSION_INT AV_VERSION_INT(LIBAVFORMAT_VERSION_MAJOR, \
@@ -450,6 +450,20 @@ typedef struct AVStream {
      */
 #define MAX_PROBE_PACKETS 100
     int probe_packets;
+
+    /**
+     * Number of samples at the start of the stream which the encoder added
+     * as delay and which decoders still output, 0 if unknown.
+     * - decoding: Set by libavformat.
+     */
+    int encoder_delay;
+
+    /**
+     * Number of samples the encoder added at the end of the stream to fill
+     * its last frame, 0 if unknown.
+     * - decoding: Set by libavformat.
+     */
+    int encoder_padding;
 } AVStream;
 
 #define AV_PROGRAM_RUNNING 1
@@ -566,6 +580,10 @@ typedef struct AVFormatContext {
 #define AVFMT_FLAG_GENPTS       0x0001 ///< Generate missing pts even if it requires parsing future frames.
 #define AVFMT_FLAG_IGNIDX       0x0002 ///< Ignore index.
 #define AVFMT_FLAG_NONBLOCK     0x0004 ///< Do not block when reading packets from input.
+#define AVFMT_FLAG_PLAYLIST_LAZY 0x0008 ///< Insert playlist items without probing them; probe each item on demand.
+#define AVFMT_FLAG_PLAYLIST_CACHE 0x0010 ///< Cache probe results of playlist items in a file next to the playlist.
+#define AVFMT_FLAG_PLAYLIST_UNIFY 0x0020 ///< Map playlist items with matching codec parameters onto the same streams.
+#define AVFMT_FLAG_PLAYLIST_COPY 0x0040 ///< Only demux playlist items, which must have the same streams, for stream copy.
 
     int loop_input;
     /** decoding: size of data to probe; encoding: unused. */
@@ -645,6 +663,66 @@ typedef struct AVFormatContext {
      */
 #define RAW_PACKET_BUFFER_SIZE 32000
     int raw_packet_buffer_remaining_size;
+
+    /**
+     * Directory in which the probe results of playlist items are cached.
+     * Enables the cache even if AVFMT_FLAG_PLAYLIST_CACHE is not set.
+     * muxing  : unused
+     * demuxing: set by user
+     */
+    char *playlist_cache_dir;
+
+    /**
+     * Number of playlist items probed at once when the playlist is opened.
+     * Probing is done in playlist order by the calling thread if it is 1, if
+     * AVFMT_FLAG_PLAYLIST_LAZY is set, or if no lock manager is registered
+     * with av_lockmgr_register(), as the probing threads open decoders.
+     * muxing  : unused
+     * demuxing: set by user
+     */
+    int playlist_probe_threads;
+
+    /**
+     * Interval in milliseconds at which an m3u playlist is checked for changes
+     * while it plays. Items following the current one are then updated to
+     * match the file. 0 if the file is only read when it is opened.
+     * muxing  : unused
+     * demuxing: set by user
+     */
+    int playlist_reload_interval;
+
+    /**
+     * Time in milliseconds by which each playlist item starts before the end
+     * of the previous one. The end of an item is then read along with the
+     * start of the next one, whose packets are on streams of its own.
+     * muxing  : unused
+     * demuxing: set by user
+     */
+    int playlist_overlap;
+
+    /**
+     * Short name of the format the segment muxer writes its segments in,
+     * mpegts if NULL.
+     * muxing  : set by user
+     * demuxing: unused
+     */
+    char *segment_format;
+
+    /**
+     * Duration in milliseconds after which the segment muxer starts a new
+     * segment at the next keyframe.
+     * muxing  : set by user
+     * demuxing: unused
+     */
+    int segment_time;
+
+    /**
+     * Number of buffers of the input that a background thread reads ahead
+     * of the demuxer, 0 to read synchronously.
+     * muxing  : unused
+     * demuxing: set by user
+     */
+    int read_ahead;
 } AVFormatContext;
 
 typedef struct AVPacketList {
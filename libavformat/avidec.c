@@ -742,11 +742,8 @@ resync:
             return err;
 
         if(ast->has_pal && pkt->data && pkt->size<(unsigned)INT_MAX/2){
-            void *ptr= av_realloc(pkt->data, pkt->size + 4*256 + FF_INPUT_BUFFER_PADDING_SIZE);
-            if(ptr){
+            if(av_grow_packet(pkt, 4*256) >= 0){
             ast->has_pal=0;
-            pkt->size += 4*256;
-            pkt->data= ptr;
                 memcpy(pkt->data + pkt->size - 4*256, ast->pal, 4*256);
             }else
                 av_log(s, AV_LOG_ERROR, "Failed to append palette\n");
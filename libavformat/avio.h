@@ -205,6 +205,7 @@ typedef struct {
     int (*read_pause)(void *opaque, int pause);
     int64_t (*read_seek)(void *opaque, int stream_index,
                          int64_t timestamp, int flags);
+    void *read_ahead; ///< state of the background reading set up by url_set_read_ahead, NULL if none
 } ByteIOContext;
 
 int init_put_byte(ByteIOContext *s,
@@ -339,6 +340,16 @@ int url_setbufsize(ByteIOContext *s, int buf_size);
  *        to set up the buffer for writing. */
 int url_resetbuf(ByteIOContext *s, int flags);
 
+/** Read the input ahead in a background thread. The reads of the protocol
+ * then fill a ring of buffers of the size of the ByteIOContext buffer, and
+ * data already read ahead is returned without waiting for the protocol.
+ * Seeking within the data read ahead skips it; other seeks drop it.
+ * @param nb_buffers number of buffers of the ring
+ * @return 0 on success, AVERROR(ENOSYS) without thread support, or another
+ *         negative value on failure, in which case the input is read as before.
+ */
+int url_set_read_ahead(ByteIOContext *s, int nb_buffers);
+
 /** @note when opened as read/write, the buffers are only used for
     writing */
 int url_fopen(ByteIOContext **s, const char *filename, int flags);
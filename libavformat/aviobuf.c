@@ -19,6 +19,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "config.h"
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include "libavutil/crc.h"
 #include "libavutil/intreadwrite.h"
 #include "avformat.h"
@@ -59,6 +63,7 @@ int init_put_byte(ByteIOContext *s,
     }
     s->read_pause = NULL;
     s->read_seek  = NULL;
+    s->read_ahead = NULL;
     return 0;
 }
 
@@ -77,6 +82,238 @@ ByteIOContext *av_alloc_put_byte(
     return s;
 }
 
+#if HAVE_PTHREADS
+/* read-ahead: a thread reads from the protocol into a ring of buffers, which
+ * the reads of the ByteIOContext take data from */
+typedef struct ReadAhead {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t **buffers;
+    int *sizes;         ///< number of bytes read into each buffer
+    int nb_buffers;
+    int buffer_size;
+    int head;           ///< index of the first buffer holding data
+    int count;          ///< number of buffers holding data
+    int offset;         ///< number of bytes of the first buffer already taken
+    int eof;            ///< set once the protocol returned end of file or an error
+    int eof_ret;        ///< what the protocol returned then
+    int busy;           ///< set while the thread reads from the protocol
+    int paused;         ///< set while the protocol is used by the reading side
+    int abort;
+    int64_t pos;        ///< position in the file of the first byte not yet taken
+} ReadAhead;
+
+static void *read_ahead_thread(void *arg)
+{
+    ByteIOContext *s = arg;
+    ReadAhead *ra = s->read_ahead;
+    int idx, len;
+
+    pthread_mutex_lock(&ra->mutex);
+    for (;;) {
+        while (!ra->abort && (ra->paused || ra->eof || ra->count == ra->nb_buffers))
+            pthread_cond_wait(&ra->cond, &ra->mutex);
+        if (ra->abort)
+            break;
+        idx = (ra->head + ra->count) % ra->nb_buffers;
+        ra->busy = 1;
+        pthread_mutex_unlock(&ra->mutex);
+        len = s->read_packet(s->opaque, ra->buffers[idx], ra->buffer_size);
+        pthread_mutex_lock(&ra->mutex);
+        ra->busy = 0;
+        if (len > 0) {
+            ra->sizes[idx] = len;
+            ra->count++;
+        } else if (len != AVERROR(EAGAIN)) {
+            // EAGAIN only means that nothing could be read yet, so it is tried again
+            ra->eof     = 1;
+            ra->eof_ret = len;
+        }
+        pthread_cond_broadcast(&ra->cond);
+    }
+    pthread_mutex_unlock(&ra->mutex);
+    return NULL;
+}
+
+/** Waits for the thread to leave the protocol alone, and returns with the
+ * mutex locked. */
+static void read_ahead_pause(ReadAhead *ra)
+{
+    pthread_mutex_lock(&ra->mutex);
+    ra->paused = 1;
+    while (ra->busy)
+        pthread_cond_wait(&ra->cond, &ra->mutex);
+}
+
+/** Lets the thread go on reading, from pos if the data read ahead was dropped. */
+static void read_ahead_resume(ReadAhead *ra, int drop, int64_t pos)
+{
+    if (drop) {
+        ra->head = ra->count = ra->offset = 0;
+        ra->eof  = 0;
+        ra->pos  = pos;
+    }
+    ra->paused = 0;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->mutex);
+}
+
+static int read_ahead_read(ByteIOContext *s, uint8_t *buf, int size)
+{
+    ReadAhead *ra = s->read_ahead;
+    int len;
+
+    pthread_mutex_lock(&ra->mutex);
+    while (!ra->count && !ra->eof)
+        pthread_cond_wait(&ra->cond, &ra->mutex);
+    if (!ra->count) {
+        pthread_mutex_unlock(&ra->mutex);
+        return ra->eof_ret;
+    }
+    // a call never returns data of two buffers, so that packet protocols
+    // keep returning one packet at a time
+    len = FFMIN(size, ra->sizes[ra->head] - ra->offset);
+    memcpy(buf, ra->buffers[ra->head] + ra->offset, len);
+    ra->offset += len;
+    ra->pos    += len;
+    if (ra->offset == ra->sizes[ra->head]) {
+        ra->head   = (ra->head + 1) % ra->nb_buffers;
+        ra->offset = 0;
+        if (ra->count-- == ra->nb_buffers)
+            pthread_cond_broadcast(&ra->cond);
+    }
+    pthread_mutex_unlock(&ra->mutex);
+    return len;
+}
+
+static int64_t read_ahead_seek(ByteIOContext *s, int64_t offset, int whence)
+{
+    ReadAhead *ra = s->read_ahead;
+    int64_t ret, end = ra->pos;
+    int i;
+
+    read_ahead_pause(ra);
+    // the protocol is at the end of the data read ahead
+    for (i = 0; i < ra->count; i++)
+        end += ra->sizes[(ra->head + i) % ra->nb_buffers] - (i ? 0 : ra->offset);
+    if (whence == SEEK_CUR) {
+        offset += ra->pos;
+        whence  = SEEK_SET;
+    }
+    if (whence == SEEK_SET && offset >= ra->pos && offset <= end) {
+        // skip data read ahead rather than drop it
+        while (ra->count && offset - ra->pos >= ra->sizes[ra->head] - ra->offset) {
+            ra->pos   += ra->sizes[ra->head] - ra->offset;
+            ra->head   = (ra->head + 1) % ra->nb_buffers;
+            ra->offset = 0;
+            ra->count--;
+        }
+        ra->offset += offset - ra->pos;
+        ra->pos     = offset;
+        read_ahead_resume(ra, 0, 0);
+        return offset;
+    }
+    ret = s->seek(s->opaque, offset, whence);
+    if (whence == AVSEEK_SIZE || ret < 0) {
+        if (whence != AVSEEK_SIZE)
+            s->seek(s->opaque, end, SEEK_SET);
+        read_ahead_resume(ra, 0, 0);
+        return ret;
+    }
+    read_ahead_resume(ra, 1, ret);
+    return ret;
+}
+
+static void read_ahead_close(ByteIOContext *s)
+{
+    ReadAhead *ra = s->read_ahead;
+    int i;
+
+    if (!ra)
+        return;
+    pthread_mutex_lock(&ra->mutex);
+    ra->abort = 1;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->mutex);
+    pthread_join(ra->thread, NULL);
+    pthread_cond_destroy(&ra->cond);
+    pthread_mutex_destroy(&ra->mutex);
+    for (i = 0; i < ra->nb_buffers; i++)
+        av_free(ra->buffers[i]);
+    av_free(ra->buffers);
+    av_free(ra->sizes);
+    av_freep(&s->read_ahead);
+}
+#endif
+
+int url_set_read_ahead(ByteIOContext *s, int nb_buffers)
+{
+#if HAVE_PTHREADS
+    ReadAhead *ra;
+    int i;
+
+    if (s->read_ahead || s->write_flag || !s->read_packet || nb_buffers <= 0)
+        return AVERROR(EINVAL);
+    if (!(ra = av_mallocz(sizeof(*ra))))
+        return AVERROR(ENOMEM);
+    ra->nb_buffers  = nb_buffers;
+    ra->buffer_size = s->buffer_size;
+    // the thread goes on from where the buffer of the ByteIOContext ends
+    ra->pos         = s->pos;
+    ra->buffers     = av_mallocz(nb_buffers * sizeof(*ra->buffers));
+    ra->sizes       = av_mallocz(nb_buffers * sizeof(*ra->sizes));
+    for (i = 0; ra->buffers && i < nb_buffers; i++)
+        if (!(ra->buffers[i] = av_malloc(ra->buffer_size)))
+            break;
+    if (!ra->sizes || i < nb_buffers) {
+        for (i = 0; ra->buffers && i < nb_buffers; i++)
+            av_free(ra->buffers[i]);
+        av_free(ra->buffers);
+        av_free(ra->sizes);
+        av_free(ra);
+        return AVERROR(ENOMEM);
+    }
+    pthread_mutex_init(&ra->mutex, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+    s->read_ahead = ra;
+    if (pthread_create(&ra->thread, NULL, read_ahead_thread, s)) {
+        s->read_ahead = NULL;
+        pthread_cond_destroy(&ra->cond);
+        pthread_mutex_destroy(&ra->mutex);
+        for (i = 0; i < nb_buffers; i++)
+            av_free(ra->buffers[i]);
+        av_free(ra->buffers);
+        av_free(ra->sizes);
+        av_free(ra);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+static int io_read(ByteIOContext *s, uint8_t *buf, int size)
+{
+#if HAVE_PTHREADS
+    if (s->read_ahead)
+        return read_ahead_read(s, buf, size);
+#endif
+    if (!s->read_packet)
+        return 0;
+    return s->read_packet(s->opaque, buf, size);
+}
+
+static int64_t io_seek(ByteIOContext *s, int64_t offset, int whence)
+{
+#if HAVE_PTHREADS
+    if (s->read_ahead)
+        return read_ahead_seek(s, offset, whence);
+#endif
+    return s->seek(s->opaque, offset, whence);
+}
+
 static void flush_buffer(ByteIOContext *s)
 {
     if (s->buf_ptr > s->buffer) {
@@ -167,7 +404,7 @@ int64_t url_fseek(ByteIOContext *s, int64_t offset, int whence)
             s->must_flush = 1;
         }
 #endif /* CONFIG_MUXERS || CONFIG_NETWORK */
-        if (!s->seek || (res = s->seek(s->opaque, offset, SEEK_SET)) < 0)
+        if (!s->seek || (res = io_seek(s, offset, SEEK_SET)) < 0)
             return res;
         if (!s->write_flag)
             s->buf_end = s->buffer;
@@ -197,12 +434,12 @@ int64_t url_fsize(ByteIOContext *s)
 
     if (!s->seek)
         return AVERROR(EPIPE);
-    size = s->seek(s->opaque, 0, AVSEEK_SIZE);
+    size = io_seek(s, 0, AVSEEK_SIZE);
     if(size<0){
-        if ((size = s->seek(s->opaque, -1, SEEK_END)) < 0)
+        if ((size = io_seek(s, -1, SEEK_END)) < 0)
             return size;
         size++;
-        s->seek(s->opaque, s->pos, SEEK_SET);
+        io_seek(s, s->pos, SEEK_SET);
     }
     return size;
 }
@@ -307,10 +544,7 @@ static void fill_buffer(ByteIOContext *s)
         s->checksum_ptr= s->buffer;
     }
 
-    if(s->read_packet)
-        len = s->read_packet(s->opaque, dst, len);
-    else
-        len = 0;
+    len = io_read(s, dst, len);
     if (len <= 0) {
         /* do not modify buffer if EOF reached so that a seek back can
            be done without rereading data */
@@ -387,7 +621,7 @@ int get_buffer(ByteIOContext *s, unsigned char *buf, int size)
         if (len == 0) {
             if(size > s->buffer_size && !s->update_checksum){
                 if(s->read_packet)
-                    len = s->read_packet(s->opaque, buf, size);
+                    len = io_read(s, buf, size);
                 if (len <= 0) {
                     /* do not modify buffer if EOF reached so that a seek back can
                     be done without rereading data */
@@ -615,6 +849,9 @@ int url_fclose(ByteIOContext *s)
 {
     URLContext *h = s->opaque;
 
+#if HAVE_PTHREADS
+    read_ahead_close(s);
+#endif
     av_free(s->buffer);
     av_free(s);
     return url_close(h);
@@ -680,6 +917,19 @@ int64_t av_url_read_fseek(ByteIOContext *s, int stream_index,
     int64_t ret;
     if (!s->read_seek)
         return AVERROR(ENOSYS);
+#if HAVE_PTHREADS
+    if (s->read_ahead) {
+        ReadAhead *ra = s->read_ahead;
+        read_ahead_pause(ra);
+        ret = s->read_seek(h, stream_index, timestamp, flags);
+        if (ret >= 0) {
+            s->buf_ptr = s->buf_end; // Flush buffer
+            s->pos = s->seek(h, 0, SEEK_CUR);
+        }
+        read_ahead_resume(ra, ret >= 0, s->pos);
+        return ret;
+    }
+#endif
     ret = s->read_seek(h, stream_index, timestamp, flags);
     if(ret >= 0) {
         s->buf_ptr = s->buf_end; // Flush buffer
@@ -35,86 +35,199 @@
 #include "libavutil/avstring.h"
 #include "internal.h"
 #include "playlist.h"
+#include "playlistscan.h"
 
 AVPlaylistContext *av_playlist_alloc(void)
 {
-    return av_mallocz(sizeof(AVPlaylistContext));
+    AVPlaylistContext *ctx = av_mallocz(sizeof(AVPlaylistContext));
+    if (ctx) {
+        ctx->offsets_item      = -1;
+        ctx->open_items_behind = -1;
+    }
+    return ctx;
 }
 
 int av_playlist_insert_item(AVPlaylistContext *ctx, const char *itempath, int pos)
 {
-    int i, itempath_len;
-    int64_t *durations_tmp, durations_offset;
-    unsigned int *nb_streams_list_tmp, nb_streams_offset;
-    AVFormatContext **formatcontext_list_tmp;
-    char **flist_tmp;
-    AVFormatContext *ic;
-    ++ctx->pelist_size;
-    flist_tmp = av_realloc(ctx->flist, sizeof(*(ctx->flist)) * ctx->pelist_size);
-    durations_tmp = av_realloc(ctx->durations,
-                               sizeof(*(ctx->durations)) * ctx->pelist_size);
-    nb_streams_list_tmp = av_realloc(ctx->nb_streams_list,
-                                     sizeof(*(ctx->nb_streams_list)) * ctx->pelist_size);
-    formatcontext_list_tmp = av_realloc(ctx->formatcontext_list,
-                                        sizeof(*(ctx->formatcontext_list)) * ctx->pelist_size);
-    if (!flist_tmp ||
-        !durations_tmp ||
-        !nb_streams_list_tmp ||
-        !formatcontext_list_tmp) {
-        av_log(ctx, AV_LOG_ERROR,
-               "av_realloc error in av_playlist_insert_item\n");
-        return AVERROR_NOMEM;
-    } else {
-        ctx->flist              = flist_tmp;
-        ctx->durations          = durations_tmp;
-        ctx->nb_streams_list    = nb_streams_list_tmp;
-        ctx->formatcontext_list = formatcontext_list_tmp;
+    int64_t item_duration = 0;
+    unsigned int item_nb_streams = 0;
+    AVPlaylistItem *items_tmp, *item;
+    if (pos < 0 || pos > ctx->pelist_size) {
+        av_log(NULL, AV_LOG_ERROR,
+               "invalid position %d in av_playlist_insert_item\n", pos);
+        return AVERROR_INVALIDDATA;
     }
-    ic = ff_playlist_alloc_formatcontext(itempath);
-    if (!ic) {
-        av_log(ctx, AV_LOG_ERROR,
+    if (!(ctx->flags & AV_PLAYLIST_FLAG_LAZY) &&
+        ff_playlist_probe_file(ctx->probe_cache, itempath, ctx->flags,
+                               &item_duration, &item_nb_streams) < 0) {
+        av_log(ctx->master_formatcontext, AV_LOG_ERROR,
                "failed to allocate and open %s in av_playlist_insert_item\n",
                itempath);
         return AVERROR_NOMEM;
     }
-    if (pos > 0) {
-        durations_offset  = ic->duration + ctx->durations[pos - 1];
-        nb_streams_offset = ic->nb_streams + ctx->nb_streams_list[pos - 1];
-    } else {
-        durations_offset  = ic->duration;
-        nb_streams_offset = ic->nb_streams;
-    }
-    av_close_input_file(ic);
-    for (i = ctx->pelist_size; i > pos; --i) {
-        ctx->flist[i] = ctx->flist[i - 1];
-        ctx->durations[i] = ctx->durations[i - 1] + durations_offset;
-        ctx->nb_streams_list[i] = ctx->nb_streams_list[i - 1] + nb_streams_offset;
-        ctx->formatcontext_list[i] = ctx->formatcontext_list[i - 1];
+    // grows geometrically, so that appending is amortized constant time
+    items_tmp = av_fast_realloc(ctx->items, &ctx->items_allocated,
+                                sizeof(*ctx->items) * (ctx->pelist_size + 1));
+    if (!items_tmp) {
+        av_log(ctx->master_formatcontext, AV_LOG_ERROR,
+               "av_realloc error in av_playlist_insert_item\n");
+        return AVERROR_NOMEM;
     }
-    ctx->formatcontext_list[pos] = NULL;
-    ctx->durations[pos]          = durations_offset;
-    ctx->nb_streams_list[pos]    = nb_streams_offset;
-    itempath_len                 = strlen(itempath);
-    ctx->flist[pos]              = av_malloc(itempath_len + 1);
-    if (!ctx->flist[pos]) {
-        av_log(ctx, AV_LOG_ERROR,
+    ctx->items = items_tmp;
+    item = &ctx->items[pos];
+    memmove(item + 1, item, sizeof(*item) * (ctx->pelist_size - pos));
+    memset(item, 0, sizeof(*item));
+    if (!(item->filename = av_strdup(itempath))) {
+        memmove(item, item + 1, sizeof(*item) * (ctx->pelist_size - pos));
+        av_log(ctx->master_formatcontext, AV_LOG_ERROR,
                "av_malloc error in av_playlist_insert_item\n");
         return AVERROR_NOMEM;
     }
-    av_strlcpy(ctx->flist[pos], itempath, itempath_len + 1);
+    item->duration   = item_duration;
+    item->nb_streams = item_nb_streams;
+    item->probed     = !(ctx->flags & AV_PLAYLIST_FLAG_LAZY);
+    item->stream_base = -1;
+    item->start_time  = AV_NOPTS_VALUE;
+    ++ctx->pelist_size;
+    ff_playlist_tree_rebuild(ctx, pos);
     // duration is updated in case it's checked by a parent demuxer (chained concat demuxers)
     if (ctx->master_formatcontext)
-        ctx->master_formatcontext->duration = ctx->durations[ctx->pelist_size - 1];
+        ctx->master_formatcontext->duration = av_playlist_time_offset(ctx, ctx->pelist_size);
     return 0;
 }
 
+int av_playlist_probe_item(AVPlaylistContext *ctx, int pos)
+{
+    AVFormatContext *ic;
+    if (pos < 0 || pos >= ctx->pelist_size) {
+        av_log(ctx->master_formatcontext, AV_LOG_ERROR,
+               "failed to probe item %d which is not present in playlist\n",
+               pos);
+        return AVERROR_INVALIDDATA;
+    }
+    if (ctx->items[pos].probed)
+        return 0;
+    if (ctx->items[pos].formatcontext) {
+        ff_playlist_set_item_info(ctx, pos, ctx->items[pos].formatcontext);
+        return 0;
+    }
+    ic = ff_playlist_alloc_formatcontext(ctx->probe_cache, ctx->items[pos].filename, ctx->flags);
+    if (!ic) {
+        av_log(ctx->master_formatcontext, AV_LOG_ERROR,
+               "failed to open %s in av_playlist_probe_item\n",
+               ctx->items[pos].filename);
+        return AVERROR_NOFMT;
+    }
+    ff_playlist_set_item_info(ctx, pos, ic);
+    av_close_input_file(ic);
+    return 0;
+}
+
+int av_playlist_set_probe_cache(AVPlaylistContext *ctx, const char *filename)
+{
+    PlaylistCache *cache = ff_playlist_cache_open(filename);
+    if (!cache) {
+        av_log(NULL, AV_LOG_ERROR,
+               "failed to allocate probe cache in av_playlist_set_probe_cache\n");
+        return AVERROR_NOMEM;
+    }
+    ff_playlist_prefetch_cancel(ctx);
+    ff_playlist_cache_close(ctx->probe_cache);
+    ctx->probe_cache = cache;
+    return 0;
+}
+
+/** @brief Caches the offsets of an item, which consecutive packets mostly share. */
+static void playlist_cache_offsets(AVPlaylistContext *ctx, int pos)
+{
+    if (ctx->offsets_item == pos)
+        return;
+    ff_playlist_tree_prefix(ctx, pos, &ctx->offsets_time, &ctx->offsets_streams);
+    ctx->offsets_item = pos;
+}
+
+int av_playlist_item_from_stream_index(AVPlaylistContext *ctx,
+                                       int stream_index,
+                                       int *local_stream_index)
+{
+    int i = ctx->offsets_item;
+    if (stream_index < 0)
+        return AVERROR_INVALIDDATA;
+    if (i < 0 || i >= ctx->pelist_size ||
+        stream_index <  ctx->offsets_streams ||
+        stream_index >= ctx->offsets_streams + ctx->items[i].nb_streams) {
+        // items without streams are skipped by the search
+        i = ff_playlist_tree_search_stream(ctx, stream_index);
+        if (i >= ctx->pelist_size)
+            return AVERROR_INVALIDDATA;
+        playlist_cache_offsets(ctx, i);
+    }
+    if (local_stream_index)
+        *local_stream_index = stream_index - ctx->offsets_streams;
+    return i;
+}
+
+int av_playlist_audio_trim(AVPlaylistContext *ctx, int stream_index,
+                           int *pos, int *delay, int64_t *nb_samples)
+{
+    int i = ctx->pe_curidx;
+    AVPlaylistItem *item;
+    AVFormatContext *ic;
+    AVStream *st;
+    if (i < 0 || i >= ctx->pelist_size ||
+        ctx->flags & AV_PLAYLIST_FLAG_STREAM_COPY)
+        return AVERROR_INVALIDDATA;
+    // with unified streams, the packets of a stream come from the current item
+    item = &ctx->items[i];
+    ic   = item->formatcontext;
+    if (!ic || item->stream_base < 0 || stream_index < item->stream_base ||
+        stream_index >= item->stream_base + ic->nb_streams) {
+        if ((i = av_playlist_item_from_stream_index(ctx, stream_index, NULL)) < 0)
+            return i;
+        item = &ctx->items[i];
+        ic   = item->formatcontext;
+        if (!ic || item->stream_base < 0 || stream_index < item->stream_base ||
+            stream_index >= item->stream_base + ic->nb_streams)
+            return AVERROR_INVALIDDATA;
+    }
+    st = ic->streams[stream_index - item->stream_base];
+    if (st->codec->codec_type != CODEC_TYPE_AUDIO || !st->codec->sample_rate ||
+        (!st->encoder_delay && !st->encoder_padding))
+        return AVERROR_INVALIDDATA;
+    *pos        = i;
+    *delay      = st->encoder_delay;
+    *nb_samples = INT64_MAX;
+    if (st->duration != AV_NOPTS_VALUE)
+        *nb_samples = FFMAX(av_rescale_q(st->duration, st->time_base,
+                                         (AVRational){1, st->codec->sample_rate}) -
+                            st->encoder_delay - st->encoder_padding, 0);
+    // the AAC decoder outputs nothing for the first frame it is given
+    if (st->codec->codec_id == CODEC_ID_AAC)
+        *delay = FFMAX(*delay - 1024, 0);
+    return 0;
+}
+
+int64_t av_playlist_time_offset(AVPlaylistContext *ctx, int pos)
+{
+    playlist_cache_offsets(ctx, pos);
+    // the last item is played to its end, so the total duration is reached
+    // at its end rather than an overlap before
+    return ctx->offsets_time - ctx->overlap * FFMAX(FFMIN(pos, ctx->pelist_size - 1), 0);
+}
+
+unsigned int av_playlist_streams_offset(AVPlaylistContext *ctx, int pos)
+{
+    playlist_cache_offsets(ctx, pos);
+    return ctx->offsets_streams;
+}
+
 int av_playlist_insert_playlist(AVPlaylistContext *ctx, AVPlaylistContext *insert_ctx, int pos)
 {
     int i, err;
     for (i = 0; i < insert_ctx->pelist_size; ++i) {
-        err = av_playlist_insert_item(ctx, insert_ctx->flist[i], pos + i);
+        err = av_playlist_insert_item(ctx, insert_ctx->items[i].filename, pos + i);
         if (err) {
-            av_log(ctx, AV_LOG_ERROR,
+            av_log(ctx->master_formatcontext, AV_LOG_ERROR,
                    "failed to insert item %d to new position %d in av_playlist_insert_playlist\n",
                    i, pos + i);
             return err;
@@ -125,80 +238,48 @@ int av_playlist_insert_playlist(AVPlaylistContext *ctx, AVPlaylistContext *inser
 
 int av_playlist_remove_item(AVPlaylistContext *ctx, int pos)
 {
-    int i;
-    int64_t *durations_tmp, durations_offset;
-    unsigned int *nb_streams_list_tmp, nb_streams_offset;
-    AVFormatContext **formatcontext_list_tmp;
-    char **flist_tmp;
-    if (pos >= ctx->pelist_size || !ctx->flist || !ctx->durations || !ctx->nb_streams_list) {
-        av_log(ctx, AV_LOG_ERROR,
+    AVPlaylistItem *item;
+    if (pos < 0 || pos >= ctx->pelist_size) {
+        av_log(ctx->master_formatcontext, AV_LOG_ERROR,
                "failed to remove item %d which is not present in playlist\n",
                pos);
         return AVERROR_INVALIDDATA;
     }
+    item = &ctx->items[pos];
+    av_free(item->filename);
+    if (item->formatcontext)
+        av_close_input_file(item->formatcontext);
+    ff_playlist_free_index(item);
     --ctx->pelist_size;
-    av_free(ctx->flist[pos]);
-    if (pos > 0) {
-        durations_offset  = ctx->durations[pos] - ctx->durations[pos - 1];
-        nb_streams_offset = ctx->nb_streams_list[pos] - ctx->nb_streams_list[pos - 1];
-    } else {
-        durations_offset  = ctx->durations[pos];
-        nb_streams_offset = ctx->nb_streams_list[pos];
-    }
-    if (ctx->formatcontext_list && ctx->formatcontext_list[pos]) {
-        av_close_input_file(ctx->formatcontext_list[pos]);
-        av_close_input_stream(ctx->formatcontext_list[pos]);
-        av_free(ctx->formatcontext_list[pos]);
-        ctx->formatcontext_list[pos] = NULL;
-    }
-    for (i = pos; i < ctx->pelist_size; ++i) {
-        ctx->flist[i] = ctx->flist[i + 1];
-        ctx->durations[i] = ctx->durations[i + 1] - durations_offset;
-        ctx->nb_streams_list[i] = ctx->nb_streams_list[i + 1] - nb_streams_offset;
-        ctx->formatcontext_list[i] = ctx->formatcontext_list[i + 1];
-    }
-    flist_tmp = av_realloc(ctx->flist, sizeof(*(ctx->flist)) * ctx->pelist_size);
-    durations_tmp = av_realloc(ctx->durations,
-                               sizeof(*(ctx->durations)) * ctx->pelist_size);
-    nb_streams_list_tmp = av_realloc(ctx->nb_streams_list,
-                                     sizeof(*(ctx->nb_streams_list)) * ctx->pelist_size);
-    formatcontext_list_tmp = av_realloc(ctx->formatcontext_list,
-                                        sizeof(*(ctx->formatcontext_list)) * ctx->pelist_size);
-    if (!flist_tmp ||
-        !durations_tmp ||
-        !nb_streams_list_tmp ||
-        !formatcontext_list_tmp) {
-        av_log(ctx, AV_LOG_ERROR,
-               "av_realloc error in av_playlist_remove_item\n");
-        return AVERROR_NOMEM;
-    } else {
-        ctx->flist              = flist_tmp;
-        ctx->durations          = durations_tmp;
-        ctx->nb_streams_list    = nb_streams_list_tmp;
-        ctx->formatcontext_list = formatcontext_list_tmp;
-    }
+    memmove(item, item + 1, sizeof(*item) * (ctx->pelist_size - pos));
+    if (ctx->pe_curidx > pos)
+        --ctx->pe_curidx;
+    ff_playlist_tree_rebuild(ctx, pos);
     // duration is updated in case it's checked by a parent demuxer (chained concat demuxers)
     if (ctx->master_formatcontext)
-        ctx->master_formatcontext->duration = ctx->durations[ctx->pelist_size - 1];
+        ctx->master_formatcontext->duration = av_playlist_time_offset(ctx, ctx->pelist_size);
     return 0;
 }
 
 int av_playlist_close(AVPlaylistContext *ctx)
 {
     int err;
+    ff_playlist_prefetch_cancel(ctx);
+    ff_playlist_cache_close(ctx->probe_cache);
+    ctx->probe_cache = NULL;
+    ff_playlist_scanner_close(ctx);
+    av_freep(&ctx->live);
     while (ctx->pelist_size > 0) {
         err = av_playlist_remove_item(ctx, ctx->pelist_size-1);
         if (err) {
-            av_log(ctx, AV_LOG_ERROR,
+            av_log(ctx->master_formatcontext, AV_LOG_ERROR,
                    "failed to remove item %d from playlist",
                    ctx->pelist_size-1);
             return err;
         }
     }
-    av_free(ctx->flist);
-    av_free(ctx->durations);
-    av_free(ctx->nb_streams_list);
-    av_free(ctx->formatcontext_list);
+    av_free(ctx->items);
+    av_free(ctx->stream_ts_offsets);
     av_free(ctx);
     return 0;
 }
@@ -36,19 +36,73 @@
 #include <libgen.h>
 #include "avformat.h"
 
+/** @struct AVPlaylistItem
+ *  @brief Represents a playlist item and its position in the playlist timeline.
+ */
+typedef struct AVPlaylistItem {
+    char *filename;                        /**< Path of the item */
+    AVFormatContext *formatcontext;        /**< AVFormatContext of the item, NULL if it is not opened */
+    int64_t duration;                      /**< Duration of the item in AV_TIME_BASE units, 0 if unknown */
+    unsigned int nb_streams;               /**< Number of streams the item adds to the playlist demuxer; 0 if it reuses the streams of another item */
+    int stream_base;                       /**< Global index of the first stream of the item once it was switched to, -1 before */
+    int64_t start_time;                    /**< Earliest start time or first dts of the streams of the item in AV_TIME_BASE units, AV_NOPTS_VALUE until it was switched to */
+    unsigned int last_used;                /**< Value of use_counter of the playlist when the item was last switched to */
+    int probed;                            /**< Nonzero if duration and nb_streams are known */
+    int64_t durations_tree;                /**< Binary indexed tree node: sum of the durations of the items from index & (index + 1) to this one */
+    unsigned int nb_streams_tree;          /**< Binary indexed tree node: sum of the number of streams of the same items */
+    AVIndexEntry **index_entries;          /**< Index entries of each stream of the item, kept while it is closed so that seeking into it again needs no probing reads; NULL if none were kept */
+    int *nb_index_entries;                 /**< Number of entries in each list of index_entries */
+    unsigned int index_nb_streams;         /**< Number of streams in index_entries and nb_index_entries */
+} AVPlaylistItem;
+
 /** @struct AVPlaylistContext
  *  @brief Represents the playlist and contains AVFormatContext for each playlist item.
+ *  @details Cumulative durations and stream counts are kept in binary indexed
+ *  (Fenwick) trees inside the items, so that they can be queried and updated in
+ *  O(log n); use av_playlist_time_offset and av_playlist_streams_offset to read them.
  */
 typedef struct AVPlaylistContext {
-    char **flist;                          /**< List of file names for each playlist item */
-    AVFormatContext **formatcontext_list;  /**< List of AVFormatContext for each playlist item */
-    int pelist_size;                       /**< Number of playlist elements stored in formatcontext_list */
-    int pe_curidx;                         /**< Index of the AVFormatContext in formatcontext_list that packets are being read from */
-    int64_t *durations;                    /**< Sum of current and previous durations, in AV_TIME_BASE units, for each playlist item */
-    unsigned int *nb_streams_list;         /**< Sum of current and previous number of streams in each playlist item*/
+    AVPlaylistItem *items;                 /**< List of playlist items */
+    int pelist_size;                       /**< Number of playlist elements stored in items */
+    unsigned int items_allocated;          /**< Allocated size of items, in bytes */
+    int pe_curidx;                         /**< Index of the item in items that packets are being read from */
     AVFormatContext *master_formatcontext; /**< Parent AVFormatContext of which priv_data is this playlist. NULL if playlist is used standalone. */
+    int flags;                             /**< AV_PLAYLIST_FLAG_* flags controlling how items are inserted and opened */
+    int prefetch_packets;                  /**< Number of packets of the next item to read in a background thread while the current one plays; 0 disables prefetching. As the thread opens decoders, prefetching also needs a lock manager registered with av_lockmgr_register() */
+    int open_items_behind;                 /**< Number of items besides the current and prefetched ones that are kept open, the least recently used others being closed; negative keeps all items open */
+    unsigned int use_counter;              /**< Number of switches to an item so far */
+    void *prefetch_opaque;                 /**< Internal state of a running prefetch, NULL if none is running */
+    void *probe_cache;                     /**< Cache of probe results consulted when opening items, NULL if caching is disabled */
+    void *scanner;                         /**< State of the scan of the playlist file for more items, NULL once all items were found */
+    void *live;                            /**< State of the reloading of a live playlist file, NULL if the file is not reloaded */
+    int offsets_item;                      /**< Item whose offsets are cached in offsets_time and offsets_streams, -1 if none */
+    int64_t offsets_time;                  /**< Sum of the durations of the items before offsets_item */
+    unsigned int offsets_streams;          /**< Number of streams of the items before offsets_item */
+    int layout_base;                       /**< Global index of the first stream of the current item */
+    unsigned int layout_nb_streams;        /**< Number of streams of the current item, 0 if none was switched to yet */
+    int64_t ts_offset;                     /**< Offset added to the timestamps of the current item, in AV_TIME_BASE units */
+    int64_t *stream_ts_offsets;            /**< ts_offset in the time base of each stream of the current item */
+    unsigned int stream_ts_offsets_allocated; /**< Allocated size of stream_ts_offsets, in bytes */
+    unsigned int nb_stream_ts_offsets;     /**< Number of streams of the current item in stream_ts_offsets, which demuxers adding streams while reading can exceed */
+    int64_t overlap;                       /**< Time in AV_TIME_BASE units by which each item starts before the end of the previous one, whose end is then read along with it; 0 disables overlapping */
+    void *tail;                            /**< State of the reading of the end of the previous item along with the current one, NULL if none is read */
 } AVPlaylistContext;
 
+/** Insert items without opening them; durations and stream counts are probed
+ *  on demand (when switching to, seeking into or explicitly probing an item). */
+#define AV_PLAYLIST_FLAG_LAZY 0x0001
+
+/** Map items whose codec parameters match those of the preceding item onto
+ *  the same streams, keeping their already opened decoders, instead of adding
+ *  new streams for every item. */
+#define AV_PLAYLIST_FLAG_UNIFY_STREAMS 0x0002
+
+/** Demux only, for stream copy: decoders are never opened, items are only
+ *  probed if their header does not describe their streams, and every item
+ *  must have the same streams with the same codec parameters as the previous
+ *  ones, which it is mapped onto. */
+#define AV_PLAYLIST_FLAG_STREAM_COPY 0x0004
+
 /** @brief Allocates and sets default values for an empty AVPlaylistContext
  *  @return NULL upon failure, newly allocated, empty AVPlaylistContext upon success.
  */
@@ -56,6 +110,8 @@ AVPlaylistContext *av_playlist_alloc(void);
 
 /** @brief Creates and adds AVFormatContext for item located at specified path to a AVPlaylistContext
  *  at specified index. Existing items will be shifted up in the list.
+ *  If AV_PLAYLIST_FLAG_LAZY is set, the item is not probed and contributes no
+ *  duration or streams until av_playlist_probe_item is called for it.
  *  @param ctx Pre-allocated AVPlaylistContext to add elements to.
  *  @param itempath Absolute path to item for which to add a playlist element.
  *  @param pos Zero-based index which the newly inserted item will occupy.
@@ -63,6 +119,66 @@ AVPlaylistContext *av_playlist_alloc(void);
  */
 int av_playlist_insert_item(AVPlaylistContext *ctx, const char *itempath, int pos);
 
+/** @brief Opens the item at the specified index, if it has not been probed yet,
+ *  and records its duration and number of streams in the playlist.
+ *  @param ctx Pre-allocated AVPlaylistContext containing the item.
+ *  @param pos Zero-based index of the item to probe.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int av_playlist_probe_item(AVPlaylistContext *ctx, int pos);
+
+/** @brief Enables caching of item probe results in the specified file.
+ *  Items whose path, size and modification time match a cache entry are
+ *  inserted and opened without being probed. New entries are written to the
+ *  file when the playlist is closed.
+ *  @param ctx Pre-allocated AVPlaylistContext to use the cache for.
+ *  @param filename Path of the cache file; it is created if it does not exist.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int av_playlist_set_probe_cache(AVPlaylistContext *ctx, const char *filename);
+
+/** @brief Finds the playlist item to which a stream of the playlist demuxer belongs.
+ *  Takes constant time if the stream belongs to the same item as in the previous
+ *  lookup, as is the case for consecutive packets, and O(log n) time otherwise.
+ *  @param ctx AVPlaylistContext within which the cumulative stream counts are stored.
+ *  @param stream_index Global stream index, the index of the stream within the playlist demuxer.
+ *  @param local_stream_index If not NULL, set to the index of the stream within the item.
+ *  @return Returns the zero-based index of the item, or negative if no item has such a stream.
+ */
+int av_playlist_item_from_stream_index(AVPlaylistContext *ctx,
+                                       int stream_index,
+                                       int *local_stream_index);
+
+/** @brief Tells which decoded samples of a stream of the item being read are
+ *  encoder delay or padding, to be dropped for gapless playback.
+ *  The delay is placed before the start of the item in the playlist timeline,
+ *  and its padding after the end, so that the next item follows its last sample.
+ *  @param ctx AVPlaylistContext of the playlist demuxer.
+ *  @param stream_index Global index of the stream the packet was read from.
+ *  @param pos Set to the index of the item, which callers count the samples decoded from.
+ *  @param delay Set to the number of decoded samples of delay the item starts with.
+ *  @param nb_samples Set to the number of samples following the delay that are
+ *  kept, INT64_MAX if the length of the stream is not known.
+ *  @return Returns 0 upon success, or negative if no samples are to be dropped.
+ */
+int av_playlist_audio_trim(AVPlaylistContext *ctx, int stream_index,
+                           int *pos, int *delay, int64_t *nb_samples);
+
+/** @brief Returns the time at which an item starts in the playlist timeline.
+ *  @param ctx AVPlaylistContext within which the cumulative durations are stored.
+ *  @param pos Zero-based index of the item; pelist_size gives the total duration.
+ *  @return Returns the sum of the durations of the items before pos, less the
+ *  overlap of every item before pos but the last one, in AV_TIME_BASE units.
+ */
+int64_t av_playlist_time_offset(AVPlaylistContext *ctx, int pos);
+
+/** @brief Returns the global index of the first stream of an item.
+ *  @param ctx AVPlaylistContext within which the cumulative stream counts are stored.
+ *  @param pos Zero-based index of the item; pelist_size gives the total number of streams.
+ *  @return Returns the number of streams of the items before pos.
+ */
+unsigned int av_playlist_streams_offset(AVPlaylistContext *ctx, int pos);
+
 /** @brief Creates and adds AVFormatContext for all items in another playlist,
  *  starting at the specified index and appending until the end of the other
  *  playlist. Existing items will be shifted up in the list.
@@ -31,8 +31,174 @@
 
 #include "concatgen.h"
 #include "avformat.h"
+#include "internal.h"
 #include "avplaylist.h"
 #include "playlist.h"
+#include "playlistscan.h"
+
+/** @brief State of the reading of the end of an item along with the start of
+ *  the next one, which has become the current item. */
+typedef struct ConcatTail {
+    int pos;                   /**< Index of the item whose end is read */
+    int64_t *ts_offsets;       /**< stream_ts_offsets of the item while it was current */
+    unsigned int nb_ts_offsets; /**< Number of streams in ts_offsets */
+    AVPacket pkt[2];           /**< Next packet of the item and of the current one */
+    int have_pkt[2];           /**< Nonzero if the corresponding packet is set */
+    int current_ended;         /**< Nonzero once reading the current item failed */
+} ConcatTail;
+
+/** @brief Moves a packet of an item onto its global streams and the playlist timeline.
+ *  @return Returns 0 upon success, or negative if the packet belongs to none
+ *  of the streams of the item that were added to the master.
+ */
+static int concatgen_map_packet(AVFormatContext *s, AVPacket *pkt, int stream_base,
+                                unsigned int nb_streams, const int64_t *ts_offsets)
+{
+    int stream_index = pkt->stream_index;
+    if (stream_index < 0 || stream_index >= nb_streams ||
+        stream_base + stream_index >= s->nb_streams)
+        return AVERROR_INVALIDDATA;
+    pkt->stream_index = stream_index + stream_base;
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts += ts_offsets[stream_index];
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts += ts_offsets[stream_index];
+    return 0;
+}
+
+/** @brief Reads the next packet of an item and maps it with the given offsets,
+ *  dropping the packets of streams that are not mapped, such as those added
+ *  by the demuxer after the offsets were computed.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+static int concatgen_read_item_packet(AVFormatContext *s, int pos, AVPacket *pkt,
+                                      const int64_t *ts_offsets, unsigned int nb_ts_offsets)
+{
+    AVPlaylistContext *ctx = s->priv_data;
+    AVPlaylistItem *item = &ctx->items[pos];
+    int ret;
+    for (;;) {
+        av_init_packet(pkt);
+        if ((ret = ff_playlist_read_packet(ctx, pos, pkt)) < 0)
+            return ret;
+        if (concatgen_map_packet(s, pkt, item->stream_base, nb_ts_offsets, ts_offsets) >= 0)
+            return 0;
+        av_log(s, AV_LOG_DEBUG, "Dropping packet of unmapped stream %d of playlist item %d\n",
+               pkt->stream_index, pos);
+        av_free_packet(pkt);
+    }
+}
+
+static void concatgen_free_tail(AVPlaylistContext *ctx)
+{
+    ConcatTail *tail = ctx->tail;
+    int i;
+    if (!tail)
+        return;
+    for (i = 0; i < 2; i++)
+        if (tail->have_pkt[i])
+            av_free_packet(&tail->pkt[i]);
+    av_free(tail->ts_offsets);
+    av_freep(&ctx->tail);
+}
+
+/** @brief Returns the packet with the lower dts among the next ones of the
+ *  item whose end is read and of the current item.
+ *  @return Returns 0 upon success, 1 once the end of the item was read and
+ *  reading goes on from the current item alone, or negative upon failure.
+ */
+static int concatgen_read_tail(AVFormatContext *s, AVPacket *pkt)
+{
+    AVPlaylistContext *ctx = s->priv_data;
+    ConcatTail *tail = ctx->tail;
+    AVPlaylistItem *item = &ctx->items[tail->pos];
+    int ret, i;
+
+    if (!tail->have_pkt[0] && item->formatcontext &&
+        concatgen_read_item_packet(s, tail->pos, &tail->pkt[0],
+                                   tail->ts_offsets, tail->nb_ts_offsets) >= 0)
+        tail->have_pkt[0] = 1;
+    if (!tail->have_pkt[1] && !tail->current_ended) {
+        ret = concatgen_read_item_packet(s, ctx->pe_curidx, &tail->pkt[1],
+                                         ctx->stream_ts_offsets, ctx->nb_stream_ts_offsets);
+        if (ret >= 0) {
+            tail->have_pkt[1] = 1;
+        } else if (ret == AVERROR(EAGAIN)) {
+            if (!tail->have_pkt[0])
+                return ret;
+        } else {
+            // the end of the current item is found again once the tail is read
+            tail->current_ended = 1;
+        }
+    }
+    if (!tail->have_pkt[0] && !tail->have_pkt[1]) {
+        concatgen_free_tail(ctx);
+        ff_playlist_close_unused_items(ctx);
+        return 1;
+    }
+    // packets without dts follow the previous one of their item
+    i = !tail->have_pkt[0];
+    if (tail->have_pkt[0] && tail->have_pkt[1] && tail->pkt[0].dts != AV_NOPTS_VALUE &&
+        (tail->pkt[1].dts == AV_NOPTS_VALUE ||
+         av_rescale_q(tail->pkt[1].dts, s->streams[tail->pkt[1].stream_index]->time_base, AV_TIME_BASE_Q) <
+         av_rescale_q(tail->pkt[0].dts, s->streams[tail->pkt[0].stream_index]->time_base, AV_TIME_BASE_Q)))
+        i = 1;
+    // packets of either item stay valid while the other one is read
+    if ((ret = av_dup_packet(&tail->pkt[i])) < 0)
+        return ret;
+    *pkt = tail->pkt[i];
+    tail->have_pkt[i] = 0;
+    return 0;
+}
+
+/** @brief Switches to the next item once a packet of the current one reaches
+ *  the start of the next in the timeline, so that both are read together.
+ *  @return Returns 1 if the packet is kept to be returned along with those of
+ *  the next item, 0 if no overlap starts, or negative upon failure.
+ */
+static int concatgen_start_tail(AVFormatContext *s, AVPacket *pkt)
+{
+    AVPlaylistContext *ctx = s->priv_data;
+    ConcatTail *tail;
+    int64_t start;
+    int err;
+
+    if (!ctx->overlap || ctx->tail || ctx->pe_curidx >= ctx->pelist_size - 1 ||
+        pkt->dts == AV_NOPTS_VALUE)
+        return 0;
+    start = ctx->items[0].start_time + av_playlist_time_offset(ctx, ctx->pe_curidx + 1);
+    if (av_rescale_q(pkt->dts, s->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q) < start)
+        return 0;
+    if (!(tail = av_mallocz(sizeof(*tail))))
+        return AVERROR_NOMEM;
+    tail->nb_ts_offsets = ctx->nb_stream_ts_offsets;
+    if (!(tail->ts_offsets = av_malloc(sizeof(*tail->ts_offsets) * tail->nb_ts_offsets))) {
+        av_free(tail);
+        return AVERROR_NOMEM;
+    }
+    memcpy(tail->ts_offsets, ctx->stream_ts_offsets, sizeof(*tail->ts_offsets) * tail->nb_ts_offsets);
+    tail->pos = ctx->pe_curidx;
+    // the item goes on being read from where it is, as if it was not switched from
+    if (ff_playlist_open_item(ctx, ++ctx->pe_curidx) < 0 ||
+        ff_playlist_set_streams(ctx) < 0) {
+        av_log(s, AV_LOG_ERROR, "Failed to overlap playlist item %d\n", ctx->pe_curidx);
+        ctx->pe_curidx = tail->pos;
+        ff_playlist_set_streams(ctx);
+        av_free(tail->ts_offsets);
+        av_free(tail);
+        return 0;
+    }
+    // the item is only closed once its end has been read
+    if ((err = av_dup_packet(pkt)) < 0) {
+        av_free(tail->ts_offsets);
+        av_free(tail);
+        return err;
+    }
+    tail->pkt[0]      = *pkt;
+    tail->have_pkt[0] = 1;
+    ctx->tail = tail;
+    return 1;
+}
 
 int ff_concatgen_read_packet(AVFormatContext *s,
                              AVPacket *pkt)
@@ -42,38 +208,32 @@ int ff_concatgen_read_packet(AVFormatContext *s,
     AVPlaylistContext *ctx = s->priv_data;
     AVFormatContext *ic;
     stream_index = 0;
+    // items are appended while playing, one block of the playlist file at a
+    // time, and at most one item per packet if each of them is probed
+    if ((ret = ff_playlist_scan_items(ctx, ctx->flags & AV_PLAYLIST_FLAG_LAZY ? INT_MAX : 1, 1)) < 0)
+        return ret;
+    ff_playlist_prefetch_start(ctx);
+    // while items overlap, the end of the previous one is read as well
+    if (ctx->tail && (ret = concatgen_read_tail(s, pkt)) <= 0)
+        return ret;
     for (;;) {
-        ic = ctx->formatcontext_list[ctx->pe_curidx];
-        av_init_packet(pkt);
-        if (s->packet_buffer) {
-            *pkt = s->packet_buffer->pkt;
-            s->packet_buffer = s->packet_buffer->next;
-            ret = 0;
-        } else {
-            ret = ic->iformat->read_packet(ic, pkt);
-        }
+        ic = ctx->items[ctx->pe_curidx].formatcontext;
+        ret = concatgen_read_item_packet(s, ctx->pe_curidx, pkt, ctx->stream_ts_offsets,
+                                         ctx->nb_stream_ts_offsets);
         if (ret >= 0) {
             if (pkt) {
-                int streams_offset = 0;
-                if (ctx->pe_curidx > 0)
-                    streams_offset = ctx->nb_streams_list[ctx->pe_curidx - 1];
-                stream_index = ff_playlist_localstidx_from_streamidx(ctx, pkt->stream_index);
-                pkt->stream_index = stream_index + streams_offset;
-                if (!ic->streams[stream_index]->codec->has_b_frames ||
-                    ic->streams[stream_index]->codec->codec->id == CODEC_ID_MPEG1VIDEO) {
-                    int64_t time_offset_localbase = 0;
-                    if (ctx->pe_curidx > 0)
-                        time_offset_localbase = av_rescale_q(ctx->durations[ctx->pe_curidx - 1],
-                                                             AV_TIME_BASE_Q,
-                                                             ic->streams[stream_index]->time_base);
-                    if (pkt->dts != AV_NOPTS_VALUE)
-                        pkt->dts += time_offset_localbase;
-                    if (pkt->pts != AV_NOPTS_VALUE)
-                        pkt->pts += time_offset_localbase;
-                }
+                stream_index = pkt->stream_index;
+                if ((ret = concatgen_start_tail(s, pkt)) > 0)
+                    return concatgen_read_tail(s, pkt);
+                if (ret < 0)
+                    av_free_packet(pkt);
             }
             break;
         } else {
+            // the next item may not have been scanned yet
+            if (ctx->pe_curidx == ctx->pelist_size - 1 &&
+                ff_playlist_scan_items(ctx, 1, -1) < 0)
+                break;
             if (!have_switched_streams &&
                 ctx->pe_curidx < ctx->pelist_size - 1 &&
                 ret != AVERROR(EAGAIN)) {
@@ -83,21 +243,21 @@ int ff_concatgen_read_packet(AVFormatContext *s,
                 av_log(ic, AV_LOG_DEBUG,
                        "Switching stream %d to %d\n",
                        stream_index, ctx->pe_curidx+1);
-                if (!ctx->formatcontext_list[++ctx->pe_curidx]) {
-                    if (!(ctx->formatcontext_list[ctx->pe_curidx] =
-                        ff_playlist_alloc_formatcontext(ctx->flist[ctx->pe_curidx]))) {
-                        av_log(NULL, AV_LOG_ERROR,
-                               "Failed to switch to AVFormatContext %d\n",
-                               ctx->pe_curidx);
-                        break;
-                    }
+                ff_playlist_extend_item_duration(ctx, ctx->pe_curidx);
+                // the item read from stays the previous one if switching fails
+                if (ff_playlist_open_item(ctx, ++ctx->pe_curidx) < 0) {
+                    av_log(NULL, AV_LOG_ERROR,
+                           "Failed to switch to AVFormatContext %d\n",
+                           ctx->pe_curidx--);
+                    break;
                 }
                 if ((ff_playlist_set_streams(ctx)) < 0) {
                     av_log(NULL, AV_LOG_ERROR,
                            "Failed to open codecs for streams in %d\n",
-                           ctx->pe_curidx);
+                           ctx->pe_curidx--);
                     break;
                 }
+                ff_playlist_close_unused_items(ctx);
                 // have_switched_streams is set to avoid infinite loop
                 have_switched_streams = 1;
                 continue;
@@ -115,40 +275,74 @@ int ff_concatgen_read_seek(AVFormatContext *s,
                            int64_t pts,
                            int flags)
 {
-    int i, err;
-    int64_t localpts_avtimebase, localpts, pts_avtimebase;
+    int err, local_stream_index, previous_idx;
+    int64_t localpts_avtimebase, localpts, pts_avtimebase, timeline_pts;
     AVPlaylistContext *ctx = s->priv_data;
-    AVFormatContext *ic = ctx->formatcontext_list[ctx->pe_curidx];
+    AVFormatContext *ic;
     pts_avtimebase = av_rescale_q(pts,
-                                  ic->streams[stream_index]->time_base,
+                                  s->streams[stream_index]->time_base,
                                   AV_TIME_BASE_Q);
+    // the playlist timeline starts at the first timestamp of the first item
+    timeline_pts = pts_avtimebase;
+    if (ctx->items[0].start_time != AV_NOPTS_VALUE)
+        timeline_pts -= ctx->items[0].start_time;
+    local_stream_index = ff_playlist_localstidx_from_streamidx(ctx, stream_index);
+    ff_playlist_prefetch_cancel(ctx);
+    // only the item seeked into is read, even within an overlap
+    concatgen_free_tail(ctx);
+    // the whole timeline is needed to find the item to seek into
+    if ((err = ff_playlist_scan_items(ctx, INT_MAX, -1)) < 0)
+        return err;
+    if (ctx->flags & AV_PLAYLIST_FLAG_LAZY) {
+        err = ff_playlist_probe_until_time(ctx, timeline_pts);
+        if (err < 0)
+            return err;
+    }
+    previous_idx   = ctx->pe_curidx;
     ctx->pe_curidx = ff_playlist_stream_index_from_time(ctx,
-                                                        pts_avtimebase,
+                                                        timeline_pts,
                                                         &localpts_avtimebase);
-    if (!ctx->formatcontext_list[ctx->pe_curidx]) {
-        if (!(ctx->formatcontext_list[ctx->pe_curidx] =
-            ff_playlist_alloc_formatcontext(ctx->flist[ctx->pe_curidx]))) {
-            av_log(NULL, AV_LOG_ERROR,
-                   "Failed to switch to AVFormatContext %d\n",
-                   ctx->pe_curidx);
-            return AVERROR_NOFMT;
-        }
+    if (ff_playlist_open_item(ctx, ctx->pe_curidx) < 0) {
+        av_log(NULL, AV_LOG_ERROR,
+               "Failed to switch to AVFormatContext %d\n",
+               ctx->pe_curidx);
+        ctx->pe_curidx = previous_idx;
+        return AVERROR_NOFMT;
     }
     err = ff_playlist_set_streams(ctx);
     if (err < 0) {
         av_log(NULL, AV_LOG_ERROR,
                "Failed to open codecs for streams in %d\n",
                ctx->pe_curidx);
+        // reading goes on from the previous item, with its own offsets
+        ctx->pe_curidx = previous_idx;
+        ff_playlist_set_streams(ctx);
         return err;
     }
-    ic = ctx->formatcontext_list[ctx->pe_curidx];
-    localpts = av_rescale_q(localpts_avtimebase,
+    ff_playlist_close_unused_items(ctx);
+    ic = ctx->items[ctx->pe_curidx].formatcontext;
+    // the stream may belong to another item than the one seeked into
+    if (local_stream_index >= ic->nb_streams)
+        local_stream_index = 0;
+    localpts = av_rescale_q(pts_avtimebase - ctx->ts_offset,
                             AV_TIME_BASE_Q,
-                            ic->streams[stream_index]->time_base);
-    s->duration = 0;
-    for (i = 0; i < ctx->pe_curidx; ++i)
-        s->duration += ctx->durations[i];
-    return ic->iformat->read_seek(ic, stream_index, localpts, flags);
+                            ic->streams[local_stream_index]->time_base);
+    // demuxers without a seek function of their own would search the file for
+    // the timestamp, which the index entries kept for the item make unneeded
+    // when they cover it
+    if (!ic->iformat->read_seek) {
+        AVStream *st = ic->streams[local_stream_index];
+        int index = av_index_search_timestamp(st, localpts, flags);
+        if (index >= 0 && index < st->nb_index_entries - 1) {
+            AVIndexEntry *ie = &st->index_entries[index];
+            av_read_frame_flush(ic);
+            if ((err = url_fseek(ic->pb, ie->pos, SEEK_SET)) < 0)
+                return err;
+            av_update_cur_dts(ic, st, ie->timestamp);
+            return 0;
+        }
+    }
+    return av_seek_frame(ic, local_stream_index, localpts, flags);
 }
 
 int64_t ff_concatgen_read_timestamp(AVFormatContext *s,
@@ -157,7 +351,7 @@ int64_t ff_concatgen_read_timestamp(AVFormatContext *s,
                                     int64_t pos_limit)
 {
     AVPlaylistContext *ctx = s->priv_data;
-    AVFormatContext *ic = ctx->formatcontext_list[ctx->pe_curidx];
+    AVFormatContext *ic = ctx->items[ctx->pe_curidx].formatcontext;
     if (ic->iformat->read_timestamp)
         return ic->iformat->read_timestamp(ic, stream_index, pos, pos_limit);
     return 0;
@@ -165,27 +359,27 @@ int64_t ff_concatgen_read_timestamp(AVFormatContext *s,
 
 int ff_concatgen_read_close(AVFormatContext *s)
 {
-    int i;
     AVPlaylistContext *ctx = s->priv_data;
-    AVFormatContext *ic;
-    for (i = 0; i < ctx->pelist_size; ++i) {
-        ic = ctx->formatcontext_list[i];
-        if (ic && ic->iformat->read_close)
-            return ic->iformat->read_close(ic);
-    }
+    ff_playlist_prefetch_cancel(ctx);
+    ff_playlist_cache_close(ctx->probe_cache);
+    ctx->probe_cache = NULL;
+    ff_playlist_scanner_close(ctx);
+    concatgen_free_tail(ctx);
+    av_freep(&ctx->live);
+    ff_playlist_free_items(ctx);
     return 0;
 }
 
 int ff_concatgen_read_play(AVFormatContext *s)
 {
     AVPlaylistContext *ctx = s->priv_data;
-    AVFormatContext *ic = ctx->formatcontext_list[ctx->pe_curidx];
+    AVFormatContext *ic = ctx->items[ctx->pe_curidx].formatcontext;
     return av_read_play(ic);
 }
 
 int ff_concatgen_read_pause(AVFormatContext *s)
 {
     AVPlaylistContext *ctx = s->priv_data;
-    AVFormatContext *ic = ctx->formatcontext_list[ctx->pe_curidx];
+    AVFormatContext *ic = ctx->items[ctx->pe_curidx].formatcontext;
     return av_read_pause(ic);
 }
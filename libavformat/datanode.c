@@ -330,20 +330,20 @@ void ff_datanode_visualize(DataNode *d)
 
 StringList *ff_stringlist_alloc()
 {
-    StringList *l = av_malloc(sizeof(*l));
-    memset(l, 0, sizeof(*l));
-    return l;
+    return av_mallocz(sizeof(StringList));
 }
 
-void ff_stringlist_append(StringList *l, char *str)
+int ff_stringlist_append(StringList *l, char *str)
 {
     while (l->next)
         l = l->next;
     if (l->str) {
-        l->next = ff_stringlist_alloc();
+        if (!(l->next = ff_stringlist_alloc()))
+            return AVERROR_NOMEM;
         l->next->str = str;
     } else
         l->str = str;
+    return 0;
 }
 
 char *ff_stringlist_at(StringList *l, int i)
@@ -64,7 +64,10 @@ void ff_datanode_visualize(DataNode *d);
 
 StringList *ff_stringlist_alloc();
 
-void ff_stringlist_append(StringList *l, char *str);
+/** @brief Appends a string to a list, without copying it.
+ *  @return Returns 0 upon success, or AVERROR_NOMEM if no node could be allocated.
+ */
+int ff_stringlist_append(StringList *l, char *str);
 
 char *ff_stringlist_at(StringList *l, int i);
 
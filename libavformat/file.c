@@ -28,7 +28,12 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <stdlib.h>
+#if CONFIG_MMAP_PROTOCOL
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "os_support.h"
+#include "internal.h"
 
 
 /* standard file protocol */
@@ -97,6 +102,202 @@ URLProtocol file_protocol = {
     .url_get_file_handle = file_get_handle,
 };
 
+#if CONFIG_MMAP_PROTOCOL
+/* memory-mapped file protocol */
+
+/* packets smaller than this are copied, as mapping them costs more */
+#define MMAP_MIN_PACKET_SIZE 65536
+
+typedef struct MMapContext {
+    int fd;
+    uint8_t *data;      ///< mapping of the whole file, NULL if it could not be mapped
+    int64_t size;       ///< size of the mapping
+    int64_t end;        ///< size of the file when last checked, at most size
+    int64_t pos;
+} MMapContext;
+
+/* mapping of the payload of a packet, unmapped along with the packet */
+typedef struct MMapPacket {
+    void *base;
+    size_t length;
+} MMapPacket;
+
+static int mmap_open(URLContext *h, const char *filename, int flags)
+{
+    MMapContext *c;
+    struct stat st;
+
+    av_strstart(filename, "mmap:", &filename);
+
+    if (flags & (URL_WRONLY | URL_RDWR))
+        return AVERROR(EINVAL);
+    if (!(c = av_mallocz(sizeof(*c))))
+        return AVERROR(ENOMEM);
+#ifdef O_BINARY
+    c->fd = open(filename, O_RDONLY | O_BINARY);
+#else
+    c->fd = open(filename, O_RDONLY);
+#endif
+    if (c->fd == -1) {
+        av_free(c);
+        return AVERROR(ENOENT);
+    }
+    // files that cannot be mapped, such as empty or huge ones, are read
+    if (!fstat(c->fd, &st) && st.st_size > 0 && st.st_size == (size_t) st.st_size) {
+        c->data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, c->fd, 0);
+        if (c->data == MAP_FAILED)
+            c->data = NULL;
+        else
+            c->size = c->end = st.st_size;
+    }
+    h->priv_data = c;
+    return 0;
+}
+
+/**
+ * Returns the end of the part of the mapping that may be touched. Pages past
+ * the end of a file truncated since it was mapped raise SIGBUS, so the size
+ * of the file is checked again.
+ */
+static int64_t mmap_end(MMapContext *c)
+{
+    struct stat st;
+
+    if (!fstat(c->fd, &st))
+        c->end = FFMIN(st.st_size, c->size);
+    return c->end;
+}
+
+static int mmap_read(URLContext *h, unsigned char *buf, int size)
+{
+    MMapContext *c = h->priv_data;
+    int ret;
+
+    if (c->pos >= mmap_end(c)) {
+        // data appended since the file was opened is past the mapping, and
+        // reading past the end of a truncated file returns end of file
+        if (lseek(c->fd, c->pos, SEEK_SET) < 0)
+            return AVERROR(EIO);
+        if ((ret = read(c->fd, buf, size)) > 0)
+            c->pos += ret;
+        return ret;
+    }
+    size = FFMIN(size, c->end - c->pos);
+    memcpy(buf, c->data + c->pos, size);
+    c->pos += size;
+    return size;
+}
+
+static int64_t mmap_seek(URLContext *h, int64_t pos, int whence)
+{
+    MMapContext *c = h->priv_data;
+    struct stat st;
+
+    if (whence == AVSEEK_SIZE || whence == SEEK_END) {
+        if (fstat(c->fd, &st))
+            return AVERROR(EIO);
+        if (whence == AVSEEK_SIZE)
+            return st.st_size;
+        pos += st.st_size;
+    } else if (whence == SEEK_CUR) {
+        pos += c->pos;
+    } else if (whence != SEEK_SET) {
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+    return c->pos = pos;
+}
+
+static int mmap_close(URLContext *h)
+{
+    MMapContext *c = h->priv_data;
+    int ret;
+
+    if (c->data)
+        munmap(c->data, c->size);
+    ret = close(c->fd);
+    av_free(c);
+    return ret;
+}
+
+static int mmap_get_handle(URLContext *h)
+{
+    return ((MMapContext *) h->priv_data)->fd;
+}
+
+URLProtocol mmap_protocol = {
+    "mmap",
+    mmap_open,
+    mmap_read,
+    NULL,
+    mmap_seek,
+    mmap_close,
+    .url_get_file_handle = mmap_get_handle,
+};
+
+static void mmap_destruct_packet(AVPacket *pkt)
+{
+    MMapPacket *m = pkt->priv;
+    munmap(m->base, m->length);
+    av_free(m);
+    pkt->data = NULL;
+    pkt->size = 0;
+}
+
+int ff_mmap_get_packet(ByteIOContext *s, AVPacket *pkt, int size)
+{
+    URLContext *h;
+    MMapContext *c;
+    MMapPacket *m;
+    int64_t pos, offset, page_size = sysconf(_SC_PAGESIZE);
+
+    if (size < MMAP_MIN_PACKET_SIZE || s->update_checksum || page_size <= 0 ||
+        s->read_packet != (int (*)(void *, uint8_t *, int)) url_read)
+        return AVERROR(ENOSYS);
+    h = url_fileno(s);
+    if (h->prot->url_open != mmap_open)
+        return AVERROR(ENOSYS);
+    c = h->priv_data;
+    pos = url_ftell(s);
+    // a packet running past the end of the file is left to the read path,
+    // which returns it truncated
+    if (pos < 0 || !c->data || pos + size > mmap_end(c))
+        return AVERROR(ENOSYS);
+    // pages wholly past the end of the file cannot be touched, so the
+    // padding has to end in the last page
+    if ((pos + size + FF_INPUT_BUFFER_PADDING_SIZE + page_size - 1) / page_size >
+        (c->end + page_size - 1) / page_size)
+        return AVERROR(ENOSYS);
+
+    if (!(m = av_malloc(sizeof(*m))))
+        return AVERROR(ENOMEM);
+    // a private mapping per packet, so that demuxers and decoders writing to
+    // the payload affect neither the file nor other packets
+    offset    = pos % page_size;
+    m->length = offset + size + FF_INPUT_BUFFER_PADDING_SIZE;
+    m->base   = mmap(NULL, m->length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     c->fd, pos - offset);
+    if (m->base == MAP_FAILED) {
+        av_free(m);
+        return AVERROR(ENOSYS);
+    }
+    if (url_fseek(s, size, SEEK_CUR) < 0) {
+        munmap(m->base, m->length);
+        av_free(m);
+        return AVERROR(EIO);
+    }
+    av_init_packet(pkt);
+    pkt->data     = (uint8_t *) m->base + offset;
+    pkt->size     = size;
+    pkt->pos      = pos;
+    pkt->priv     = m;
+    pkt->destruct = mmap_destruct_packet;
+    memset(pkt->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    return size;
+}
+#endif
+
 /* pipe protocol */
 
 static int pipe_open(URLContext *h, const char *filename, int flags)
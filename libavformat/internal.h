@@ -28,6 +28,11 @@ char *ff_data_to_hex(char *buf, const uint8_t *src, int size);
 
 void av_program_add_stream_index(AVFormatContext *ac, int progid, unsigned int idx);
 
+/**
+ * Flush the frame reader.
+ */
+void av_read_frame_flush(AVFormatContext *s);
+
 /**
  * Add packet to AVFormatContext->packet_buffer list, determining its
  * interleaved position using compare() function argument.
@@ -35,4 +40,13 @@ void av_program_add_stream_index(AVFormatContext *ac, int progid, unsigned int i
 void ff_interleave_add_packet(AVFormatContext *s, AVPacket *pkt,
                               int (*compare)(AVFormatContext *, AVPacket *, AVPacket *));
 
+/**
+ * Make a packet of the next size bytes of a file opened with the mmap
+ * protocol, whose payload is a private mapping of the file rather than a copy.
+ * The mapping is released along with the packet.
+ * @return size on success, AVERROR(ENOSYS) if the packet has to be read
+ *         instead, or another negative value on failure.
+ */
+int ff_mmap_get_packet(ByteIOContext *s, AVPacket *pkt, int size);
+
 #endif /* AVFORMAT_INTERNAL_H */
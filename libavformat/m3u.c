@@ -25,11 +25,14 @@
  *  @brief M3U playlist demuxer
  */
 
+#include <sys/stat.h>
+
 #include "concatgen.h"
 #include "riff.h"
 #include "libavutil/avstring.h"
 #include "internal.h"
 #include "playlist.h"
+#include "playlistscan.h"
 
 /* The ffmpeg codecs we support, and the IDs they have in the file */
 static const AVCodecTag codec_m3u_tags[] = {
@@ -44,74 +47,132 @@ static int m3u_probe(AVProbeData *p)
         return 0;
 }
 
-static int m3u_list_files(ByteIOContext *s, char ***flist_ptr, int *len_ptr)
+static int m3u_next_item(PlaylistScanner *sc)
 {
-    char **flist, **flist_tmp;
-    int i, bufsize;
-    flist = NULL;
-    i = bufsize = 0;
-    while (1) {
-        char *q;
-        char linebuf[1024] = {0};
-        if ((q = url_fgets(s, linebuf, sizeof(linebuf))) == NULL) // EOF
-            break;
-        linebuf[sizeof(linebuf)-1] = 0; // cut off end if buffer overflowed
-        while (*q != 0) {
-            if (*q++ == '#')
-                *(q-1) = 0;
+    char *line, *hash;
+    unsigned int len;
+    int ret;
+    for (;;) {
+        if ((ret = ff_playlist_scan_until(sc, '\n', 1)) < 0)
+            return ret;
+        if (!ret && !(sc->eof && sc->entry_len)) // line continues in the next block
+            return 0;
+        line = sc->entry;
+        len  = sc->entry_len;
+        // anything from a hash on is a comment
+        if (len && (hash = memchr(line, '#', len)))
+            len = hash - line;
+        while (len && (line[len-1] == '\r' || line[len-1] == ' ' || line[len-1] == '\t'))
+            --len;
+        if (len) {
+            line[len] = 0;
+            sc->item = line;
+            return 1;
         }
-        if (*linebuf == 0) // hashed out
-            continue;
-        flist_tmp = av_fast_realloc(flist, &bufsize, i+2);
-        if (!flist_tmp) {
-            av_log(NULL, AV_LOG_ERROR, "av_realloc error in m3u_list_files\n");
-            av_free(flist);
-            return AVERROR_NOMEM;
-        } else
-            flist = flist_tmp;
-        flist[i] = av_malloc(q-linebuf+1);
-        av_strlcpy(flist[i], linebuf, q-linebuf+1);
-        flist[i++][q-linebuf] = 0;
+        ff_playlist_scan_reset(sc);
     }
-    *flist_ptr = flist;
-    *len_ptr = i;
-    if (!flist) // no files have been found
-        return AVERROR_EOF;
-    flist[i] = 0;
+}
+
+/** State of a live m3u playlist, which is reloaded when it changes */
+typedef struct M3ULive {
+    int64_t next_check;     ///< av_gettime() after which the file is checked again
+    int64_t size;           ///< size of the file when it was last read
+    time_t mtime;           ///< modification time of the file when it was last read
+} M3ULive;
+
+static int m3u_stat(const char *filename, int64_t *size, time_t *mtime)
+{
+    struct stat st;
+    const char *path = filename;
+    av_strstart(filename, "file:", &path);
+    if (stat(path, &st) < 0)
+        return AVERROR(errno);
+    *size  = st.st_size;
+    *mtime = st.st_mtime;
     return 0;
 }
 
+/** @brief Rereads the playlist file if it changed since it was last read, and
+ *  updates the items following the current one accordingly.
+ *  @param force Nonzero to check the file even if the reload interval has not elapsed.
+ *  @return Returns the number of items inserted or removed, or negative upon failure.
+ */
+static int m3u_reload(AVFormatContext *s, int force)
+{
+    AVPlaylistContext *ctx = s->priv_data;
+    M3ULive *live = ctx->live;
+    ByteIOContext *pb;
+    char **flist, workingdir[1024];
+    int64_t now = av_gettime(), size;
+    time_t mtime;
+    int flist_len, i, err;
+    // the file is still being scanned for the first time
+    if (ctx->scanner || (!force && now < live->next_check))
+        return 0;
+    live->next_check = now + s->playlist_reload_interval * INT64_C(1000);
+    if (m3u_stat(s->filename, &size, &mtime) < 0 ||
+        (size == live->size && mtime == live->mtime))
+        return 0;
+    if ((err = url_fopen(&pb, s->filename, URL_RDONLY)) < 0)
+        return err;
+    err = ff_playlist_scan_list(pb, m3u_next_item, &flist, &flist_len);
+    url_fclose(pb);
+    if (err < 0)
+        return err;
+    live->size  = size;
+    live->mtime = mtime;
+    // dirname may modify its argument
+    av_strlcpy(workingdir, s->filename, sizeof(workingdir));
+    err = ff_playlist_update_items(ctx, dirname(workingdir), flist, flist_len);
+    if (err > 0)
+        av_log(s, AV_LOG_VERBOSE, "%d items inserted or removed after reloading %s\n",
+               err, s->filename);
+    for (i = 0; i < flist_len; ++i)
+        av_free(flist[i]);
+    av_free(flist);
+    return err;
+}
+
 static int m3u_read_header(AVFormatContext *s,
                            AVFormatParameters *ap)
 {
     AVPlaylistContext *ctx;
-    char **flist;
-    int flist_len, i;
-    m3u_list_files(s->pb, &flist, &flist_len);
-    if (!flist || flist_len <= 0) {
-        fprintf(stderr, "no playlist items found in %s\n", s->filename);
-        return AVERROR_EOF;
-    }
-    ff_playlist_relative_paths(flist, flist_len, dirname(s->filename));
+    int err;
     ctx = av_playlist_alloc();
     if (!ctx) {
         av_log(NULL, AV_LOG_ERROR, "failed to allocate AVPlaylistContext in m3u_read_header\n");
         return AVERROR_NOMEM;
     }
-    for (i = 0; i < flist_len; ++i) {
-        av_playlist_insert_item(ctx, flist[i], ctx->pelist_size);
-        av_free(flist[i]);
-    }
-    av_free(flist);
-    s->priv_data = ctx;
-    ctx->master_formatcontext = s;
-    if (!ctx->formatcontext_list[ctx->pe_curidx]) {
-        if (!(ctx->formatcontext_list[ctx->pe_curidx] =
-            ff_playlist_alloc_formatcontext(ctx->flist[ctx->pe_curidx])))
-            return AVERROR_NOFMT;
+    if ((err = ff_playlist_scanner_open(ctx, s, m3u_next_item)) < 0)
+        return err;
+    if (s->playlist_reload_interval > 0) {
+        M3ULive *live = av_mallocz(sizeof(*live));
+        if (!live)
+            return AVERROR_NOMEM;
+        ctx->live = live;
+        m3u_stat(s->filename, &live->size, &live->mtime);
+        live->next_check = av_gettime() + s->playlist_reload_interval * INT64_C(1000);
     }
-    ff_playlist_set_streams(ctx);
-    return 0;
+    err = ff_playlist_populate_context(s, ctx, NULL, 0);
+    if (ctx->pelist_size <= 0)
+        av_log(s, AV_LOG_ERROR, "no playlist items found in %s\n", s->filename);
+    if (err < 0)
+        ff_concatgen_read_close(s);
+    return err;
+}
+
+static int m3u_read_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    AVPlaylistContext *ctx = s->priv_data;
+    int ret, err;
+    if (ctx->live && (err = m3u_reload(s, 0)) < 0)
+        av_log(s, AV_LOG_WARNING, "failed to reload %s\n", s->filename);
+    ret = ff_concatgen_read_packet(s, pkt);
+    // items may have been appended since the file was last checked
+    if (ret < 0 && ret != AVERROR(EAGAIN) && ctx->live &&
+        ctx->pe_curidx == ctx->pelist_size - 1 && m3u_reload(s, 1) > 0)
+        ret = ff_concatgen_read_packet(s, pkt);
+    return ret;
 }
 
 AVInputFormat m3u_demuxer = {
@@ -120,7 +181,7 @@ AVInputFormat m3u_demuxer = {
     sizeof(AVPlaylistContext),
     m3u_probe,
     m3u_read_header,
-    ff_concatgen_read_packet,
+    m3u_read_packet,
     ff_concatgen_read_close,
     ff_concatgen_read_seek,
     ff_concatgen_read_timestamp,
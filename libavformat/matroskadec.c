@@ -971,18 +971,19 @@ static void matroska_fix_ass_packet(MatroskaDemuxContext *matroska,
             return;
         snprintf(line,len,"Dialogue: %s,%d:%02d:%02d.%02d,%d:%02d:%02d.%02d,%s\r\n",
                  layer, sh, sm, ss, sc, eh, em, es, ec, ptr);
-        av_free(pkt->data);
+        av_free_packet(pkt);
         pkt->data = line;
         pkt->size = strlen(line);
+        pkt->destruct = av_destruct_packet;
     }
 }
 
 static void matroska_merge_packets(AVPacket *out, AVPacket *in)
 {
-    out->data = av_realloc(out->data, out->size+in->size);
-    memcpy(out->data+out->size, in->data, in->size);
-    out->size += in->size;
-    av_destruct_packet(in);
+    int size = out->size;
+    if (av_grow_packet(out, in->size) >= 0)
+        memcpy(out->data+size, in->data, in->size);
+    av_free_packet(in);
     av_free(in);
 }
 
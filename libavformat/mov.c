@@ -1598,6 +1598,54 @@ static int mov_read_ilst(MOVContext *c, ByteIOContext *pb, MOVAtom atom)
     return ret;
 }
 
+/**
+ * Read a freeform iTunes metadata item, made of a mean, a name and a data
+ * atom. Only iTunSMPB is used, which gives the encoder delay and padding of
+ * the audio in hexadecimal, after a field that is always zero.
+ */
+static int mov_read_freeform(MOVContext *c, ByteIOContext *pb, MOVAtom atom)
+{
+    char name[16] = {0}, str[128];
+    int64_t end = url_ftell(pb) + atom.size;
+    unsigned int delay, padding;
+    int i;
+
+    while (url_ftell(pb) + 8 <= end && !url_feof(pb)) {
+        int64_t size = get_be32(pb);
+        uint32_t tag = get_le32(pb);
+        int len;
+        if (size < 8 || url_ftell(pb) + size - 8 > end)
+            break;
+        size -= 8;
+        if (tag == MKTAG('n','a','m','e') && size > 4) {
+            get_be32(pb); // version + flags
+            len = FFMIN(size - 4, sizeof(name) - 1);
+            get_buffer(pb, name, len);
+            name[len] = 0;
+            url_fskip(pb, size - 4 - len);
+        } else if (tag == MKTAG('d','a','t','a') && size > 8 &&
+                   !strcmp(name, "iTunSMPB")) {
+            get_be32(pb); // type
+            get_be32(pb); // locale
+            len = FFMIN(size - 8, sizeof(str) - 1);
+            get_buffer(pb, str, len);
+            str[len] = 0;
+            url_fskip(pb, size - 8 - len);
+            if (sscanf(str, "%*x %x %x", &delay, &padding) == 2) {
+                for (i = 0; i < c->fc->nb_streams; i++) {
+                    AVStream *st = c->fc->streams[i];
+                    if (st->codec->codec_type == CODEC_TYPE_AUDIO) {
+                        st->encoder_delay   = delay;
+                        st->encoder_padding = padding;
+                    }
+                }
+            }
+        } else
+            url_fskip(pb, size);
+    }
+    return 0;
+}
+
 static int mov_read_meta(MOVContext *c, ByteIOContext *pb, MOVAtom atom)
 {
     while (atom.size > 8) {
@@ -1982,6 +2030,7 @@ static const MOVParseTableEntry mov_default_parse_table[] = {
 { MKTAG('e','s','d','s'), mov_read_esds },
 { MKTAG('w','i','d','e'), mov_read_wide }, /* place holder */
 { MKTAG('c','m','o','v'), mov_read_cmov },
+{ MKTAG('-','-','-','-'), mov_read_freeform },
 { 0, NULL }
 };
 
@@ -2118,8 +2167,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
 #if CONFIG_DV_DEMUXER
         if (mov->dv_demux && sc->dv_audio_container) {
             dv_produce_packet(mov->dv_demux, pkt, pkt->data, pkt->size);
-            av_free(pkt->data);
-            pkt->size = 0;
+            av_free_packet(pkt);
             ret = dv_get_packet(mov->dv_demux, pkt);
             if (ret < 0)
                 return ret;
@@ -96,6 +96,25 @@ static int mp3_parse_vbr_tags(AVFormatContext *s, AVStream *st, int64_t base)
         v = get_be32(s->pb);
         if(v & 0x1)
             frames = get_be32(s->pb);
+        if(v & 0x2)
+            get_be32(s->pb);        /* number of bytes */
+        if(v & 0x4)
+            url_fskip(s->pb, 100);  /* TOC */
+        if(v & 0x8)
+            get_be32(s->pb);        /* quality */
+
+        /* LAME tag: encoder delay and padding follow the version string,
+           VBR method, lowpass, ReplayGain, flags and bitrate */
+        v = get_be32(s->pb);
+        if(v == MKBETAG('L', 'A', 'M', 'E') ||
+           v == MKBETAG('L', 'a', 'v', 'f') ||
+           v == MKBETAG('L', 'a', 'v', 'c')) {
+            url_fskip(s->pb, 17);
+            v = get_be24(s->pb);
+            /* the decoder outputs 528 + 1 samples on top of the encoder delay */
+            st->encoder_delay   = (v >> 12) + 528 + 1;
+            st->encoder_padding = FFMAX((int)(v & 0xfff) - (528 + 1), 0);
+        }
     }
 
     /* Check for VBRI tag (always 32 bytes after end of mpegaudio header) */
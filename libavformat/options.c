@@ -46,6 +46,10 @@ static const AVOption options[]={
 {"fflags", NULL, OFFSET(flags), FF_OPT_TYPE_FLAGS, DEFAULT, INT_MIN, INT_MAX, D|E, "fflags"},
 {"ignidx", "ignore index", 0, FF_OPT_TYPE_CONST, AVFMT_FLAG_IGNIDX, INT_MIN, INT_MAX, D, "fflags"},
 {"genpts", "generate pts", 0, FF_OPT_TYPE_CONST, AVFMT_FLAG_GENPTS, INT_MIN, INT_MAX, D, "fflags"},
+{"pllazy", "probe playlist items on demand", 0, FF_OPT_TYPE_CONST, AVFMT_FLAG_PLAYLIST_LAZY, INT_MIN, INT_MAX, D, "fflags"},
+{"plcache", "cache probe results of playlist items next to the playlist", 0, FF_OPT_TYPE_CONST, AVFMT_FLAG_PLAYLIST_CACHE, INT_MIN, INT_MAX, D, "fflags"},
+{"plunify", "map playlist items with matching codec parameters onto the same streams", 0, FF_OPT_TYPE_CONST, AVFMT_FLAG_PLAYLIST_UNIFY, INT_MIN, INT_MAX, D, "fflags"},
+{"plcopy", "only demux playlist items with identical streams, for stream copy", 0, FF_OPT_TYPE_CONST, AVFMT_FLAG_PLAYLIST_COPY, INT_MIN, INT_MAX, D, "fflags"},
 #if LIBAVFORMAT_VERSION_INT < (53<<16)
 {"track", " set the track number", OFFSET(track), FF_OPT_TYPE_INT, DEFAULT, 0, INT_MAX, E},
 {"year", "set the year", OFFSET(year), FF_OPT_TYPE_INT, DEFAULT, INT_MIN, INT_MAX, E},
@@ -54,6 +58,13 @@ static const AVOption options[]={
 {"cryptokey", "decryption key", OFFSET(key), FF_OPT_TYPE_BINARY, 0, 0, 0, D},
 {"indexmem", "max memory used for timestamp index (per stream)", OFFSET(max_index_size), FF_OPT_TYPE_INT, 1<<20, 0, INT_MAX, D},
 {"rtbufsize", "max memory used for buffering real-time frames", OFFSET(max_picture_buffer), FF_OPT_TYPE_INT, 3041280, 0, INT_MAX, D}, /* defaults to 1s of 15fps 352x288 YUYV422 video */
+{"plcachedir", "directory in which probe results of playlist items are cached", OFFSET(playlist_cache_dir), FF_OPT_TYPE_STRING, DEFAULT, CHAR_MIN, CHAR_MAX, D},
+{"plprobethreads", "number of playlist items probed at once when opening a playlist", OFFSET(playlist_probe_threads), FF_OPT_TYPE_INT, 1, 1, INT_MAX, D},
+{"plreload", "interval in milliseconds at which a live m3u playlist is checked for changes, 0 disables it", OFFSET(playlist_reload_interval), FF_OPT_TYPE_INT, 0, 0, INT_MAX, D},
+{"segment_format", "format of the segments written by the segment muxer", OFFSET(segment_format), FF_OPT_TYPE_STRING, DEFAULT, CHAR_MIN, CHAR_MAX, E},
+{"segment_time", "duration in milliseconds after which the segment muxer starts a new segment at the next keyframe", OFFSET(segment_time), FF_OPT_TYPE_INT, 10000, 1, INT_MAX, E},
+{"ploverlap", "time in milliseconds by which playlist items overlap, read together on separate streams", OFFSET(playlist_overlap), FF_OPT_TYPE_INT, 0, 0, INT_MAX, D},
+{"readahead", "number of input buffers read ahead of the demuxer by a background thread", OFFSET(read_ahead), FF_OPT_TYPE_INT, 0, 0, INT_MAX, D},
 {"fdebug", "print specific debug info", OFFSET(debug), FF_OPT_TYPE_FLAGS, DEFAULT, 0, INT_MAX, E|D, "fdebug"},
 {"ts", NULL, 0, FF_OPT_TYPE_CONST, FF_FDEBUG_TS, INT_MIN, INT_MAX, E|D, "fdebug"},
 {NULL},
@@ -28,35 +28,153 @@
  *  The public playlist API can be found in avplaylist.h
  */
 
+#include "config.h"
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #include "playlist.h"
+#include "playlistscan.h"
 #include "concatgen.h"
 #include "concat.h"
 #include "libavutil/avstring.h"
+#include "libavcodec/internal.h"
+
+/** @brief State of the background open of the playlist item following the current one. */
+typedef struct PlaylistPrefetch {
+#if HAVE_PTHREADS
+    pthread_t thread;
+#endif
+    int pos;                   /**< Index of the item being prefetched at the time the worker was started */
+    char *filename;            /**< Copy of the path of the item, used to detect that the list changed meanwhile */
+    PlaylistCache *cache;      /**< Probe cache of the playlist */
+    int nb_packets;            /**< Number of packets to read ahead */
+    int flags;                 /**< AV_PLAYLIST_FLAG_* flags of the playlist */
+    int joined;                /**< Nonzero once the worker has finished and its result was taken over */
+    AVFormatContext *ic;       /**< Opened item; set by the worker, NULL if opening failed */
+    AVPacketList *buffer;      /**< Packets read ahead from ic, not yet returned by ff_playlist_read_packet */
+    AVPacketList *buffer_end;
+} PlaylistPrefetch;
 
-AVFormatContext *ff_playlist_alloc_formatcontext(char *filename)
+/** @brief Fills in the start time and duration of a file from those of its streams,
+ *  and checks whether its header described all of its streams.
+ *  @param ic AVFormatContext of the file, as left by av_open_input_file.
+ *  @return Returns nonzero if the streams need not be probed.
+ */
+static int playlist_header_complete(AVFormatContext *ic)
 {
-    int err;
-    AVFormatContext *ic = avformat_alloc_context();
-    if (!ic) {
-        av_log(NULL, AV_LOG_ERROR,
-               "unable to allocate AVFormatContext in ff_playlist_alloc_formatcontext\n");
-        return NULL;
+    unsigned int i;
+    if (!ic->nb_streams)
+        return 0;
+    for (i = 0; i < ic->nb_streams; ++i) {
+        AVStream *st = ic->streams[i];
+        AVCodecContext *avctx = st->codec;
+        if (avctx->codec_id == CODEC_ID_NONE ||
+            (avctx->codec_type == CODEC_TYPE_VIDEO &&
+             (!avctx->width || !avctx->height)) ||
+            (avctx->codec_type == CODEC_TYPE_AUDIO &&
+             (!avctx->sample_rate || !avctx->channels)))
+            return 0;
+        if (st->start_time != AV_NOPTS_VALUE) {
+            int64_t start = av_rescale_q(st->start_time, st->time_base, AV_TIME_BASE_Q);
+            if (ic->start_time == AV_NOPTS_VALUE || start < ic->start_time)
+                ic->start_time = start;
+        }
+        if (st->duration != AV_NOPTS_VALUE) {
+            int64_t duration = av_rescale_q(st->duration, st->time_base, AV_TIME_BASE_Q);
+            if (ic->duration == AV_NOPTS_VALUE || duration > ic->duration)
+                ic->duration = duration;
+        }
+    }
+    return ic->duration != AV_NOPTS_VALUE;
+}
+
+int64_t ff_playlist_gapless_duration(AVFormatContext *ic)
+{
+    unsigned int i;
+    int gapless = 0;
+    int64_t duration = AV_NOPTS_VALUE;
+    if (ic->duration == AV_NOPTS_VALUE)
+        return ic->duration;
+    for (i = 0; i < ic->nb_streams; ++i) {
+        AVStream *st = ic->streams[i];
+        int64_t end;
+        // the end of other streams is not known to the sample
+        if (st->codec->codec_type != CODEC_TYPE_AUDIO ||
+            !st->codec->sample_rate || st->duration == AV_NOPTS_VALUE)
+            return ic->duration;
+        end = av_rescale_q(st->duration, st->time_base, AV_TIME_BASE_Q) -
+              av_rescale(st->encoder_delay + st->encoder_padding,
+                         AV_TIME_BASE, st->codec->sample_rate);
+        duration = FFMAX(duration, end);
+        gapless |= st->encoder_delay || st->encoder_padding;
     }
-    err = av_open_input_file(&ic, filename, ic->iformat, 0, NULL);
+    if (!gapless || duration >= ic->duration)
+        return ic->duration;
+    return FFMAX(duration, 0);
+}
+
+AVFormatContext *ff_playlist_alloc_formatcontext(PlaylistCache *cache, const char *filename, int flags)
+{
+    int err;
+    unsigned int i;
+    AVFormatContext *ic = NULL;
+    if (cache && ff_playlist_cache_open_input(cache, &ic, filename) >= 0)
+        return ic;
+    // the context is allocated by av_open_input_file, which ignores one
+    // allocated beforehand unless it is passed as prealloced_context
+    err = av_open_input_file(&ic, filename, NULL, 0, NULL);
     if (err < 0) {
-        av_log(ic, AV_LOG_ERROR, "Error during av_open_input_file\n");
-        av_free(ic);
+        av_log(NULL, AV_LOG_ERROR, "Error during av_open_input_file of %s\n", filename);
         return NULL;
     }
+    // stream copy needs no more than what the header says, and probing opens decoders
+    if (flags & AV_PLAYLIST_FLAG_STREAM_COPY && playlist_header_complete(ic))
+        return ic;
     err = av_find_stream_info(ic);
     if (err < 0) {
         av_log(ic, AV_LOG_ERROR, "Could not find stream info\n");
         av_close_input_file(ic);
         return NULL;
     }
+    // the streams are parsed by the master from now on, which would overwrite
+    // the packet probing left in the parser of each of them
+    ic->cur_st = NULL;
+    for (i = 0; i < ic->nb_streams; ++i) {
+        AVStream *st = ic->streams[i];
+        av_free_packet(&st->cur_pkt);
+        st->cur_ptr = NULL;
+        st->cur_len = 0;
+    }
+    if (cache)
+        ff_playlist_cache_add(cache, filename, ic);
     return ic;
 }
 
+int ff_playlist_probe_file(PlaylistCache *cache, const char *filename, int flags,
+                           int64_t *duration, unsigned int *nb_streams)
+{
+    AVFormatContext *ic;
+    int64_t gapless_duration;
+    // cached items need not be opened at all
+    if (!cache ||
+        ff_playlist_cache_get_info(cache, filename, duration, &gapless_duration,
+                                   nb_streams) < 0) {
+        if (!(ic = ff_playlist_alloc_formatcontext(cache, filename, flags)))
+            return AVERROR_NOFMT;
+        *duration        = ic->duration;
+        gapless_duration = ff_playlist_gapless_duration(ic);
+        *nb_streams      = ic->nb_streams;
+        av_close_input_file(ic);
+    }
+    // copied packets keep the delay and padding, which would overlap the next item
+    if (!(flags & AV_PLAYLIST_FLAG_STREAM_COPY))
+        *duration = gapless_duration;
+    if (*duration == AV_NOPTS_VALUE)
+        *duration = 0;
+    return 0;
+}
+
 AVFormatContext *ff_playlist_alloc_concat_formatcontext(void)
 {
     AVFormatContext *ic;
@@ -73,22 +191,199 @@ AVFormatContext *ff_playlist_alloc_concat_formatcontext(void)
     return ic;
 }
 
+/** @brief Checks whether the streams of an item can be decoded by the decoders of master streams.
+ *  @param s Master AVFormatContext.
+ *  @param base Global index of the first master stream to compare with.
+ *  @param nb_streams Number of master streams to compare with.
+ *  @param ic AVFormatContext of the item.
+ *  @return Returns nonzero if the item has the same streams with the same codec parameters.
+ */
+static int playlist_streams_match(AVFormatContext *s, unsigned int base,
+                                  unsigned int nb_streams, AVFormatContext *ic)
+{
+    unsigned int i;
+    if (ic->nb_streams != nb_streams || base + nb_streams > s->nb_streams)
+        return 0;
+    for (i = 0; i < nb_streams; ++i) {
+        AVStream *st = s->streams[base + i], *ist = ic->streams[i];
+        AVCodecContext *c = st ? st->codec : NULL, *ic_c = ist->codec;
+        if (!c ||
+            st->time_base.num != ist->time_base.num ||
+            st->time_base.den != ist->time_base.den ||
+            c->codec_type  != ic_c->codec_type ||
+            c->codec_id    != ic_c->codec_id ||
+            c->codec_tag   != ic_c->codec_tag ||
+            c->bits_per_coded_sample != ic_c->bits_per_coded_sample ||
+            c->extradata_size != ic_c->extradata_size ||
+            (c->extradata_size &&
+             memcmp(c->extradata, ic_c->extradata, c->extradata_size)))
+            return 0;
+        switch (c->codec_type) {
+        case CODEC_TYPE_VIDEO:
+            if (c->width  != ic_c->width ||
+                c->height != ic_c->height)
+                return 0;
+            break;
+        case CODEC_TYPE_AUDIO:
+            if (c->sample_rate != ic_c->sample_rate ||
+                c->channels    != ic_c->channels    ||
+                c->block_align != ic_c->block_align)
+                return 0;
+            break;
+        default:
+            break;
+        }
+    }
+    return 1;
+}
+
+/** @brief Computes the offsets that map the timestamps of the current item onto the playlist timeline.
+ *  The earliest timestamp of the item is mapped to the start of the item in the
+ *  timeline, relative to the earliest timestamp of the first item, so that
+ *  decoding timestamps stay monotonic across items even with B-frames.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+static int playlist_set_ts_offsets(AVPlaylistContext *ctx)
+{
+    unsigned int i;
+    int64_t *offsets, origin;
+    AVPlaylistItem *item = &ctx->items[ctx->pe_curidx];
+    AVFormatContext *ic = item->formatcontext;
+    if (item->start_time == AV_NOPTS_VALUE) {
+        int64_t start = ic->start_time != AV_NOPTS_VALUE ? ic->start_time : INT64_MAX;
+        for (i = 0; i < ic->nb_streams; ++i) {
+            AVStream *st = ic->streams[i];
+            if (st->first_dts != AV_NOPTS_VALUE)
+                start = FFMIN(start, av_rescale_q(st->first_dts, st->time_base, AV_TIME_BASE_Q));
+        }
+        item->start_time = start != INT64_MAX ? start : 0;
+    }
+    origin = ctx->items[0].start_time != AV_NOPTS_VALUE ? ctx->items[0].start_time : 0;
+    ctx->ts_offset = origin + av_playlist_time_offset(ctx, ctx->pe_curidx) - item->start_time;
+    offsets = av_fast_realloc(ctx->stream_ts_offsets, &ctx->stream_ts_offsets_allocated,
+                              sizeof(*offsets) * ic->nb_streams);
+    if (!offsets)
+        return AVERROR_NOMEM;
+    ctx->stream_ts_offsets    = offsets;
+    ctx->nb_stream_ts_offsets = ic->nb_streams;
+    for (i = 0; i < ic->nb_streams; ++i) {
+        AVStream *st = ic->streams[i];
+        offsets[i] = av_rescale_q(ctx->ts_offset, AV_TIME_BASE_Q, st->time_base);
+        // the encoder delay precedes the start of the item, where it overlaps
+        // the previous one and is cut by av_playlist_audio_trim users
+        if (st->codec->codec_type == CODEC_TYPE_AUDIO && st->codec->sample_rate &&
+            !(ctx->flags & AV_PLAYLIST_FLAG_STREAM_COPY))
+            offsets[i] -= av_rescale_q(st->encoder_delay,
+                                       (AVRational){1, st->codec->sample_rate},
+                                       st->time_base);
+    }
+    return 0;
+}
+
+/** @brief Allocates a master stream which stands in for a stream of an item
+ *  that was never switched to, so that every master stream up to nb_streams is set.
+ *  No packet belongs to it, and it is freed along with the master streams.
+ */
+static AVStream *playlist_placeholder_stream(AVPlaylistContext *ctx, unsigned int index)
+{
+    AVStream *st = av_mallocz(sizeof(*st));
+    if (!st)
+        return NULL;
+    if (!(st->codec = avcodec_alloc_context())) {
+        av_free(st);
+        return NULL;
+    }
+    // the playlist is marked as owner, since item streams are not to be freed here
+    st->codec->opaque     = ctx;
+    st->codec->codec_type = CODEC_TYPE_UNKNOWN;
+    st->index      = index;
+    st->discard    = AVDISCARD_ALL;
+    st->start_time = AV_NOPTS_VALUE;
+    st->duration   = AV_NOPTS_VALUE;
+    st->cur_dts    = AV_NOPTS_VALUE;
+    st->first_dts  = AV_NOPTS_VALUE;
+    av_set_pts_info(st, 64, 1, AV_TIME_BASE);
+    return st;
+}
+
+static int playlist_is_placeholder(AVPlaylistContext *ctx, AVStream *st)
+{
+    return st && st->codec->opaque == ctx;
+}
+
+static void playlist_free_placeholder(AVStream *st)
+{
+    av_free(st->codec);
+    av_free(st);
+}
+
 int ff_playlist_set_streams(AVPlaylistContext *ctx)
 {
+    int err;
     unsigned int i, offset;
     AVFormatContext *s, *ic;
+    AVPlaylistItem *item;
     if (!(s = ctx->master_formatcontext))
         return 0;
-    ic = ctx->formatcontext_list[ctx->pe_curidx];
-    if (ctx->pe_curidx > 0)
-        offset = ctx->nb_streams_list[ctx->pe_curidx - 1];
-    else
-        offset = 0;
-    ic->iformat->read_header(ic, NULL);
+    item = &ctx->items[ctx->pe_curidx];
+    ic = item->formatcontext;
+    if ((err = playlist_set_ts_offsets(ctx)) < 0)
+        return err;
+    item->last_used = ++ctx->use_counter;
+    if (item->stream_base < 0 &&
+        ctx->flags & (AV_PLAYLIST_FLAG_UNIFY_STREAMS | AV_PLAYLIST_FLAG_STREAM_COPY) &&
+        ctx->layout_nb_streams) {
+        if (playlist_streams_match(s, ctx->layout_base, ctx->layout_nb_streams, ic)) {
+            // the streams of the item no longer count towards the global stream indices
+            ff_playlist_tree_add(ctx, ctx->pe_curidx, 0, -(int)item->nb_streams);
+            item->nb_streams  = 0;
+            item->stream_base = ctx->layout_base;
+        } else if (ctx->flags & AV_PLAYLIST_FLAG_STREAM_COPY) {
+            av_log(s, AV_LOG_ERROR,
+                   "Streams of playlist item %s do not match those of the previous item\n",
+                   item->filename);
+            return AVERROR_INVALIDDATA;
+        }
+    }
+    // items inserted or removed before the item shift its streams, unless it reuses others
+    if (item->nb_streams || item->stream_base < 0)
+        item->stream_base = av_playlist_streams_offset(ctx, ctx->pe_curidx);
+    offset = item->stream_base;
+    ctx->layout_base       = offset;
+    ctx->layout_nb_streams = ic->nb_streams;
+    if (!item->nb_streams && ic->nb_streams) {
+        // the streams reused are dropped when an earlier item is seeked to,
+        // in which case those of the item take their place
+        for (i = 0; i < ic->nb_streams; ++i)
+            if (offset + i >= s->nb_streams ||
+                playlist_is_placeholder(ctx, s->streams[offset + i]))
+                break;
+        if (i == ic->nb_streams) {
+            // packets are decoded by the decoders of the streams reused
+            for (i = 0; i < ic->nb_streams; ++i)
+                ic->streams[i]->index = offset + i;
+            return 0;
+        }
+    }
+    if (offset + ic->nb_streams > MAX_STREAMS) {
+        av_log(s, AV_LOG_ERROR,
+               "Too many streams for playlist item %s, try -fflags plunify\n",
+               item->filename);
+        return AVERROR_NOMEM;
+    }
+    // items seeked past without being switched to leave no streams of their own
+    for (; s->nb_streams < offset; ++s->nb_streams)
+        if (!(s->streams[s->nb_streams] = playlist_placeholder_stream(ctx, s->nb_streams)))
+            return AVERROR_NOMEM;
     for (i = 0; i < ic->nb_streams; ++i) {
+        if (offset + i < s->nb_streams &&
+            playlist_is_placeholder(ctx, s->streams[offset + i]))
+            playlist_free_placeholder(s->streams[offset + i]);
         s->streams[offset + i] = ic->streams[i];
-        ic->streams[i]->index += offset;
-        if (!ic->streams[i]->codec->codec) {
+        ic->streams[i]->index = offset + i;
+        if (!ic->streams[i]->codec->codec &&
+            !(ctx->flags & AV_PLAYLIST_FLAG_STREAM_COPY)) {
             AVCodec *codec = avcodec_find_decoder(ic->streams[i]->codec->codec_id);
             if (!codec) {
                 av_log(ic->streams[i]->codec,
@@ -107,9 +402,13 @@ int ff_playlist_set_streams(AVPlaylistContext *ctx)
             }
         }
     }
+    // streams of later items are dropped, since they are counted again when switched to
+    for (i = offset + ic->nb_streams; i < s->nb_streams; ++i) {
+        if (playlist_is_placeholder(ctx, s->streams[i]))
+            playlist_free_placeholder(s->streams[i]);
+        s->streams[i] = NULL;
+    }
     s->nb_streams        = ic->nb_streams + offset;
-    s->packet_buffer     = ic->packet_buffer;
-    s->packet_buffer_end = ic->packet_buffer_end;
     if (ic->iformat->read_timestamp)
         s->iformat->read_timestamp = ff_concatgen_read_timestamp;
     else
@@ -117,6 +416,640 @@ int ff_playlist_set_streams(AVPlaylistContext *ctx)
     return 0;
 }
 
+void ff_playlist_set_item_info(AVPlaylistContext *ctx, int pos, AVFormatContext *ic)
+{
+    AVPlaylistItem *item = &ctx->items[pos];
+    if (item->probed)
+        return;
+    item->duration   = ctx->flags & AV_PLAYLIST_FLAG_STREAM_COPY ?
+                       ic->duration : ff_playlist_gapless_duration(ic);
+    if (item->duration == AV_NOPTS_VALUE)
+        item->duration = 0;
+    item->nb_streams = ic->nb_streams;
+    item->probed     = 1;
+    ff_playlist_tree_add(ctx, pos, item->duration, item->nb_streams);
+    if (ctx->master_formatcontext)
+        ctx->master_formatcontext->duration = av_playlist_time_offset(ctx, ctx->pelist_size);
+}
+
+/** @brief Checks whether an item can be closed without freeing streams of the master demuxer.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Zero-based index of the item.
+ *  @return Returns nonzero if the item is open and none of its streams is a master stream.
+ */
+static int playlist_item_closable(AVPlaylistContext *ctx, int pos)
+{
+    unsigned int i;
+    AVPlaylistItem *item = &ctx->items[pos];
+    AVFormatContext *s = ctx->master_formatcontext, *ic = item->formatcontext;
+    PlaylistPrefetch *pf = ctx->prefetch_opaque;
+    if (!ic || pos == ctx->pe_curidx || (pf && pf->pos == pos && pf->ic == ic))
+        return 0;
+    for (i = 0; s && item->stream_base >= 0 && i < ic->nb_streams; ++i)
+        if (item->stream_base + i < s->nb_streams &&
+            s->streams[item->stream_base + i] == ic->streams[i])
+            return 0;
+    return 1;
+}
+
+/** @brief Takes over the index entries of the streams of an item about to be
+ *  closed, so that they need not be read again once it is reopened.
+ */
+static void playlist_save_index(AVPlaylistItem *item, AVFormatContext *ic)
+{
+    unsigned int i;
+    if (!item->index_entries) {
+        item->index_entries    = av_mallocz(sizeof(*item->index_entries) * ic->nb_streams);
+        item->nb_index_entries = av_mallocz(sizeof(*item->nb_index_entries) * ic->nb_streams);
+        if (!item->index_entries || !item->nb_index_entries) {
+            ff_playlist_free_index(item);
+            return;
+        }
+        item->index_nb_streams = ic->nb_streams;
+    }
+    for (i = 0; i < ic->nb_streams && i < item->index_nb_streams; ++i) {
+        AVStream *st = ic->streams[i];
+        av_free(item->index_entries[i]);
+        item->index_entries[i]    = st->index_entries;
+        item->nb_index_entries[i] = st->nb_index_entries;
+        st->index_entries                = NULL;
+        st->nb_index_entries             = 0;
+        st->index_entries_allocated_size = 0;
+    }
+}
+
+/** @brief Hands the index entries saved by playlist_save_index back to the
+ *  streams of a reopened item, merging them with any read while opening it.
+ */
+static void playlist_restore_index(AVPlaylistItem *item, AVFormatContext *ic)
+{
+    unsigned int i;
+    int j;
+    for (i = 0; i < ic->nb_streams && i < item->index_nb_streams; ++i) {
+        AVStream *st = ic->streams[i];
+        AVIndexEntry *entries = item->index_entries[i];
+        if (!entries)
+            continue;
+        if (!st->nb_index_entries) {
+            av_free(st->index_entries);
+            st->index_entries                = entries;
+            st->nb_index_entries             = item->nb_index_entries[i];
+            st->index_entries_allocated_size = sizeof(*entries) * item->nb_index_entries[i];
+        } else {
+            for (j = 0; j < item->nb_index_entries[i]; ++j)
+                av_add_index_entry(st, entries[j].pos, entries[j].timestamp,
+                                   entries[j].size, entries[j].min_distance,
+                                   entries[j].flags);
+            av_free(entries);
+        }
+        item->index_entries[i]    = NULL;
+        item->nb_index_entries[i] = 0;
+    }
+}
+
+void ff_playlist_free_index(AVPlaylistItem *item)
+{
+    unsigned int i;
+    for (i = 0; item->index_entries && i < item->index_nb_streams; ++i)
+        av_free(item->index_entries[i]);
+    av_freep(&item->index_entries);
+    av_freep(&item->nb_index_entries);
+    item->index_nb_streams = 0;
+}
+
+void ff_playlist_close_unused_items(AVPlaylistContext *ctx)
+{
+    int i, lru, nb_open;
+    if (ctx->open_items_behind < 0)
+        return;
+    do {
+        lru     = -1;
+        nb_open = 0;
+        for (i = 0; i < ctx->pelist_size; ++i) {
+            if (!playlist_item_closable(ctx, i))
+                continue;
+            ++nb_open;
+            if (lru < 0 || ctx->items[i].last_used < ctx->items[lru].last_used)
+                lru = i;
+        }
+        if (nb_open <= ctx->open_items_behind)
+            break;
+        av_log(ctx->master_formatcontext, AV_LOG_DEBUG,
+               "Closing playlist item %d\n", lru);
+        playlist_save_index(&ctx->items[lru], ctx->items[lru].formatcontext);
+        av_close_input_file(ctx->items[lru].formatcontext);
+        ctx->items[lru].formatcontext = NULL;
+    } while (nb_open - 1 > ctx->open_items_behind);
+}
+
+void ff_playlist_free_items(AVPlaylistContext *ctx)
+{
+    int i;
+    unsigned int j, nb_streams = 0;
+    AVFormatContext *s = ctx->master_formatcontext, *ic;
+    for (j = 0; s && j < s->nb_streams; ++j)
+        if (playlist_is_placeholder(ctx, s->streams[j]))
+            s->streams[nb_streams++] = s->streams[j];
+    if (s)
+        s->nb_streams = nb_streams;
+    for (i = 0; i < ctx->pelist_size; ++i) {
+        AVPlaylistItem *item = &ctx->items[i];
+        if ((ic = item->formatcontext)) {
+            for (j = 0; j < ic->nb_streams; ++j)
+                if (ic->streams[j]->codec->codec)
+                    avcodec_close(ic->streams[j]->codec);
+            av_close_input_file(ic);
+        }
+        av_free(item->filename);
+        ff_playlist_free_index(item);
+    }
+    av_freep(&ctx->items);
+    ctx->pelist_size     = 0;
+    ctx->items_allocated = 0;
+    av_freep(&ctx->stream_ts_offsets);
+    ctx->stream_ts_offsets_allocated = 0;
+    ctx->nb_stream_ts_offsets        = 0;
+}
+
+void ff_playlist_extend_item_duration(AVPlaylistContext *ctx, int pos)
+{
+    unsigned int i;
+    int64_t end = AV_NOPTS_VALUE, item_end;
+    AVPlaylistItem *item = &ctx->items[pos];
+    AVFormatContext *s = ctx->master_formatcontext;
+    if (!s || !item->formatcontext || item->stream_base < 0 ||
+        item->start_time == AV_NOPTS_VALUE)
+        return;
+    // cur_dts of the master streams is the dts following the last packet returned
+    for (i = 0; i < item->formatcontext->nb_streams &&
+                item->stream_base + i < s->nb_streams; ++i) {
+        AVStream *st = s->streams[item->stream_base + i];
+        AVStream *ist = item->formatcontext->streams[i];
+        int64_t st_end;
+        if (!st || st->cur_dts == AV_NOPTS_VALUE)
+            continue;
+        st_end = av_rescale_q(st->cur_dts, st->time_base, AV_TIME_BASE_Q);
+        // padding is cut by gapless playback rather than played
+        if (ist->codec->codec_type == CODEC_TYPE_AUDIO && ist->codec->sample_rate &&
+            !(ctx->flags & AV_PLAYLIST_FLAG_STREAM_COPY))
+            st_end -= av_rescale(ist->encoder_padding, AV_TIME_BASE, ist->codec->sample_rate);
+        end = FFMAX(end, st_end);
+    }
+    item_end = ctx->items[0].start_time + av_playlist_time_offset(ctx, pos) + item->duration;
+    if (end == AV_NOPTS_VALUE || end <= item_end)
+        return;
+    item->duration += end - item_end;
+    ff_playlist_tree_add(ctx, pos, end - item_end, 0);
+    s->duration = av_playlist_time_offset(ctx, ctx->pelist_size);
+}
+
+/* Node i of the binary indexed trees holds the sum over the items
+ * i & (i + 1) to i, so that a prefix sum or a point update visits
+ * O(log n) nodes. */
+
+void ff_playlist_tree_add(AVPlaylistContext *ctx, int pos, int64_t duration, int nb_streams)
+{
+    for (; pos < ctx->pelist_size; pos |= pos + 1) {
+        ctx->items[pos].durations_tree  += duration;
+        ctx->items[pos].nb_streams_tree += nb_streams;
+    }
+    ctx->offsets_item = -1;
+}
+
+void ff_playlist_tree_prefix(AVPlaylistContext *ctx, int pos,
+                             int64_t *duration, unsigned int *nb_streams)
+{
+    int64_t d = 0;
+    unsigned int n = 0;
+    for (--pos; pos >= 0; pos = (pos & (pos + 1)) - 1) {
+        d += ctx->items[pos].durations_tree;
+        n += ctx->items[pos].nb_streams_tree;
+    }
+    *duration   = d;
+    *nb_streams = n;
+}
+
+void ff_playlist_tree_rebuild(AVPlaylistContext *ctx, int pos)
+{
+    AVPlaylistItem *items = ctx->items;
+    int i, n = ctx->pelist_size;
+    ctx->offsets_item = -1;
+    if (pos >= n)
+        return;
+    if (pos == n - 1) {
+        // appended item: its node covers itself and some items before it
+        int64_t d0, d1;
+        unsigned int n0, n1;
+        ff_playlist_tree_prefix(ctx, pos, &d1, &n1);
+        ff_playlist_tree_prefix(ctx, pos & (pos + 1), &d0, &n0);
+        items[pos].durations_tree  = items[pos].duration   + d1 - d0;
+        items[pos].nb_streams_tree = items[pos].nb_streams + n1 - n0;
+        return;
+    }
+    // nodes before pos only cover items before pos and are still valid
+    for (i = pos; i < n; ++i) {
+        items[i].durations_tree  = items[i].duration;
+        items[i].nb_streams_tree = items[i].nb_streams;
+    }
+    for (i = 0; i < n; ++i) {
+        int parent = i | (i + 1);
+        if (parent >= pos && parent < n) {
+            items[parent].durations_tree  += items[i].durations_tree;
+            items[parent].nb_streams_tree += items[i].nb_streams_tree;
+        }
+    }
+}
+
+static int playlist_tree_top_step(AVPlaylistContext *ctx)
+{
+    int step = 1;
+    while (step <= ctx->pelist_size >> 1)
+        step <<= 1;
+    return step;
+}
+
+// both searches descend the tree, which relies on durations and stream counts being nonnegative
+
+int ff_playlist_tree_search_time(AVPlaylistContext *ctx, int64_t pts)
+{
+    int step, pos = 0;
+    for (step = playlist_tree_top_step(ctx); step; step >>= 1) {
+        if (pos + step <= ctx->pelist_size &&
+            ctx->items[pos + step - 1].durations_tree <= pts) {
+            pos += step;
+            pts -= ctx->items[pos - 1].durations_tree;
+        }
+    }
+    return pos;
+}
+
+int ff_playlist_tree_search_stream(AVPlaylistContext *ctx, unsigned int stream_index)
+{
+    int step, pos = 0;
+    for (step = playlist_tree_top_step(ctx); step; step >>= 1) {
+        if (pos + step <= ctx->pelist_size &&
+            ctx->items[pos + step - 1].nb_streams_tree <= stream_index) {
+            pos += step;
+            stream_index -= ctx->items[pos - 1].nb_streams_tree;
+        }
+    }
+    return pos;
+}
+
+static void playlist_prefetch_free(PlaylistPrefetch *pf)
+{
+    while (pf->buffer) {
+        AVPacketList *pktl = pf->buffer;
+        pf->buffer = pktl->next;
+        av_free_packet(&pktl->pkt);
+        av_free(pktl);
+    }
+    av_free(pf->filename);
+    av_free(pf);
+}
+
+#if HAVE_PTHREADS
+static void *playlist_prefetch_worker(void *arg)
+{
+    PlaylistPrefetch *pf = arg;
+    AVFormatContext *ic;
+    unsigned int i;
+    if (!(ic = ff_playlist_alloc_formatcontext(pf->cache, pf->filename, pf->flags)))
+        return NULL;
+    // decoders opened here are kept by ff_playlist_set_streams; with unified
+    // streams the item most likely reuses the decoders already open
+    for (i = 0; !(pf->flags & (AV_PLAYLIST_FLAG_UNIFY_STREAMS | AV_PLAYLIST_FLAG_STREAM_COPY)) &&
+                i < ic->nb_streams; ++i) {
+        AVCodecContext *avctx = ic->streams[i]->codec;
+        AVCodec *codec;
+        if (!avctx->codec && (codec = avcodec_find_decoder(avctx->codec_id)))
+            avcodec_open(avctx, codec);
+    }
+    for (i = 0; i < pf->nb_packets; ++i) {
+        AVPacketList *pktl = av_mallocz(sizeof(*pktl));
+        if (!pktl)
+            break;
+        av_init_packet(&pktl->pkt);
+        if (ic->iformat->read_packet(ic, &pktl->pkt) < 0 ||
+            av_dup_packet(&pktl->pkt) < 0) {
+            av_free(pktl);
+            break;
+        }
+        if (pf->buffer)
+            pf->buffer_end->next = pktl;
+        else
+            pf->buffer = pktl;
+        pf->buffer_end = pktl;
+    }
+    pf->ic = ic;
+    return NULL;
+}
+#endif
+
+void ff_playlist_prefetch_start(AVPlaylistContext *ctx)
+{
+#if HAVE_PTHREADS
+    PlaylistPrefetch *pf = ctx->prefetch_opaque;
+    int pos = ctx->pe_curidx + 1;
+    if (pf) {
+        // packets read ahead for an item that is no longer current are stale
+        if (!pf->joined || (pf->buffer && pf->pos == ctx->pe_curidx))
+            return;
+        ff_playlist_prefetch_cancel(ctx);
+    }
+    // the worker opens decoders while this thread may open others, which
+    // is only safe with a lock manager; the item is then opened when reached
+    if (ctx->prefetch_packets <= 0 || !ff_lockmgr_cb ||
+        pos >= ctx->pelist_size ||
+        ctx->items[pos].formatcontext)
+        return;
+    if (!(pf = av_mallocz(sizeof(*pf))))
+        return;
+    pf->pos        = pos;
+    pf->nb_packets = ctx->prefetch_packets;
+    pf->filename   = av_strdup(ctx->items[pos].filename);
+    pf->cache      = ctx->probe_cache;
+    pf->flags      = ctx->flags;
+    if (!pf->filename ||
+        pthread_create(&pf->thread, NULL, playlist_prefetch_worker, pf)) {
+        av_log(NULL, AV_LOG_ERROR,
+               "Failed to start prefetching playlist item %d\n", pos);
+        playlist_prefetch_free(pf);
+        return;
+    }
+    av_log(NULL, AV_LOG_DEBUG, "Prefetching playlist item %d\n", pos);
+    ctx->prefetch_opaque = pf;
+#endif
+}
+
+void ff_playlist_prefetch_finish(AVPlaylistContext *ctx)
+{
+    PlaylistPrefetch *pf = ctx->prefetch_opaque;
+    if (!pf || pf->joined)
+        return;
+#if HAVE_PTHREADS
+    pthread_join(pf->thread, NULL);
+#endif
+    pf->joined = 1;
+    // items may have been inserted or removed since the worker started
+    if (pf->ic &&
+        pf->pos < ctx->pelist_size &&
+        !ctx->items[pf->pos].formatcontext &&
+        !strcmp(ctx->items[pf->pos].filename, pf->filename)) {
+        ctx->items[pf->pos].formatcontext = pf->ic;
+        playlist_restore_index(&ctx->items[pf->pos], pf->ic);
+    } else {
+        if (pf->ic)
+            av_close_input_file(pf->ic);
+        ctx->prefetch_opaque = NULL;
+        playlist_prefetch_free(pf);
+    }
+}
+
+void ff_playlist_prefetch_cancel(AVPlaylistContext *ctx)
+{
+    ff_playlist_prefetch_finish(ctx);
+    if (ctx->prefetch_opaque) {
+        playlist_prefetch_free(ctx->prefetch_opaque);
+        ctx->prefetch_opaque = NULL;
+    }
+}
+
+int ff_playlist_read_packet(AVPlaylistContext *ctx, int pos, AVPacket *pkt)
+{
+    PlaylistPrefetch *pf = ctx->prefetch_opaque;
+    AVFormatContext *ic = ctx->items[pos].formatcontext;
+    unsigned int i;
+    int base, ret;
+    // packets read by av_find_stream_info precede any others
+    if (ic->packet_buffer) {
+        AVPacketList *pktl = ic->packet_buffer;
+        *pkt = pktl->pkt;
+        ic->packet_buffer = pktl->next;
+        if (!ic->packet_buffer)
+            ic->packet_buffer_end = NULL;
+        av_free(pktl);
+        return 0;
+    }
+    if (pf && pf->joined && pf->buffer &&
+        pf->pos == pos && pf->ic == ic) {
+        AVPacketList *pktl = pf->buffer;
+        *pkt = pktl->pkt;
+        pf->buffer = pktl->next;
+        av_free(pktl);
+        return 0;
+    }
+    // demuxers report st->index, which ff_playlist_set_streams made global,
+    // so the streams get back their indices in the item while it is read
+    base = ic->nb_streams ? ic->streams[0]->index : 0;
+    for (i = 0; base && i < ic->nb_streams; ++i)
+        ic->streams[i]->index -= base;
+    ret = ic->iformat->read_packet(ic, pkt);
+    for (i = 0; base && i < ic->nb_streams; ++i)
+        ic->streams[i]->index += base;
+    return ret;
+}
+
+int ff_playlist_open_item(AVPlaylistContext *ctx, int pos)
+{
+    ff_playlist_prefetch_finish(ctx);
+    if (!ctx->items[pos].formatcontext) {
+        if (!(ctx->items[pos].formatcontext =
+            ff_playlist_alloc_formatcontext(ctx->probe_cache, ctx->items[pos].filename, ctx->flags))) {
+            av_log(NULL, AV_LOG_ERROR,
+                   "Failed to open AVFormatContext %d\n",
+                   pos);
+            return AVERROR_NOFMT;
+        }
+        playlist_restore_index(&ctx->items[pos], ctx->items[pos].formatcontext);
+    }
+    ff_playlist_set_item_info(ctx, pos, ctx->items[pos].formatcontext);
+    return 0;
+}
+
+int ff_playlist_probe_until_time(AVPlaylistContext *ctx, int64_t pts)
+{
+    int i, err;
+    for (i = 0; i < ctx->pelist_size; ++i) {
+        if ((err = av_playlist_probe_item(ctx, i)) < 0)
+            return err;
+        if (av_playlist_time_offset(ctx, i) + ctx->items[i].duration > pts)
+            break;
+    }
+    return 0;
+}
+
+/** @brief Result of probing a playlist item in ff_playlist_probe_items. */
+typedef struct PlaylistProbeResult {
+    int64_t duration;
+    unsigned int nb_streams;
+    int err;
+} PlaylistProbeResult;
+
+#if HAVE_PTHREADS
+/** @brief State shared by the threads of ff_playlist_probe_items. */
+typedef struct PlaylistProbe {
+    AVPlaylistContext *ctx;       /**< Playlist, which is not modified while the threads run */
+    PlaylistProbeResult *results; /**< One result per item */
+    pthread_mutex_t lock;         /**< Protects next */
+    int next;                     /**< Index of the next item to probe */
+} PlaylistProbe;
+
+static void *playlist_probe_worker(void *arg)
+{
+    PlaylistProbe *pp = arg;
+    AVPlaylistContext *ctx = pp->ctx;
+    int pos;
+    for (;;) {
+        pthread_mutex_lock(&pp->lock);
+        pos = pp->next++;
+        pthread_mutex_unlock(&pp->lock);
+        if (pos >= ctx->pelist_size)
+            break;
+        if (ctx->items[pos].probed)
+            continue;
+        pp->results[pos].err = ff_playlist_probe_file(ctx->probe_cache,
+                                                      ctx->items[pos].filename,
+                                                      ctx->flags,
+                                                      &pp->results[pos].duration,
+                                                      &pp->results[pos].nb_streams);
+    }
+    return NULL;
+}
+#endif
+
+int ff_playlist_probe_items(AVPlaylistContext *ctx, int nb_threads)
+{
+    int i;
+    PlaylistProbeResult *results;
+    if (ctx->pelist_size <= 0)
+        return 0;
+    if (!(results = av_mallocz(sizeof(*results) * ctx->pelist_size)))
+        return AVERROR_NOMEM;
+    // probing opens decoders, which threads may only do at once with a lock manager
+    if (nb_threads > 1 && !ff_lockmgr_cb) {
+        av_log(ctx->master_formatcontext, AV_LOG_WARNING,
+               "No lock manager is registered with av_lockmgr_register(), "
+               "probing playlist items in a single thread\n");
+        nb_threads = 1;
+    }
+#if HAVE_PTHREADS
+    if (nb_threads > 1) {
+        PlaylistProbe pp;
+        pthread_t *threads;
+        int nb_started;
+        nb_threads = FFMIN(nb_threads, ctx->pelist_size);
+        if (!(threads = av_malloc(sizeof(*threads) * nb_threads))) {
+            av_free(results);
+            return AVERROR_NOMEM;
+        }
+        pp.ctx     = ctx;
+        pp.results = results;
+        pp.next    = 0;
+        pthread_mutex_init(&pp.lock, NULL);
+        for (nb_started = 0; nb_started < nb_threads; ++nb_started)
+            if (pthread_create(&threads[nb_started], NULL, playlist_probe_worker, &pp))
+                break;
+        // items left over by threads that failed to start are probed here
+        playlist_probe_worker(&pp);
+        for (i = 0; i < nb_started; ++i)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&pp.lock);
+        av_free(threads);
+    } else
+#endif
+    for (i = 0; i < ctx->pelist_size; ++i)
+        if (!ctx->items[i].probed)
+            results[i].err = ff_playlist_probe_file(ctx->probe_cache,
+                                                    ctx->items[i].filename,
+                                                    ctx->flags,
+                                                    &results[i].duration,
+                                                    &results[i].nb_streams);
+    // committed in playlist order, with a single rebuild of the trees
+    for (i = 0; i < ctx->pelist_size; ++i) {
+        if (ctx->items[i].probed || results[i].err < 0)
+            continue;
+        ctx->items[i].duration   = results[i].duration;
+        ctx->items[i].nb_streams = results[i].nb_streams;
+        ctx->items[i].probed     = 1;
+    }
+    ff_playlist_tree_rebuild(ctx, 0);
+    for (i = ctx->pelist_size - 1; i >= 0; --i) {
+        if (results[i].err < 0) {
+            av_log(ctx->master_formatcontext, AV_LOG_ERROR,
+                   "Failed to probe playlist item %s, removing it\n",
+                   ctx->items[i].filename);
+            av_playlist_remove_item(ctx, i);
+        }
+    }
+    if (ctx->master_formatcontext)
+        ctx->master_formatcontext->duration = av_playlist_time_offset(ctx, ctx->pelist_size);
+    av_free(results);
+    return 0;
+}
+
+int ff_playlist_populate_context(AVFormatContext *s,
+                                 AVPlaylistContext *ctx,
+                                 char **flist,
+                                 int len)
+{
+    int i, err;
+    // the demuxer's own private data is replaced by the playlist
+    if (s->priv_data != ctx)
+        av_free(s->priv_data);
+    s->priv_data = ctx;
+    ctx->master_formatcontext = s;
+    if (s->flags & AVFMT_FLAG_PLAYLIST_LAZY)
+        ctx->flags |= AV_PLAYLIST_FLAG_LAZY;
+    if (s->flags & AVFMT_FLAG_PLAYLIST_UNIFY)
+        ctx->flags |= AV_PLAYLIST_FLAG_UNIFY_STREAMS;
+    if (s->flags & AVFMT_FLAG_PLAYLIST_COPY)
+        ctx->flags |= AV_PLAYLIST_FLAG_STREAM_COPY;
+    if (s->playlist_overlap > 0) {
+        // overlapping items are read together, each on its own streams
+        if (ctx->flags & (AV_PLAYLIST_FLAG_UNIFY_STREAMS | AV_PLAYLIST_FLAG_STREAM_COPY))
+            av_log(s, AV_LOG_WARNING,
+                   "Playlist items cannot overlap on shared streams, ignoring the overlap\n");
+        else
+            ctx->overlap = av_rescale(s->playlist_overlap, AV_TIME_BASE, 1000);
+    }
+    if (s->playlist_cache_dir || s->flags & AVFMT_FLAG_PLAYLIST_CACHE) {
+        char workingdir[1024], cache_filename[1024];
+        const char *dir = s->playlist_cache_dir;
+        if (!dir) {
+            // next to the playlist, or to the first item of a comma-separated list
+            av_strlcpy(workingdir, s->filename[0] ? s->filename : flist[0], sizeof(workingdir));
+            dir = dirname(workingdir);
+        }
+        snprintf(cache_filename, sizeof(cache_filename), "%s/%s", dir, PLAYLIST_CACHE_FILENAME);
+        if (av_playlist_set_probe_cache(ctx, cache_filename) < 0)
+            return AVERROR_NOMEM;
+    }
+    if (!(ctx->flags & AV_PLAYLIST_FLAG_LAZY) && s->playlist_probe_threads > 1) {
+        // items are inserted without being probed, then probed all at once
+        ctx->flags |= AV_PLAYLIST_FLAG_LAZY;
+        for (i = 0; i < len; ++i)
+            av_playlist_insert_item(ctx, flist[i], ctx->pelist_size);
+        err = ff_playlist_scan_items(ctx, INT_MAX, -1);
+        ctx->flags &= ~AV_PLAYLIST_FLAG_LAZY;
+        if (err < 0 ||
+            (err = ff_playlist_probe_items(ctx, s->playlist_probe_threads)) < 0)
+            return err;
+    } else {
+        for (i = 0; i < len; ++i)
+            av_playlist_insert_item(ctx, flist[i], ctx->pelist_size);
+        // the rest of the playlist file is scanned while the first item plays
+        if ((err = ff_playlist_scan_items(ctx, 1, -1)) < 0)
+            return err;
+    }
+    if (ctx->pelist_size <= 0)
+        return AVERROR_EOF;
+    if ((err = ff_playlist_open_item(ctx, ctx->pe_curidx)) < 0)
+        return err;
+    ff_playlist_set_streams(ctx);
+    return 0;
+}
+
 int ff_playlist_split_encodedstring(const char *s,
                                     const char sep,
                                     char ***flist_ptr,
@@ -126,7 +1059,8 @@ int ff_playlist_split_encodedstring(const char *s,
     int i, len, buflen, *sepidx, *sepidx_tmp;
     sepidx = NULL;
     buflen = len = 0;
-    sepidx_tmp = av_fast_realloc(sepidx, &buflen, ++len);
+    // room for the start of each item and the end of the last one
+    sepidx_tmp = av_fast_realloc(sepidx, &buflen, sizeof(*sepidx) * (++len + 1));
     if (!sepidx_tmp) {
         av_log(NULL, AV_LOG_ERROR,
                "av_realloc error in av_playlist_split_encodedstring\n");
@@ -140,7 +1074,7 @@ int ff_playlist_split_encodedstring(const char *s,
     while ((c = *ts++) != 0) {
         if (c == sep) {
             sepidx[len] = ts-s;
-            sepidx_tmp = av_fast_realloc(sepidx, &buflen, ++len);
+            sepidx_tmp = av_fast_realloc(sepidx, &buflen, sizeof(*sepidx) * (++len + 1));
             if (!sepidx_tmp) {
                 av_free(sepidx);
                 av_log(NULL, AV_LOG_ERROR,
@@ -172,49 +1106,34 @@ int ff_playlist_split_encodedstring(const char *s,
     return 0;
 }
 
-void ff_playlist_relative_paths(char **flist,
-                                int len,
-                                const char *workingdir)
-{
-    int i;
-    for (i = 0; i < len; ++i) { // determine if relative paths
-        char *full_file_path;
-        int workingdir_len, filename_len;
-        workingdir_len = strlen(workingdir);
-        filename_len = strlen(flist[i]);
-        full_file_path = av_malloc(workingdir_len + filename_len + 2);
-        av_strlcpy(full_file_path, workingdir, workingdir_len + 1);
-        full_file_path[workingdir_len] = '/';
-        full_file_path[workingdir_len + 1] = 0;
-        av_strlcat(full_file_path, flist[i], workingdir_len + filename_len + 2);
-        if (url_exist(full_file_path))
-            flist[i] = full_file_path;
-    }
-}
-
 int ff_playlist_stream_index_from_time(AVPlaylistContext *ctx,
                                        int64_t pts,
                                        int64_t *localpts)
 {
-    int64_t total = 0;
-    int i = ctx->pe_curidx;
-    while (pts >= total) {
-        if (i >= ctx->pelist_size)
-            break;
-        total = ctx->durations[i++];
+    // times past the end map to the last item
+    int i = FFMIN(ff_playlist_tree_search_time(ctx, pts), ctx->pelist_size - 1);
+    if (ctx->overlap) {
+        // items start earlier than the durations before them add up to, and
+        // within an overlap the later item is taken
+        int lo = 0, hi = ctx->pelist_size - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) >> 1;
+            if (av_playlist_time_offset(ctx, mid) <= pts)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        i = lo;
     }
     if (localpts)
-        *localpts = pts-(total-ctx->durations[i-1]);
+        *localpts = pts - av_playlist_time_offset(ctx, i);
     return i;
 }
 
 int ff_playlist_localstidx_from_streamidx(AVPlaylistContext *ctx, int stream_index)
 {
-    unsigned int i, stream_total, stream_offset;
-    stream_total = stream_offset = 0;
-    for (i = 0; stream_index >= stream_total; ++i) {
-        stream_offset = stream_total;
-        stream_total = ctx->nb_streams_list[i];
-    }
-    return stream_index - stream_offset;
+    int local_stream_index;
+    if (av_playlist_item_from_stream_index(ctx, stream_index, &local_stream_index) < 0)
+        return stream_index;
+    return local_stream_index;
 }
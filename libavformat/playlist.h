@@ -32,18 +32,54 @@
 #define AVFORMAT_PLAYLIST_H
 
 #include "avplaylist.h"
+#include "playlistcache.h"
+
+/** @brief Returns the duration of the audio of a file without encoder delay and padding.
+ *  Only audio-only files whose streams give their delay and padding are
+ *  shortened, as the end of other streams is not known to the sample.
+ *  @param ic AVFormatContext of the file.
+ *  @return Returns the duration in AV_TIME_BASE units, that of ic if it is not shortened.
+ */
+int64_t ff_playlist_gapless_duration(AVFormatContext *ic);
 
 /** @brief Allocates AVFormatContext, then opens file, and probes and opens streams.
+ *  Probe results are taken from and added to the cache, if one is given.
+ *  With AV_PLAYLIST_FLAG_STREAM_COPY, streams are not probed if the header of
+ *  the file already describes them.
+ *  @param cache Probe cache to use, or NULL.
  *  @param filename Null-terminated string of path to file to open.
+ *  @param flags AV_PLAYLIST_FLAG_* flags of the playlist.
  *  @return Returns an allocated AVFormatContext upon success, or NULL upon failure.
  */
-AVFormatContext *ff_playlist_alloc_formatcontext(char *filename);
+AVFormatContext *ff_playlist_alloc_formatcontext(PlaylistCache *cache, const char *filename, int flags);
 
 /** @brief Allocates a new AVFormatContext for a concat-type demuxer.
  *  @return Returns NULL if failed, or AVFormatContext if succeeded.
  */
 AVFormatContext *ff_playlist_alloc_concat_formatcontext(void);
 
+/** @brief Finds out the duration and number of streams of a file, from the cache
+ *  if it has an entry for it, or else by opening and probing it.
+ *  May be called from several threads at once.
+ *  @param cache Probe cache to use, or NULL.
+ *  @param filename Null-terminated string of path to file to probe.
+ *  @param flags AV_PLAYLIST_FLAG_* flags of the playlist.
+ *  @param duration Set to the duration of the file in AV_TIME_BASE units, 0 if unknown.
+ *  @param nb_streams Set to the number of streams of the file.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int ff_playlist_probe_file(PlaylistCache *cache, const char *filename, int flags,
+                           int64_t *duration, unsigned int *nb_streams);
+
+/** @brief Probes all items that have not been probed yet, using several threads
+ *  if available, then records their durations and numbers of streams in playlist
+ *  order. Items that cannot be opened are removed from the playlist.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param nb_threads Number of items probed at once, taken as 1 if no lock manager is registered with av_lockmgr_register().
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int ff_playlist_probe_items(AVPlaylistContext *ctx, int nb_threads);
+
 /** @brief Sets the master concat-type demuxer's streams to those of its currently opened playlist element.
  *  Does nothing if using a standalone playlist (master_formatcontext is NULL).
  *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
@@ -51,14 +87,143 @@ AVFormatContext *ff_playlist_alloc_concat_formatcontext(void);
  */
 int ff_playlist_set_streams(AVPlaylistContext *ctx);
 
-/** @brief Converts a list of mixed relative or absolute paths into all absolute paths.
- *  @param flist List of null-terminated strings of relative or absolute paths.
+/** @brief Closes the least recently used items beyond the open_items_behind window.
+ *  The current item, the prefetched one and items whose streams are those of
+ *  the master demuxer are kept open. The index entries of closed items are kept,
+ *  and handed back to their streams once they are reopened.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ */
+void ff_playlist_close_unused_items(AVPlaylistContext *ctx);
+
+/** @brief Closes all open items along with their decoders and frees the items.
+ *  The streams of the master demuxer that belong to items are removed from
+ *  it, since they are freed along with their items; only the placeholders of
+ *  items never switched to are left to be freed with the master streams.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ */
+void ff_playlist_free_items(AVPlaylistContext *ctx);
+
+/** @brief Frees the index entries kept for a closed item, if any.
+ *  @param item Playlist item whose index entries are freed.
+ */
+void ff_playlist_free_index(AVPlaylistItem *item);
+
+/** @brief Records the duration and number of streams of an opened playlist item,
+ *  adding them to the cumulative lists. Does nothing if the item was already probed.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Zero-based index of the item.
+ *  @param ic Opened AVFormatContext of the item.
+ */
+void ff_playlist_set_item_info(AVPlaylistContext *ctx, int pos, AVFormatContext *ic);
+
+/** @brief Extends the duration of an item that was played until its end to cover
+ *  the timestamps that were actually returned for it, which may end after the
+ *  duration estimated when probing (e.g. by the duration of the last frame).
+ *  Called when switching to the next item, so that its timestamps follow.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Zero-based index of the item.
+ */
+void ff_playlist_extend_item_duration(AVPlaylistContext *ctx, int pos);
+
+/** @brief Adds to the duration and number of streams of an item in the cumulative trees.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Zero-based index of the item.
+ *  @param duration Duration to add, in AV_TIME_BASE units.
+ *  @param nb_streams Number of streams to add.
+ */
+void ff_playlist_tree_add(AVPlaylistContext *ctx, int pos, int64_t duration, int nb_streams);
+
+/** @brief Sums the durations and numbers of streams of the items before an item.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Zero-based index of the item; may be pelist_size.
+ *  @param duration Set to the sum of the durations, in AV_TIME_BASE units.
+ *  @param nb_streams Set to the sum of the numbers of streams.
+ */
+void ff_playlist_tree_prefix(AVPlaylistContext *ctx, int pos,
+                             int64_t *duration, unsigned int *nb_streams);
+
+/** @brief Recomputes the cumulative trees after items were inserted or removed.
+ *  Takes O(log n) time if only the last item changed, O(n) otherwise.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Zero-based index of the first item that changed.
+ */
+void ff_playlist_tree_rebuild(AVPlaylistContext *ctx, int pos);
+
+/** @brief Finds the first item whose end lies after the specified time.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pts Timestamp in AV_TIME_BASE.
+ *  @return Returns the index of the item, or pelist_size if pts is past the end of the playlist.
+ */
+int ff_playlist_tree_search_time(AVPlaylistContext *ctx, int64_t pts);
+
+/** @brief Finds the item to which a global stream index belongs.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param stream_index Global stream index.
+ *  @return Returns the index of the item, or pelist_size if there is no such stream.
+ */
+int ff_playlist_tree_search_stream(AVPlaylistContext *ctx, unsigned int stream_index);
+
+/** @brief Opens the AVFormatContext of the playlist item at the specified index,
+ *  if it is not already open, and records its duration and number of streams.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Zero-based index of the item to open.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int ff_playlist_open_item(AVPlaylistContext *ctx, int pos);
+
+/** @brief Starts opening the item following the current one and reading
+ *  ctx->prefetch_packets of its packets in a background thread.
+ *  Does nothing if prefetching is disabled, already running, the next item is
+ *  already open or threads are not available.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ */
+void ff_playlist_prefetch_start(AVPlaylistContext *ctx);
+
+/** @brief Waits for a running prefetch to complete and stores the opened
+ *  AVFormatContext in the item list. Packets read ahead stay queued for
+ *  ff_playlist_read_packet. Does nothing if no prefetch was started.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ */
+void ff_playlist_prefetch_finish(AVPlaylistContext *ctx);
+
+/** @brief Like ff_playlist_prefetch_finish, but also discards packets read ahead,
+ *  as needed when seeking or closing.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ */
+void ff_playlist_prefetch_cancel(AVPlaylistContext *ctx);
+
+/** @brief Reads a packet from an open item, returning packets buffered by
+ *  av_find_stream_info and packets read ahead by the prefetch worker before
+ *  reading from the item's demuxer.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pos Index of the item, the current one unless the end of the previous one is read along with it.
+ *  @param pkt Packet to fill, with its stream_index local to the item.
+ *  @return 0 on success, < 0 on error.
+ */
+int ff_playlist_read_packet(AVPlaylistContext *ctx, int pos, AVPacket *pkt);
+
+/** @brief Probes items in order until the cumulative duration exceeds the specified time.
+ *  Only needed for playlists using AV_PLAYLIST_FLAG_LAZY.
+ *  @param ctx AVPlaylistContext within which the list of playlist elements and durations are stored.
+ *  @param pts Timestamp in AV_TIME_BASE.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int ff_playlist_probe_until_time(AVPlaylistContext *ctx, int64_t pts);
+
+/** @brief Inserts a list of items into the playlist of a playlist demuxer,
+ *  then opens the first item and sets the demuxer's streams to its streams.
+ *  If a scanner is attached to the playlist, only the first item it finds is
+ *  inserted, unless all items are probed at once with playlist_probe_threads.
+ *  @param s Playlist demuxer's AVFormatContext; its flags select how items are inserted.
+ *  @param ctx Pre-allocated, empty AVPlaylistContext which becomes s->priv_data.
+ *  @param flist List of null-terminated strings of absolute paths.
  *  @param len Number of paths in flist.
- *  @param workingdir Path that strings in flist are relative to.
+ *  @return Returns 0 upon success, or negative upon failure.
  */
-void ff_playlist_relative_paths(char **flist,
-                                int len,
-                                const char *workingdir);
+int ff_playlist_populate_context(AVFormatContext *s,
+                                 AVPlaylistContext *ctx,
+                                 char **flist,
+                                 int len);
 
 /** @brief Splits a character-delimited string into a list of strings.
  *  @param s The input character-delimited string ("one,two,three").
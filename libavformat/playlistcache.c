@@ -0,0 +1,478 @@
+/*
+ * Persistent cache of probe results for playlist items
+ * Copyright (c) 2009 Geza Kovacs
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** @file libavformat/playlistcache.c
+ *  @author Geza Kovacs ( gkovacs mit edu )
+ *
+ *  @brief Persistent cache of probe results for playlist items
+ *
+ *  @details The cache file starts with the tag "FPPC" and a version number,
+ *  followed by one record per file: the path, file size and modification time
+ *  it was probed at, and the serialized probe results. The serialized results
+ *  are kept as is in memory and only parsed when an entry is used.
+ */
+
+#include "config.h"
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "playlistcache.h"
+#include "playlist.h"
+#include "libavutil/avstring.h"
+
+#define PLAYLIST_CACHE_VERSION 3
+
+/** Sanity limit on the size of a record read from the cache file */
+#define PLAYLIST_CACHE_MAX_DATA_SIZE (1 << 24)
+
+typedef struct PlaylistCacheEntry {
+    char *path;        /**< Path of the file, without protocol prefix */
+    int64_t size;      /**< File size at the time the file was probed */
+    int64_t mtime;     /**< File modification time at the time the file was probed */
+    uint8_t *data;     /**< Serialized probe results */
+    int data_size;
+} PlaylistCacheEntry;
+
+struct PlaylistCache {
+    char *filename;              /**< Path of the cache file */
+    PlaylistCacheEntry *entries;
+    int nb_entries;
+    int dirty;                   /**< Nonzero if entries were added since the file was loaded */
+#if HAVE_PTHREADS
+    pthread_mutex_t lock;        /**< Items may be probed from the prefetch thread */
+#endif
+};
+
+static void playlist_cache_lock(PlaylistCache *cache)
+{
+#if HAVE_PTHREADS
+    pthread_mutex_lock(&cache->lock);
+#endif
+}
+
+static void playlist_cache_unlock(PlaylistCache *cache)
+{
+#if HAVE_PTHREADS
+    pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+/** @brief Retrieves size and modification time of a local file.
+ *  @return Returns the path without protocol prefix, or NULL if the file cannot be cached.
+ */
+static const char *playlist_cache_stat(const char *filename, int64_t *size, int64_t *mtime)
+{
+    struct stat st;
+    const char *path = filename;
+    av_strstart(filename, "file:", &path);
+    // fails for other protocols as well
+    if (stat(path, &st) || !S_ISREG(st.st_mode))
+        return NULL;
+    *size  = st.st_size;
+    *mtime = st.st_mtime;
+    return path;
+}
+
+static PlaylistCacheEntry *playlist_cache_find(PlaylistCache *cache, const char *path)
+{
+    int i;
+    for (i = 0; i < cache->nb_entries; ++i)
+        if (!strcmp(cache->entries[i].path, path))
+            return &cache->entries[i];
+    return NULL;
+}
+
+/** @brief Copies the serialized probe results of a file if its entry is still valid.
+ *  @return Returns the size of the copy stored to *data, or negative upon failure.
+ */
+static int playlist_cache_get_data(PlaylistCache *cache, const char *filename, uint8_t **data)
+{
+    PlaylistCacheEntry *e;
+    int64_t size, mtime;
+    int ret = -1;
+    const char *path = playlist_cache_stat(filename, &size, &mtime);
+    if (!path)
+        return -1;
+    playlist_cache_lock(cache);
+    e = playlist_cache_find(cache, path);
+    if (e && e->size == size && e->mtime == mtime &&
+        (*data = av_malloc(e->data_size))) {
+        memcpy(*data, e->data, e->data_size);
+        ret = e->data_size;
+    }
+    playlist_cache_unlock(cache);
+    return ret;
+}
+
+static int playlist_cache_insert(PlaylistCache *cache, const char *path,
+                                 int64_t size, int64_t mtime,
+                                 uint8_t *data, int data_size)
+{
+    PlaylistCacheEntry *e = playlist_cache_find(cache, path);
+    if (e) {
+        av_free(e->data);
+    } else {
+        char *path_copy = av_strdup(path);
+        e = av_realloc(cache->entries, sizeof(*e) * (cache->nb_entries + 1));
+        if (!path_copy || !e) {
+            av_free(path_copy);
+            if (e)
+                cache->entries = e;
+            av_free(data);
+            return AVERROR_NOMEM;
+        }
+        cache->entries = e;
+        e = &cache->entries[cache->nb_entries++];
+        e->path = path_copy;
+    }
+    e->size      = size;
+    e->mtime     = mtime;
+    e->data      = data;
+    e->data_size = data_size;
+    return 0;
+}
+
+static void put_str16(ByteIOContext *pb, const char *str)
+{
+    int len = FFMIN(strlen(str), 0xFFFF);
+    put_be16(pb, len);
+    put_buffer(pb, (const unsigned char *)str, len);
+}
+
+static void get_str16(ByteIOContext *pb, char *buf, int buf_size)
+{
+    int len = get_be16(pb);
+    int copy = FFMIN(len, buf_size - 1);
+    get_buffer(pb, (unsigned char *)buf, copy);
+    url_fskip(pb, len - copy);
+    buf[copy] = 0;
+}
+
+static void put_rational(ByteIOContext *pb, AVRational q)
+{
+    put_be32(pb, q.num);
+    put_be32(pb, q.den);
+}
+
+static AVRational get_rational(ByteIOContext *pb)
+{
+    AVRational q;
+    q.num = get_be32(pb);
+    q.den = get_be32(pb);
+    return q;
+}
+
+PlaylistCache *ff_playlist_cache_open(const char *filename)
+{
+    ByteIOContext *pb;
+    char path[1024];
+    PlaylistCache *cache = av_mallocz(sizeof(*cache));
+    if (!cache)
+        return NULL;
+    if (!(cache->filename = av_strdup(filename))) {
+        av_free(cache);
+        return NULL;
+    }
+#if HAVE_PTHREADS
+    pthread_mutex_init(&cache->lock, NULL);
+#endif
+    if (url_fopen(&pb, filename, URL_RDONLY) < 0)
+        return cache;
+    if (get_le32(pb) != MKTAG('F', 'P', 'P', 'C') ||
+        get_be32(pb) != PLAYLIST_CACHE_VERSION) {
+        av_log(NULL, AV_LOG_WARNING,
+               "Ignoring playlist probe cache %s of unknown version\n", filename);
+        url_fclose(pb);
+        return cache;
+    }
+    while (!url_feof(pb)) {
+        int64_t size, mtime;
+        int data_size;
+        uint8_t *data;
+        get_str16(pb, path, sizeof(path));
+        size      = get_be64(pb);
+        mtime     = get_be64(pb);
+        data_size = get_be32(pb);
+        if (url_feof(pb) || data_size <= 0 || data_size > PLAYLIST_CACHE_MAX_DATA_SIZE)
+            break;
+        if (!(data = av_malloc(data_size)))
+            break;
+        if (get_buffer(pb, data, data_size) != data_size) {
+            av_free(data);
+            break;
+        }
+        if (playlist_cache_insert(cache, path, size, mtime, data, data_size) < 0)
+            break;
+    }
+    url_fclose(pb);
+    av_log(NULL, AV_LOG_DEBUG, "Loaded %d entries from playlist probe cache %s\n",
+           cache->nb_entries, filename);
+    return cache;
+}
+
+/** @brief Writes the cache to a temporary file which then replaces the cache file,
+ *  so that a concurrent reader never sees a partially written cache.
+ */
+static int playlist_cache_save(PlaylistCache *cache)
+{
+    ByteIOContext *pb;
+    char tmpname[1024];
+    int i, err;
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", cache->filename);
+    if ((err = url_fopen(&pb, tmpname, URL_WRONLY)) < 0)
+        return err;
+    put_tag(pb, "FPPC");
+    put_be32(pb, PLAYLIST_CACHE_VERSION);
+    for (i = 0; i < cache->nb_entries; ++i) {
+        PlaylistCacheEntry *e = &cache->entries[i];
+        put_str16(pb, e->path);
+        put_be64(pb, e->size);
+        put_be64(pb, e->mtime);
+        put_be32(pb, e->data_size);
+        put_buffer(pb, e->data, e->data_size);
+    }
+    put_flush_packet(pb);
+    err = url_ferror(pb);
+    url_fclose(pb);
+    if (err < 0 || rename(tmpname, cache->filename)) {
+        remove(tmpname);
+        return err < 0 ? err : AVERROR_IO;
+    }
+    return 0;
+}
+
+void ff_playlist_cache_close(PlaylistCache *cache)
+{
+    int i;
+    if (!cache)
+        return;
+    if (cache->dirty && playlist_cache_save(cache) < 0)
+        av_log(NULL, AV_LOG_WARNING,
+               "Failed to save playlist probe cache %s\n", cache->filename);
+    for (i = 0; i < cache->nb_entries; ++i) {
+        av_free(cache->entries[i].path);
+        av_free(cache->entries[i].data);
+    }
+    av_free(cache->entries);
+    av_free(cache->filename);
+#if HAVE_PTHREADS
+    pthread_mutex_destroy(&cache->lock);
+#endif
+    av_free(cache);
+}
+
+int ff_playlist_cache_add(PlaylistCache *cache,
+                          const char *filename,
+                          AVFormatContext *ic)
+{
+    ByteIOContext *pb;
+    uint8_t *data;
+    int64_t size, mtime;
+    unsigned int i;
+    int data_size, err;
+    const char *path = playlist_cache_stat(filename, &size, &mtime);
+    if (!path)
+        return AVERROR_NOTSUPP;
+    if ((err = url_open_dyn_buf(&pb)) < 0)
+        return err;
+    put_str16(pb, ic->iformat->name);
+    put_be64(pb, ic->start_time);
+    put_be64(pb, ic->duration);
+    put_be64(pb, ff_playlist_gapless_duration(ic));
+    put_be32(pb, ic->bit_rate);
+    put_be32(pb, ic->nb_streams);
+    for (i = 0; i < ic->nb_streams; ++i) {
+        AVStream *st = ic->streams[i];
+        AVCodecContext *avctx = st->codec;
+        put_be32(pb, st->id);
+        put_be32(pb, st->need_parsing);
+        put_be32(pb, st->pts_wrap_bits);
+        put_rational(pb, st->time_base);
+        put_rational(pb, st->r_frame_rate);
+        put_rational(pb, st->sample_aspect_ratio);
+        put_be64(pb, st->start_time);
+        put_be64(pb, st->first_dts);
+        put_be64(pb, st->duration);
+        put_be64(pb, st->nb_frames);
+        put_be32(pb, avctx->codec_type);
+        put_be32(pb, avctx->codec_id);
+        put_be32(pb, avctx->codec_tag);
+        put_be32(pb, avctx->bit_rate);
+        put_rational(pb, avctx->time_base);
+        put_be32(pb, avctx->width);
+        put_be32(pb, avctx->height);
+        put_be32(pb, avctx->pix_fmt);
+        put_be32(pb, avctx->has_b_frames);
+        put_rational(pb, avctx->sample_aspect_ratio);
+        put_be32(pb, avctx->sample_rate);
+        put_be32(pb, avctx->channels);
+        put_be32(pb, avctx->sample_fmt);
+        put_be32(pb, avctx->frame_size);
+        put_be32(pb, avctx->block_align);
+        put_be32(pb, avctx->bits_per_coded_sample);
+        put_be64(pb, avctx->channel_layout);
+        put_be32(pb, avctx->extradata ? avctx->extradata_size : 0);
+        if (avctx->extradata)
+            put_buffer(pb, avctx->extradata, avctx->extradata_size);
+    }
+    data_size = url_close_dyn_buf(pb, &data);
+    if (!data)
+        return AVERROR_NOMEM;
+    playlist_cache_lock(cache);
+    err = playlist_cache_insert(cache, path, size, mtime, data, data_size);
+    if (!err)
+        cache->dirty = 1;
+    playlist_cache_unlock(cache);
+    return err;
+}
+
+int ff_playlist_cache_get_info(PlaylistCache *cache,
+                               const char *filename,
+                               int64_t *duration,
+                               int64_t *gapless_duration,
+                               unsigned int *nb_streams)
+{
+    ByteIOContext pb;
+    uint8_t *data;
+    char format_name[64];
+    int data_size = playlist_cache_get_data(cache, filename, &data);
+    if (data_size < 0)
+        return AVERROR_NOENT;
+    init_put_byte(&pb, data, data_size, 0, NULL, NULL, NULL, NULL);
+    get_str16(&pb, format_name, sizeof(format_name));
+    get_be64(&pb);
+    *duration         = get_be64(&pb);
+    *gapless_duration = get_be64(&pb);
+    get_be32(&pb);
+    *nb_streams = get_be32(&pb);
+    av_free(data);
+    return 0;
+}
+
+int ff_playlist_cache_open_input(PlaylistCache *cache,
+                                 AVFormatContext **ic_ptr,
+                                 const char *filename)
+{
+    ByteIOContext pb;
+    AVFormatContext *ic;
+    AVInputFormat *fmt;
+    uint8_t *data;
+    char format_name[64];
+    unsigned int i, nb_streams;
+    int err = AVERROR_INVALIDDATA;
+    int data_size = playlist_cache_get_data(cache, filename, &data);
+    if (data_size < 0)
+        return AVERROR_NOENT;
+    init_put_byte(&pb, data, data_size, 0, NULL, NULL, NULL, NULL);
+    get_str16(&pb, format_name, sizeof(format_name));
+    if (!(fmt = av_find_input_format(format_name))) {
+        av_free(data);
+        return AVERROR_NOFMT;
+    }
+    if ((err = av_open_input_file(&ic, filename, fmt, 0, NULL)) < 0) {
+        av_free(data);
+        return err;
+    }
+    ic->start_time = get_be64(&pb);
+    ic->duration   = get_be64(&pb);
+    get_be64(&pb); // gapless duration, worked out again from the streams
+    ic->bit_rate   = get_be32(&pb);
+    nb_streams     = get_be32(&pb);
+    // formats without header create their streams while reading, with the same ids
+    if (nb_streams < ic->nb_streams || nb_streams > MAX_STREAMS)
+        goto fail;
+    for (i = 0; i < nb_streams; ++i) {
+        AVStream *st;
+        AVCodecContext *avctx;
+        AVRational time_base;
+        int id = get_be32(&pb), extradata_size, pts_wrap_bits;
+        if (i < ic->nb_streams)
+            st = ic->streams[i];
+        else if (!(st = av_new_stream(ic, id)))
+            goto fail;
+        if (st->id != id)
+            goto fail;
+        avctx = st->codec;
+        st->need_parsing        = get_be32(&pb);
+        pts_wrap_bits           = get_be32(&pb);
+        time_base               = get_rational(&pb);
+        if (time_base.num <= 0 || time_base.den <= 0 ||
+            pts_wrap_bits < 1 || pts_wrap_bits > 64)
+            goto fail;
+        av_set_pts_info(st, pts_wrap_bits, time_base.num, time_base.den);
+        st->r_frame_rate        = get_rational(&pb);
+        st->sample_aspect_ratio = get_rational(&pb);
+        st->start_time          = get_be64(&pb);
+        st->first_dts           = get_be64(&pb);
+        st->duration            = get_be64(&pb);
+        st->nb_frames           = get_be64(&pb);
+        avctx->codec_type             = get_be32(&pb);
+        avctx->codec_id               = get_be32(&pb);
+        avctx->codec_tag              = get_be32(&pb);
+        avctx->bit_rate               = get_be32(&pb);
+        avctx->time_base              = get_rational(&pb);
+        avctx->width                  = get_be32(&pb);
+        avctx->height                 = get_be32(&pb);
+        avctx->pix_fmt                = get_be32(&pb);
+        avctx->has_b_frames           = get_be32(&pb);
+        avctx->sample_aspect_ratio    = get_rational(&pb);
+        avctx->sample_rate            = get_be32(&pb);
+        avctx->channels               = get_be32(&pb);
+        avctx->sample_fmt             = get_be32(&pb);
+        avctx->frame_size             = get_be32(&pb);
+        avctx->block_align            = get_be32(&pb);
+        avctx->bits_per_coded_sample  = get_be32(&pb);
+        avctx->channel_layout         = get_be64(&pb);
+        extradata_size                = get_be32(&pb);
+        // the cache may have been written by a build with other enum values
+        if ((unsigned)(avctx->codec_type + 1) > CODEC_TYPE_NB ||
+            (unsigned)(avctx->pix_fmt    + 1) > PIX_FMT_NB    ||
+            (unsigned)(avctx->sample_fmt + 1) > SAMPLE_FMT_NB ||
+            ((avctx->width || avctx->height) &&
+             avcodec_check_dimensions(ic, avctx->width, avctx->height) < 0))
+            goto fail;
+        if (extradata_size < 0 || extradata_size > data_size)
+            goto fail;
+        if (extradata_size && !avctx->extradata) {
+            avctx->extradata = av_mallocz(extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+            if (!avctx->extradata)
+                goto fail;
+            get_buffer(&pb, avctx->extradata, extradata_size);
+            avctx->extradata_size = extradata_size;
+        } else {
+            url_fskip(&pb, extradata_size);
+        }
+    }
+    if (url_feof(&pb))
+        goto fail;
+    av_free(data);
+    *ic_ptr = ic;
+    return 0;
+fail:
+    av_log(ic, AV_LOG_WARNING,
+           "Cached probe results do not match %s, probing it again\n", filename);
+    av_free(data);
+    av_close_input_file(ic);
+    return AVERROR_INVALIDDATA;
+}
@@ -0,0 +1,92 @@
+/*
+ * Persistent cache of probe results for playlist items
+ * Copyright (c) 2009 Geza Kovacs
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** @file libavformat/playlistcache.h
+ *  @author Geza Kovacs ( gkovacs mit edu )
+ *
+ *  @brief Persistent cache of probe results for playlist items
+ *
+ *  @details Stores what av_find_stream_info found out about each playlist item
+ *  (input format, stream parameters, extradata, start time and duration) in a
+ *  binary file, so that items played again later do not need to be probed.
+ *  Entries are keyed by path, file size and modification time; an entry is
+ *  only used if all three still match the file.
+ */
+
+#ifndef AVFORMAT_PLAYLISTCACHE_H
+#define AVFORMAT_PLAYLISTCACHE_H
+
+#include "avformat.h"
+
+/** Name of the cache file created in the playlist or cache directory */
+#define PLAYLIST_CACHE_FILENAME "playlist.probecache"
+
+typedef struct PlaylistCache PlaylistCache;
+
+/** @brief Allocates a cache and loads the entries of the specified cache file.
+ *  A missing or unreadable file results in an empty cache.
+ *  @param filename Path of the cache file, which is also where ff_playlist_cache_close saves it.
+ *  @return Returns the cache upon success, or NULL upon failure.
+ */
+PlaylistCache *ff_playlist_cache_open(const char *filename);
+
+/** @brief Saves the cache to its file if entries were added, then frees it.
+ *  @param cache Cache to close, may be NULL.
+ */
+void ff_playlist_cache_close(PlaylistCache *cache);
+
+/** @brief Opens a file using the probe results cached for it instead of av_find_stream_info.
+ *  @param cache Cache to look the file up in.
+ *  @param ic_ptr Set to the opened AVFormatContext upon success.
+ *  @param filename Path of the file to open.
+ *  @return Returns 0 upon success, or negative if the file has no valid entry
+ *  or does not match it, in which case nothing is left opened.
+ */
+int ff_playlist_cache_open_input(PlaylistCache *cache,
+                                 AVFormatContext **ic_ptr,
+                                 const char *filename);
+
+/** @brief Retrieves the duration and number of streams cached for a file without opening it.
+ *  @param cache Cache to look the file up in.
+ *  @param filename Path of the file.
+ *  @param duration Set to the duration of the file, in AV_TIME_BASE units.
+ *  @param gapless_duration Set to the duration as returned by ff_playlist_gapless_duration.
+ *  @param nb_streams Set to the number of streams of the file.
+ *  @return Returns 0 upon success, or negative if the file has no valid entry.
+ */
+int ff_playlist_cache_get_info(PlaylistCache *cache,
+                               const char *filename,
+                               int64_t *duration,
+                               int64_t *gapless_duration,
+                               unsigned int *nb_streams);
+
+/** @brief Stores the probe results of a file that was opened and passed to av_find_stream_info.
+ *  Replaces any previous entry for the same path.
+ *  @param cache Cache to add the entry to.
+ *  @param filename Path of the file.
+ *  @param ic AVFormatContext of the file, as left by av_find_stream_info.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int ff_playlist_cache_add(PlaylistCache *cache,
+                          const char *filename,
+                          AVFormatContext *ic);
+
+#endif /* AVFORMAT_PLAYLISTCACHE_H */
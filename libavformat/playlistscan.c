@@ -0,0 +1,322 @@
+/*
+ * Incremental scanning of playlist files for items
+ * Copyright (c) 2009 Geza Kovacs
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** @file libavformat/playlistscan.c
+ *  @author Geza Kovacs ( gkovacs mit edu )
+ *
+ *  @brief Incremental scanning of playlist files for items
+ */
+
+#include "playlistscan.h"
+#include "playlist.h"
+#include "libavutil/avstring.h"
+
+int ff_playlist_scanner_open(AVPlaylistContext *ctx,
+                             AVFormatContext *s,
+                             int (*next_item)(PlaylistScanner *sc))
+{
+    PlaylistScanner *sc = av_mallocz(sizeof(*sc));
+    if (!sc)
+        return AVERROR_NOMEM;
+    sc->pb = s->pb;
+    sc->next_item = next_item;
+    sc->ptr = sc->end = sc->block;
+    // dirname may modify its argument
+    av_strlcpy(sc->workingdir, s->filename, sizeof(sc->workingdir));
+    av_strlcpy(sc->workingdir, dirname(sc->workingdir), sizeof(sc->workingdir));
+    ctx->scanner = sc;
+    return 0;
+}
+
+void ff_playlist_scanner_close(AVPlaylistContext *ctx)
+{
+    PlaylistScanner *sc = ctx->scanner;
+    if (!sc)
+        return;
+    av_free(sc->entry);
+    av_free(sc);
+    ctx->scanner = NULL;
+}
+
+int ff_playlist_scan_until(PlaylistScanner *sc, int c, int keep)
+{
+    uint8_t *p = memchr(sc->ptr, c, sc->end - sc->ptr);
+    uint8_t *stop = p ? p : sc->end;
+    if (keep) {
+        unsigned int len = stop - sc->ptr;
+        char *entry;
+        if (len) {
+            if (sc->entry_len + len >= INT_MAX)
+                return AVERROR_NOMEM;
+            entry = av_fast_realloc(sc->entry, &sc->entry_allocated,
+                                    sc->entry_len + len + 1);
+            if (!entry)
+                return AVERROR_NOMEM;
+            sc->entry = entry;
+            memcpy(sc->entry + sc->entry_len, sc->ptr, len);
+            sc->entry_len += len;
+            sc->entry[sc->entry_len] = 0;
+        }
+    }
+    sc->ptr = p ? p + 1 : sc->end;
+    return !!p;
+}
+
+void ff_playlist_scan_reset(PlaylistScanner *sc)
+{
+    sc->entry_len = 0;
+    if (sc->entry)
+        sc->entry[0] = 0;
+    sc->item = NULL;
+}
+
+/** @brief Resolves a path read from a playlist file against the directory of
+ *  the file, if such a file exists there.
+ *  @return Returns the newly allocated path, or NULL upon failure.
+ */
+static char *playlist_scan_resolve(const char *workingdir, const char *item)
+{
+    int workingdir_len = strlen(workingdir);
+    int item_len = strlen(item);
+    char *full_file_path = av_malloc(workingdir_len + item_len + 2);
+    if (!full_file_path)
+        return NULL;
+    memcpy(full_file_path, workingdir, workingdir_len);
+    full_file_path[workingdir_len] = '/';
+    memcpy(full_file_path + workingdir_len + 1, item, item_len + 1);
+    if (!url_exist(full_file_path))
+        memcpy(full_file_path, item, item_len + 1);
+    return full_file_path;
+}
+
+/** @brief Tells whether a playlist item was inserted for a path read from the playlist file.
+ *  Unlike playlist_scan_resolve, does not need to look for the file.
+ */
+static int playlist_scan_match(const char *filename, const char *workingdir, const char *item)
+{
+    int workingdir_len = strlen(workingdir);
+    if (!strcmp(filename, item))
+        return 1;
+    return !strncmp(filename, workingdir, workingdir_len) &&
+           filename[workingdir_len] == '/' &&
+           !strcmp(filename + workingdir_len + 1, item);
+}
+
+static int playlist_scan_insert(AVPlaylistContext *ctx, const char *workingdir,
+                                const char *item, int pos)
+{
+    char *path = playlist_scan_resolve(workingdir, item);
+    int err;
+    if (!path)
+        return AVERROR_NOMEM;
+    err = av_playlist_insert_item(ctx, path, pos);
+    av_free(path);
+    return err;
+}
+
+/** @brief Reads blocks until the scanner finds an item or reaches the end of the file.
+ *  @param max_blocks Number of blocks that may still be read, decremented for
+ *  every block read; negative for no limit.
+ *  @return Returns 1 if sc->item was set, 0 if no more blocks may be read or
+ *  the end of the file was reached, or negative upon failure.
+ */
+static int playlist_scan_next(PlaylistScanner *sc, int *max_blocks)
+{
+    int ret;
+    for (;;) {
+        if (sc->ptr == sc->end && !sc->eof) {
+            if (!*max_blocks)
+                return 0;
+            if (*max_blocks > 0)
+                --*max_blocks;
+            ret = get_partial_buffer(sc->pb, sc->block, sizeof(sc->block));
+            if (ret <= 0) {
+                sc->eof = 1;
+            } else {
+                sc->ptr = sc->block;
+                sc->end = sc->block + ret;
+            }
+        }
+        if ((ret = sc->next_item(sc)) || sc->eof)
+            return ret;
+    }
+}
+
+int ff_playlist_scan_items(AVPlaylistContext *ctx, int max_items, int max_blocks)
+{
+    PlaylistScanner *sc = ctx->scanner;
+    int ret, found = 0;
+    while (sc && found < max_items) {
+        if ((ret = playlist_scan_next(sc, &max_blocks)) < 0)
+            return ret;
+        if (ret > 0) {
+            // items that cannot be inserted are skipped, as when listing all at once
+            if (playlist_scan_insert(ctx, sc->workingdir, sc->item, ctx->pelist_size) >= 0)
+                ++found;
+            ff_playlist_scan_reset(sc);
+        } else if (sc->eof) {
+            ff_playlist_scanner_close(ctx);
+            sc = NULL;
+        } else {
+            break;
+        }
+    }
+    return found;
+}
+
+int ff_playlist_scan_list(ByteIOContext *pb,
+                          int (*next_item)(PlaylistScanner *sc),
+                          char ***flist_ptr,
+                          int *len_ptr)
+{
+    PlaylistScanner *sc = av_mallocz(sizeof(*sc));
+    char **flist = NULL, **flist_tmp;
+    unsigned int flist_allocated = 0;
+    int len = 0, max_blocks = -1, ret;
+    if (!sc)
+        return AVERROR_NOMEM;
+    sc->pb = pb;
+    sc->next_item = next_item;
+    sc->ptr = sc->end = sc->block;
+    while ((ret = playlist_scan_next(sc, &max_blocks)) > 0) {
+        flist_tmp = av_fast_realloc(flist, &flist_allocated, sizeof(*flist) * (len + 1));
+        if (!flist_tmp) {
+            ret = AVERROR_NOMEM;
+            break;
+        }
+        flist = flist_tmp;
+        if (!(flist[len] = av_strdup(sc->item))) {
+            ret = AVERROR_NOMEM;
+            break;
+        }
+        ++len;
+        ff_playlist_scan_reset(sc);
+    }
+    av_free(sc->entry);
+    av_free(sc);
+    if (ret < 0) {
+        while (len > 0)
+            av_free(flist[--len]);
+        av_freep(&flist);
+    }
+    *flist_ptr = flist;
+    *len_ptr = len;
+    return ret;
+}
+
+/** @brief Looks for a played item in a new version of the playlist file.
+ *  Among several occurrences, the one preceded by the most of the same items
+ *  as in the playlist is taken, then the one closest to the item's index.
+ *  @return Returns the index of the item in flist, or -1 if it is not listed.
+ */
+static int playlist_update_find(AVPlaylistContext *ctx, const char *workingdir,
+                                char **flist, int len, int pos)
+{
+    int i, run, best = -1, best_run = -1;
+    for (i = 0; i < len; ++i) {
+        if (!playlist_scan_match(ctx->items[pos].filename, workingdir, flist[i]))
+            continue;
+        for (run = 1; run <= PLAYLIST_UPDATE_ANCHORS && run <= pos && run <= i; ++run)
+            if (!playlist_scan_match(ctx->items[pos-run].filename, workingdir, flist[i-run]))
+                break;
+        if (run > best_run ||
+            (run == best_run && FFABS(i - pos) < FFABS(best - pos))) {
+            best     = i;
+            best_run = run;
+        }
+    }
+    return best;
+}
+
+int ff_playlist_update_items(AVPlaylistContext *ctx, const char *workingdir,
+                             char **flist, int len)
+{
+    int cur = ctx->pe_curidx, start = 0, prefix = 0, suffix = 0;
+    int i, j, a, b, pos, old_len, new_len, err, changes = 0;
+    uint16_t *lcs = NULL;
+    // the items following the current one are those following the last
+    // played item that is still listed
+    for (i = cur; i >= 0 && i > cur - PLAYLIST_UPDATE_ANCHORS; --i) {
+        if ((j = playlist_update_find(ctx, workingdir, flist, len, i)) >= 0) {
+            start = j + 1;
+            break;
+        }
+    }
+    flist   += start;
+    new_len  = len - start;
+    old_len  = ctx->pelist_size - cur - 1;
+    // only the differing middle part of both lists needs to be compared
+    while (prefix < old_len && prefix < new_len &&
+           playlist_scan_match(ctx->items[cur+1+prefix].filename, workingdir, flist[prefix]))
+        ++prefix;
+    while (suffix < old_len - prefix && suffix < new_len - prefix &&
+           playlist_scan_match(ctx->items[cur+old_len-suffix].filename, workingdir,
+                               flist[new_len-1-suffix]))
+        ++suffix;
+    a = old_len - prefix - suffix;
+    b = new_len - prefix - suffix;
+    if (!a && !b)
+        return 0;
+    ff_playlist_prefetch_cancel(ctx);
+    flist += prefix;
+    pos    = cur + 1 + prefix;
+    // lcs[i*(b+1)+j] is the length of the longest common subsequence of the
+    // old items from i on and the new ones from j on, which is used to keep
+    // as many items as possible; if the lists are too long to compare, all
+    // differing items are replaced
+    if (a && b && (int64_t) (a + 1) * (b + 1) <= PLAYLIST_UPDATE_MAX_COMPARE &&
+        (lcs = av_malloc(sizeof(*lcs) * (a + 1) * (b + 1)))) {
+        for (i = a; i >= 0; --i) {
+            for (j = b; j >= 0; --j) {
+                if (i == a || j == b)
+                    lcs[i*(b+1)+j] = 0;
+                else if (playlist_scan_match(ctx->items[pos+i].filename, workingdir, flist[j]))
+                    lcs[i*(b+1)+j] = lcs[(i+1)*(b+1)+j+1] + 1;
+                else
+                    lcs[i*(b+1)+j] = FFMAX(lcs[(i+1)*(b+1)+j], lcs[i*(b+1)+j+1]);
+            }
+        }
+    }
+    i = j = 0;
+    while (i < a || j < b) {
+        if (lcs && i < a && j < b &&
+            playlist_scan_match(ctx->items[pos].filename, workingdir, flist[j])) {
+            ++pos;
+            ++i;
+            ++j;
+        } else if (j < b && (i == a || !lcs || lcs[i*(b+1)+j+1] >= lcs[(i+1)*(b+1)+j])) {
+            // items that cannot be inserted are skipped, as when listing all at once
+            if (playlist_scan_insert(ctx, workingdir, flist[j], pos) >= 0)
+                ++pos;
+            ++j;
+            ++changes;
+        } else {
+            if ((err = av_playlist_remove_item(ctx, pos)) < 0) {
+                av_free(lcs);
+                return err;
+            }
+            ++i;
+            ++changes;
+        }
+    }
+    av_free(lcs);
+    return changes;
+}
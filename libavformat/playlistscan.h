@@ -0,0 +1,129 @@
+/*
+ * Incremental scanning of playlist files for items
+ * Copyright (c) 2009 Geza Kovacs
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** @file libavformat/playlistscan.h
+ *  @author Geza Kovacs ( gkovacs mit edu )
+ *
+ *  @brief Incremental scanning of playlist files for items
+ *
+ *  @details A playlist demuxer reads its file one block at a time and hands
+ *  each block to a format-specific callback, which locates delimiters with
+ *  memchr rather than looking at every byte itself. Items are inserted into the
+ *  playlist as soon as they are found, so that playback can start while the
+ *  rest of the file is still being scanned.
+ */
+
+#ifndef AVFORMAT_PLAYLISTSCAN_H
+#define AVFORMAT_PLAYLISTSCAN_H
+
+#include "avplaylist.h"
+
+/** Number of bytes of the playlist file scanned at once */
+#define PLAYLIST_SCAN_BLOCK_SIZE 32768
+
+/** Number of played items looked for in a new version of the playlist file,
+ *  and of items before them compared to tell apart repeated paths */
+#define PLAYLIST_UPDATE_ANCHORS 16
+
+/** Largest product of the numbers of changed old and new items for which the
+ *  fewest insertions and removals are worked out when updating a playlist */
+#define PLAYLIST_UPDATE_MAX_COMPARE (1 << 20)
+
+typedef struct PlaylistScanner {
+    ByteIOContext *pb;           /**< Playlist file being scanned */
+    /** Format-specific callback which scans from ptr on and returns 1 with item
+     *  set once an item is found, 0 once the block is used up, or negative
+     *  upon failure. Called with an empty block once the end of the file is
+     *  reached, so that a pending item can still be returned. */
+    int (*next_item)(struct PlaylistScanner *sc);
+    uint8_t block[PLAYLIST_SCAN_BLOCK_SIZE];
+    uint8_t *ptr;                /**< Next byte of block to scan */
+    uint8_t *end;                /**< End of the data in block */
+    int eof;                     /**< Nonzero once the end of the file is reached */
+    int state;                   /**< Format-specific state carried across blocks */
+    char *entry;                 /**< Null-terminated text collected so far, which may span several blocks */
+    unsigned int entry_len;      /**< Length of entry, without the null terminator */
+    unsigned int entry_allocated; /**< Allocated size of entry, in bytes */
+    char *item;                  /**< Path of the item found, pointing into entry */
+    char workingdir[1024];       /**< Directory of the playlist file, which relative paths are resolved against */
+} PlaylistScanner;
+
+/** @brief Allocates a scanner for the file of a playlist demuxer and attaches it to its playlist.
+ *  @param ctx AVPlaylistContext to insert the items found into.
+ *  @param s Playlist demuxer's AVFormatContext, whose file is scanned.
+ *  @param next_item Format-specific callback, see PlaylistScanner.next_item.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int ff_playlist_scanner_open(AVPlaylistContext *ctx,
+                             AVFormatContext *s,
+                             int (*next_item)(PlaylistScanner *sc));
+
+/** @brief Frees the scanner of a playlist, if any. */
+void ff_playlist_scanner_close(AVPlaylistContext *ctx);
+
+/** @brief Appends the bytes of the block up to the next occurrence of a
+ *  character to entry, or skips them, and consumes the character.
+ *  @param sc Scanner whose block is scanned.
+ *  @param c Character to look for.
+ *  @param keep Nonzero to append the bytes to entry, zero to skip them.
+ *  @return Returns 1 if the character was found, 0 if the block was used up
+ *  without finding it, or negative upon failure.
+ */
+int ff_playlist_scan_until(PlaylistScanner *sc, int c, int keep);
+
+/** @brief Empties entry. */
+void ff_playlist_scan_reset(PlaylistScanner *sc);
+
+/** @brief Scans the file of a playlist for more items and appends them to it.
+ *  The scanner is freed once the end of the file is reached.
+ *  @param ctx AVPlaylistContext with a scanner attached.
+ *  @param max_items Number of items after which to stop scanning.
+ *  @param max_blocks Number of blocks after which to stop scanning; negative for no limit.
+ *  @return Returns the number of items appended, or negative upon failure.
+ */
+int ff_playlist_scan_items(AVPlaylistContext *ctx, int max_items, int max_blocks);
+
+/** @brief Scans a whole playlist file into a list of paths, as they appear in the file.
+ *  @param pb Playlist file to scan from its current position on.
+ *  @param next_item Format-specific callback, see PlaylistScanner.next_item.
+ *  @param flist_ptr Set to the allocated list of allocated paths.
+ *  @param len_ptr Set to the number of paths in the list.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+int ff_playlist_scan_list(ByteIOContext *pb,
+                          int (*next_item)(PlaylistScanner *sc),
+                          char ***flist_ptr,
+                          int *len_ptr);
+
+/** @brief Updates the items following the current one to match a new version
+ *  of the playlist file, inserting and removing as few items as possible.
+ *  Items up to the current one are left untouched, and items which are kept
+ *  are neither probed nor reopened again.
+ *  @param ctx AVPlaylistContext to update.
+ *  @param workingdir Directory of the playlist file, which relative paths are resolved against.
+ *  @param flist Paths listed in the new version of the file, as returned by ff_playlist_scan_list.
+ *  @param len Number of paths in flist.
+ *  @return Returns the number of items inserted or removed, or negative upon failure.
+ */
+int ff_playlist_update_items(AVPlaylistContext *ctx, const char *workingdir,
+                             char **flist, int len);
+
+#endif /* AVFORMAT_PLAYLISTSCAN_H */
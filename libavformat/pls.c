@@ -30,6 +30,7 @@
 #include "libavutil/avstring.h"
 #include "internal.h"
 #include "playlist.h"
+#include "playlistscan.h"
 
 /* The ffmpeg codecs we support, and the IDs they have in the file */
 static const AVCodecTag codec_pls_tags[] = {
@@ -44,93 +45,55 @@ static int pls_probe(AVProbeData *p)
         return 0;
 }
 
-static int pls_list_files(ByteIOContext *b, char ***flist_ptr, int *len_ptr)
+static int pls_next_item(PlaylistScanner *sc)
 {
-    int i, j, c;
-    unsigned int buflen;
-    char state;
-    char **flist, **flist_tmp;
-    char buf[1024];
-    char buf_tag[5] = {0};
-    const char match_tag[] = "\nFile";
-    flist = NULL;
-    state = buflen = i = j = 0;
-    while ((c = url_fgetc(b))) {
-        if (c == EOF)
-            break;
-        if (state == 0) {
-            memmove(buf_tag, buf_tag+1, 4);
-            buf_tag[4] = c;
-            if (!memcmp(buf_tag, match_tag, 5))
-                state = 1;
-        } else if (state == 1) {
-            if (c == '=')
-                state = 2;
-            else if (c == '#')
-                state = 0;
-        } else {
-            if (c == '\n' || c == '#') {
-                termfn:
-                buf[i++] = 0;
-                flist_tmp = av_fast_realloc(flist, &buflen, sizeof(*flist) * (j+2));
-                if (!flist_tmp) {
-                    av_log(NULL, AV_LOG_ERROR, "av_realloc error in m3u_list_files\n");
-                    av_free(flist);
-                    return AVERROR_NOMEM;
-                } else
-                    flist = flist_tmp;
-                flist[j] = av_malloc(i);
-                av_strlcpy(flist[j++], buf, i);
-                i = 0;
-                state = 0;
-                buf_tag[sizeof(buf_tag)-1] = c;
-                continue;
-            } else {
-                buf[i++] = c;
-                if (i >= sizeof(buf)-1)
-                    goto termfn;
+    char *line, *value, *end;
+    int ret;
+    for (;;) {
+        if ((ret = ff_playlist_scan_until(sc, '\n', 1)) < 0)
+            return ret;
+        if (!ret && !(sc->eof && sc->entry_len)) // line continues in the next block
+            return 0;
+        line = sc->entry;
+        end  = line + sc->entry_len;
+        // items are the values of the FileN keys; anything from a hash on is a comment
+        if (sc->entry_len > 4 && !memcmp(line, "File", 4) &&
+            (value = memchr(line, '=', end - line)) &&
+            !memchr(line, '#', value - line)) {
+            char *hash;
+            ++value;
+            if ((hash = memchr(value, '#', end - value)))
+                end = hash;
+            while (end > value && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+                --end;
+            if (end > value) {
+                *end = 0;
+                sc->item = value;
+                return 1;
             }
         }
+        ff_playlist_scan_reset(sc);
     }
-    *flist_ptr = flist;
-    *len_ptr = j;
-    if (!flist) // no files have been found
-        return AVERROR_EOF;
-    flist[j] = 0;
-    return 0;
 }
 
 static int pls_read_header(AVFormatContext *s,
                            AVFormatParameters *ap)
 {
     AVPlaylistContext *ctx;
-    char **flist;
-    int flist_len, i;
-    pls_list_files(s->pb, &flist, &flist_len);
-    if (!flist || flist_len <= 0) {
-        fprintf(stderr, "no playlist items found in %s\n", s->filename);
-        return AVERROR_EOF;
-    }
-    ff_playlist_relative_paths(flist, flist_len, dirname(s->filename));
+    int err;
     ctx = av_playlist_alloc();
     if (!ctx) {
         av_log(NULL, AV_LOG_ERROR, "failed to allocate AVPlaylistContext in pls_read_header\n");
         return AVERROR_NOMEM;
     }
-    for (i = 0; i < flist_len; ++i) {
-        av_playlist_insert_item(ctx, flist[i], ctx->pelist_size);
-        av_free(flist[i]);
-    }
-    av_free(flist);
-    s->priv_data = ctx;
-    ctx->master_formatcontext = s;
-    if (!ctx->formatcontext_list[ctx->pe_curidx]) {
-        if (!(ctx->formatcontext_list[ctx->pe_curidx] =
-            ff_playlist_alloc_formatcontext(ctx->flist[ctx->pe_curidx])))
-            return AVERROR_NOFMT;
-    }
-    ff_playlist_set_streams(ctx);
-    return 0;
+    if ((err = ff_playlist_scanner_open(ctx, s, pls_next_item)) < 0)
+        return err;
+    err = ff_playlist_populate_context(s, ctx, NULL, 0);
+    if (ctx->pelist_size <= 0)
+        av_log(s, AV_LOG_ERROR, "no playlist items found in %s\n", s->filename);
+    if (err < 0)
+        ff_concatgen_read_close(s);
+    return err;
 }
 
 AVInputFormat pls_demuxer = {
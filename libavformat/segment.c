@@ -0,0 +1,244 @@
+/*
+ * Segmenting muxer writing an M3U playlist of its segments
+ * Copyright (c) 2009 Geza Kovacs
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** @file libavformat/segment.c
+ *  @author Geza Kovacs ( gkovacs mit edu )
+ *
+ *  @brief Segmenting muxer writing an M3U playlist of its segments
+ *
+ *  @details The output file is an extended M3U playlist. Packets are passed
+ *  to another muxer, mpegts unless AVFormatContext.segment_format says
+ *  otherwise, which writes them to numbered files next to the playlist. A new
+ *  file is started at the first keyframe of the first video stream (or of the
+ *  first stream) that follows AVFormatContext.segment_time milliseconds of
+ *  the current one. The muxer of every segment shares the codec contexts of
+ *  the output streams, so encoders are only opened once. Each segment is
+ *  listed in the playlist as soon as it is complete, so that the playlist
+ *  can be played back with -plreload while it is being written.
+ */
+
+#include "avformat.h"
+#include "libavutil/avstring.h"
+
+typedef struct SegmentContext {
+    AVOutputFormat *oformat;    /**< Muxer of the segments */
+    AVFormatContext *avf;       /**< Context of the segment being written, NULL if none */
+    int segment_index;          /**< Number of the segment being written, from 0 on */
+    int reference_stream;       /**< Stream at whose keyframes segments are started */
+    int64_t segment_start;      /**< Timestamp the segment being written starts at, in AV_TIME_BASE units */
+    int64_t segment_end;        /**< Timestamp its last packet ends at, in AV_TIME_BASE units */
+    char prefix[1024];          /**< File name of the playlist without its extension */
+    char extension[16];         /**< Extension of the segment files */
+} SegmentContext;
+
+/** @brief Frees the context of a segment, leaving the shared codec contexts alone. */
+static void segment_free(AVFormatContext *oc)
+{
+    int i;
+    for (i = 0; i < oc->nb_streams; i++) {
+        av_metadata_free(&oc->streams[i]->metadata);
+        av_free(oc->streams[i]->priv_data);
+        av_free(oc->streams[i]);
+    }
+    av_metadata_free(&oc->metadata);
+    av_free(oc->priv_data);
+    av_free(oc);
+}
+
+/** @brief Opens the next segment file and writes its header.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+static int segment_open(AVFormatContext *s)
+{
+    SegmentContext *seg = s->priv_data;
+    AVFormatContext *oc;
+    int i, err;
+
+    if (!(oc = avformat_alloc_context()))
+        return AVERROR(ENOMEM);
+    oc->oformat     = seg->oformat;
+    oc->max_delay   = s->max_delay;
+    oc->preload     = s->preload;
+    oc->mux_rate    = s->mux_rate;
+    oc->packet_size = s->packet_size;
+    if (snprintf(oc->filename, sizeof(oc->filename), "%s-%05d.%s",
+                 seg->prefix, seg->segment_index, seg->extension) >= sizeof(oc->filename)) {
+        av_log(s, AV_LOG_ERROR, "Segment file name for '%s' is too long\n", s->filename);
+        segment_free(oc);
+        return AVERROR(EINVAL);
+    }
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = av_new_stream(oc, s->streams[i]->id);
+        if (!st) {
+            segment_free(oc);
+            return AVERROR(ENOMEM);
+        }
+        av_free(st->codec);
+        st->codec               = s->streams[i]->codec;
+        st->sample_aspect_ratio = s->streams[i]->sample_aspect_ratio;
+    }
+    if ((err = url_fopen(&oc->pb, oc->filename, URL_WRONLY)) < 0) {
+        av_log(s, AV_LOG_ERROR, "Could not open '%s'\n", oc->filename);
+        segment_free(oc);
+        return err;
+    }
+    if ((err = av_write_header(oc)) < 0) {
+        url_fclose(oc->pb);
+        segment_free(oc);
+        return err;
+    }
+    seg->avf = oc;
+    return 0;
+}
+
+/** @brief Writes the trailer of the segment being written, closes its file
+ *  and lists it in the playlist.
+ *  @return Returns 0 upon success, or negative upon failure.
+ */
+static int segment_close(AVFormatContext *s)
+{
+    SegmentContext *seg = s->priv_data;
+    AVFormatContext *oc = seg->avf;
+    const char *name = strrchr(oc->filename, '/');
+    int ret = av_write_trailer(oc);
+
+    url_fclose(oc->pb);
+    // segments are listed relative to the playlist, which is next to them
+    name = name ? name + 1 : oc->filename;
+    if (seg->segment_start != AV_NOPTS_VALUE) {
+        int64_t duration = seg->segment_end - seg->segment_start;
+        url_fprintf(s->pb, "#EXTINF:%d,\n",
+                    (int)((duration + AV_TIME_BASE / 2) / AV_TIME_BASE));
+    }
+    url_fprintf(s->pb, "%s\n", name);
+    put_flush_packet(s->pb);
+    segment_free(oc);
+    seg->avf = NULL;
+    if (ret == 0)
+        ret = url_ferror(s->pb);
+    return ret;
+}
+
+static int segment_write_header(AVFormatContext *s)
+{
+    SegmentContext *seg = s->priv_data;
+    const char *format = s->segment_format ? s->segment_format : "mpegts";
+    char *p;
+    int i, err;
+
+    seg->oformat = guess_format(format, NULL, NULL);
+    if (!seg->oformat || seg->oformat->flags & AVFMT_NOFILE ||
+        seg->oformat == s->oformat) {
+        av_log(s, AV_LOG_ERROR, "Cannot write segments in format '%s'\n", format);
+        return AVERROR(EINVAL);
+    }
+    if (s->segment_time <= 0) {
+        av_log(s, AV_LOG_ERROR, "Invalid segment time %d\n", s->segment_time);
+        return AVERROR(EINVAL);
+    }
+    for (i = 0; i < s->nb_streams; i++) {
+        if (s->streams[i]->codec->codec_type == CODEC_TYPE_VIDEO) {
+            seg->reference_stream = i;
+            break;
+        }
+    }
+    av_strlcpy(seg->prefix, s->filename, sizeof(seg->prefix));
+    if ((p = strrchr(seg->prefix, '.')) && !strchr(p, '/'))
+        *p = 0;
+    av_strlcpy(seg->extension, seg->oformat->extensions ? seg->oformat->extensions
+                                                        : seg->oformat->name,
+               sizeof(seg->extension));
+    if ((p = strchr(seg->extension, ',')))
+        *p = 0;
+    seg->segment_start = seg->segment_end = AV_NOPTS_VALUE;
+
+    if ((err = segment_open(s)) < 0)
+        return err;
+    // packets are given in the time bases the segment muxer chose
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = seg->avf->streams[i];
+        av_set_pts_info(s->streams[i], st->pts_wrap_bits,
+                        st->time_base.num, st->time_base.den);
+    }
+    put_tag(s->pb, "#EXTM3U\n");
+    put_flush_packet(s->pb);
+    return 0;
+}
+
+static int segment_write_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    SegmentContext *seg = s->priv_data;
+    AVStream *st = s->streams[pkt->stream_index];
+    AVStream *ost;
+    AVPacket opkt = *pkt;
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    int err;
+
+    if (ts != AV_NOPTS_VALUE) {
+        ts = av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q);
+        if (seg->segment_start == AV_NOPTS_VALUE)
+            seg->segment_start = seg->segment_end = ts;
+        if (pkt->stream_index == seg->reference_stream &&
+            pkt->flags & PKT_FLAG_KEY &&
+            ts - seg->segment_start >= s->segment_time * (int64_t) 1000) {
+            seg->segment_end = FFMAX(seg->segment_end, ts);
+            if ((err = segment_close(s)) < 0)
+                return err;
+            seg->segment_index++;
+            seg->segment_start = seg->segment_end = ts;
+            if ((err = segment_open(s)) < 0)
+                return err;
+        }
+        seg->segment_end = FFMAX(seg->segment_end, ts +
+                                 av_rescale_q(pkt->duration, st->time_base, AV_TIME_BASE_Q));
+    }
+    if (!seg->avf)
+        return AVERROR(EINVAL);
+
+    ost = seg->avf->streams[pkt->stream_index];
+    if (pkt->pts != AV_NOPTS_VALUE)
+        opkt.pts = av_rescale_q(pkt->pts, st->time_base, ost->time_base);
+    if (pkt->dts != AV_NOPTS_VALUE)
+        opkt.dts = av_rescale_q(pkt->dts, st->time_base, ost->time_base);
+    opkt.duration = av_rescale_q(pkt->duration, st->time_base, ost->time_base);
+    return av_write_frame(seg->avf, &opkt);
+}
+
+static int segment_write_trailer(AVFormatContext *s)
+{
+    SegmentContext *seg = s->priv_data;
+    if (!seg->avf)
+        return 0;
+    return segment_close(s);
+}
+
+AVOutputFormat segment_muxer = {
+    "segment",
+    NULL_IF_CONFIG_SMALL("segmenting muxer with M3U playlist"),
+    "audio/x-mpegurl",
+    "m3u",
+    sizeof(SegmentContext),
+    CODEC_ID_MP2,
+    CODEC_ID_MPEG2VIDEO,
+    segment_write_header,
+    segment_write_packet,
+    segment_write_trailer,
+};
@@ -263,7 +263,14 @@ AVInputFormat *av_find_input_format(const char *short_name)
 
 int av_get_packet(ByteIOContext *s, AVPacket *pkt, int size)
 {
-    int ret= av_new_packet(pkt, size);
+    int ret;
+
+#if CONFIG_MMAP_PROTOCOL
+    // large payloads of mapped files are not copied
+    if ((ret = ff_mmap_get_packet(s, pkt, size)) != AVERROR(ENOSYS))
+        return ret;
+#endif
+    ret= av_new_packet(pkt, size);
 
     if(ret<0)
         return ret;
@@ -457,23 +464,29 @@ int av_open_input_file(AVFormatContext **ic_ptr, const char *filename,
             AVPlaylistContext *playlist_ctx = ic->priv_data;
             if (playlist_ctx) {
                 av_log(ic, AV_LOG_DEBUG, "Generating playlist from %s\n", filename);
-                for (i = 0; i < flist_len; ++i) {
-                    av_playlist_insert_item(playlist_ctx, flist[i], playlist_ctx->pelist_size);
-                    av_free(flist[i]);
+                if (ap && ap->prealloced_context && *ic_ptr) {
+                    ic->flags = (*ic_ptr)->flags;
+                    ic->playlist_probe_threads = (*ic_ptr)->playlist_probe_threads;
+                    ic->playlist_overlap = (*ic_ptr)->playlist_overlap;
+                    ic->read_ahead = (*ic_ptr)->read_ahead;
+                    if ((*ic_ptr)->playlist_cache_dir)
+                        ic->playlist_cache_dir = av_strdup((*ic_ptr)->playlist_cache_dir);
                 }
+                err = ff_playlist_populate_context(ic, playlist_ctx, flist, flist_len);
+                for (i = 0; i < flist_len; ++i)
+                    av_free(flist[i]);
                 av_free(flist);
+                if (err < 0)
+                    return err;
                 av_strlcpy(ic->filename, filename, sizeof(ic->filename));
-                if (!playlist_ctx->formatcontext_list[playlist_ctx->pe_curidx]) {
-                    if (!(playlist_ctx->formatcontext_list[playlist_ctx->pe_curidx] =
-                        ff_playlist_alloc_formatcontext(playlist_ctx->flist[playlist_ctx->pe_curidx])))
-                        return AVERROR_NOFMT;
-                }
-                ff_playlist_set_streams(playlist_ctx);
                 *ic_ptr = ic;
                 return 0;
             }
         }
     }
+    for (i = 0; flist && i < flist_len; ++i)
+        av_free(flist[i]);
+    av_free(flist);
 
     /* Do not open file if the format does not need it. XXX: specific
        hack needed to handle RTSP/TCP */
@@ -504,6 +517,10 @@ int av_open_input_file(AVFormatContext **ic_ptr, const char *filename,
             fmt = av_probe_input_format2(pd, 1, &score);
         }
         av_freep(&pd->buf);
+        // probing reads synchronously, as it seeks back to the start anyway
+        if (ap && ap->prealloced_context && *ic_ptr && (*ic_ptr)->read_ahead > 0 &&
+            (err = url_set_read_ahead(pb, (*ic_ptr)->read_ahead)) < 0)
+            av_log(*ic_ptr, AV_LOG_WARNING, "Could not read the input ahead: %d\n", err);
     }
 
     /* if still no format found, error */
@@ -977,6 +994,10 @@ static int av_read_frame_internal(AVFormatContext *s, AVPacket *pkt)
                     pkt->dts = st->parser->dts;
                     pkt->pos = st->parser->pos;
                     pkt->destruct = NULL;
+                    // frames that are whole packets share their payload,
+                    // so that buffering them does not copy it
+                    if (pkt->data == st->cur_pkt.data && pkt->size == st->cur_pkt.size)
+                        av_ref_packet(pkt, &st->cur_pkt);
                     compute_pkt_fields(s, st, st->parser, pkt);
 
                     if((s->iformat->flags & AVFMT_GENERIC_INDEX) && pkt->flags & PKT_FLAG_KEY){
@@ -2368,6 +2389,7 @@ void av_close_input_stream(AVFormatContext *s)
     }
     av_freep(&s->chapters);
     av_metadata_free(&s->metadata);
+    av_freep(&s->playlist_cache_dir);
     av_free(s);
 }
 
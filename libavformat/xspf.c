@@ -30,40 +30,32 @@
 #include "libavutil/avstring.h"
 #include "internal.h"
 #include "playlist.h"
+#include "playlistscan.h"
 
 /* The ffmpeg codecs we support, and the IDs they have in the file */
 static const AVCodecTag codec_xspf_tags[] = {
     { 0, 0 },
 };
 
-static int xspf_probe(AVProbeData *p)
+static int xspf_find(const uint8_t *buf, int size, const char *str)
 {
-    int i, len;
-    char found_xml, found_tag;
-    unsigned char c;
-    const char match_xml[] = "<?xml";
-    char buf_xml[5] = {0};
-    const char match_tag[] = "<playlist";
-    char buf_tag[9] = {0};
-    found_xml = found_tag = 0;
-    len = p->buf_size;
-    for (i = 0; i < len; i++) {
-        if (found_tag)
+    int len = strlen(str);
+    const uint8_t *p = buf, *last = buf + size - len;
+    if (size < len)
+        return 0;
+    while ((p = memchr(p, str[0], last - p + 1))) {
+        if (!memcmp(p, str, len))
+            return 1;
+        if (++p > last)
             break;
-        c = p->buf[i];
-        if (!found_xml) {
-            memmove(buf_xml, buf_xml+1, 4);
-            buf_xml[4] = c;
-            if (!memcmp(buf_xml, match_xml, 5))
-                found_xml = 1;
-        }
-        if (!found_tag) {
-            memmove(buf_tag, buf_tag+1, 8);
-            buf_tag[8] = c;
-            if (!memcmp(buf_tag, match_tag, 9))
-                found_tag = 1;
-        }
     }
+    return 0;
+}
+
+static int xspf_probe(AVProbeData *p)
+{
+    int found_xml = xspf_find(p->buf, p->buf_size, "<?xml");
+    int found_tag = xspf_find(p->buf, p->buf_size, "<playlist");
     if (found_xml && found_tag)
         return AVPROBE_SCORE_MAX;
     else if (found_xml || found_tag)
@@ -72,88 +64,53 @@ static int xspf_probe(AVProbeData *p)
         return 0;
 }
 
-static int xspf_list_files(ByteIOContext *b, char ***flist_ptr, int *len_ptr)
+static int xspf_next_item(PlaylistScanner *sc)
 {
-    int i, j, c;
-    unsigned int buflen;
-    char state;
-    char **flist, **flist_tmp;
-    char buf[1024];
-    char buf_tag[10] = {0};
-    const char match_tag[] = "<location>";
-    flist = NULL;
-    state = buflen = i = j = 0;
-    while ((c = url_fgetc(b))) {
-        if (c == EOF)
-            break;
-        if (state == 0) {
-            memmove(buf_tag, buf_tag+1, 9);
-            buf_tag[9] = c;
-            if (!memcmp(buf_tag, match_tag, 10))
-                state = 1;
+    int ret;
+    // state:
+    // 0 = between tags
+    // 1 = in a tag
+    // 2 = in the text of a location element
+    for (;;) {
+        if (sc->state == 0) {
+            if ((ret = ff_playlist_scan_until(sc, '<', 0)) <= 0)
+                return ret;
+            sc->state = 1;
+        } else if (sc->state == 1) {
+            if ((ret = ff_playlist_scan_until(sc, '>', 1)) <= 0)
+                return ret;
+            sc->state = sc->entry_len == 8 && !memcmp(sc->entry, "location", 8) ? 2 : 0;
+            ff_playlist_scan_reset(sc);
         } else {
-            if (c == '<') {
-                termfn:
-                buf[i++] = 0;
-                flist_tmp = av_fast_realloc(flist, &buflen, sizeof(*flist) * (j+2));
-                if (!flist_tmp) {
-                    av_log(NULL, AV_LOG_ERROR, "av_realloc error in m3u_list_files\n");
-                    av_free(flist);
-                    return AVERROR_NOMEM;
-                } else
-                    flist = flist_tmp;
-                flist[j] = av_malloc(i);
-                av_strlcpy(flist[j++], buf, i);
-                i = 0;
-                state = 0;
-                buf_tag[sizeof(buf_tag)-1] = c;
-                continue;
-            } else {
-                buf[i++] = c;
-                if (i >= sizeof(buf)-1)
-                    goto termfn;
+            if ((ret = ff_playlist_scan_until(sc, '<', 1)) <= 0)
+                return ret;
+            sc->state = 1; // the closing tag
+            if (sc->entry_len) {
+                sc->item = sc->entry;
+                return 1;
             }
         }
     }
-    *flist_ptr = flist;
-    *len_ptr = j;
-    if (!flist) // no files have been found
-        return AVERROR_EOF;
-    flist[j] = 0;
-    return 0;
 }
 
 static int xspf_read_header(AVFormatContext *s,
                             AVFormatParameters *ap)
 {
     AVPlaylistContext *ctx;
-    char **flist;
-    int flist_len, i;
-    xspf_list_files(s->pb, &flist, &flist_len);
-    if (!flist || flist_len <= 0) {
-        fprintf(stderr, "no playlist items found in %s\n", s->filename);
-        return AVERROR_EOF;
-    }
-    ff_playlist_relative_paths(flist, flist_len, dirname(s->filename));
+    int err;
     ctx = av_playlist_alloc();
     if (!ctx) {
         av_log(NULL, AV_LOG_ERROR, "failed to allocate AVPlaylistContext in xspf_read_header\n");
         return AVERROR_NOMEM;
     }
-    for (i = 0; i < flist_len; ++i) {
-        av_playlist_insert_item(ctx, flist[i], ctx->pelist_size);
-        av_free(flist[i]);
-    }
-    av_free(flist);
-    s->priv_data = ctx;
-    ctx->master_formatcontext = s;
-    if (!ctx->formatcontext_list[ctx->pe_curidx]) {
-        if (!(ctx->formatcontext_list[ctx->pe_curidx] =
-            ff_playlist_alloc_formatcontext(ctx->flist[ctx->pe_curidx])))
-            return AVERROR_NOFMT;
-    }
-    ff_playlist_set_streams(ctx);
-    return 0;
+    if ((err = ff_playlist_scanner_open(ctx, s, xspf_next_item)) < 0)
+        return err;
+    err = ff_playlist_populate_context(s, ctx, NULL, 0);
+    if (ctx->pelist_size <= 0)
+        av_log(s, AV_LOG_ERROR, "no playlist items found in %s\n", s->filename);
+    if (err < 0)
+        ff_concatgen_read_close(s);
+    return err;
 }
 
 AVInputFormat xspf_demuxer = {
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2009 Geza Kovacs
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if HAVE_SYS_RESOURCE_H
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+#include "libavformat/avformat.h"
+#include "libavformat/avplaylist.h"
+#include "libavcodec/opt.h"
+
+#define MAX_SIZES 16
+#define CLIP_RATE 8000
+#define CLIP_SAMPLES 2000
+
+static int usage(int ret)
+{
+    fprintf(stderr, "benchmark the playlist demuxers on synthetic M3U playlists.\n");
+    fprintf(stderr, "the items are runs of each of the given files and of a generated quarter second\n");
+    fprintf(stderr, "WAV clip, so that with plunify all items of a run are played on the same streams.\n");
+    fprintf(stderr, "plbench [options] [file ...]\n");
+    fprintf(stderr, "-s n,n,...\tnumbers of items of the playlists, default 10,1000,10000\n");
+    fprintf(stderr, "-f fflags\tformat flags to open the playlists with, default plunify\n");
+    fprintf(stderr, "-P packets\tpackets of the next item to prefetch\n");
+    fprintf(stderr, "-w items\tnumber of played items kept open\n");
+    fprintf(stderr, "-p packets\tread at most that many packets of each playlist, 0 for all\n");
+    fprintf(stderr, "-k seeks\tnumber of seeks to time, default 20\n");
+    fprintf(stderr, "-d dir\t\tdirectory to write the playlists and clip to, default .\n");
+    fprintf(stderr, "one line of key=value pairs is printed per playlist; times are in microseconds,\n");
+    fprintf(stderr, "maxrss_kb is the peak of the process so far, so sizes are best given in increasing order.\n");
+    return ret;
+}
+
+static void put_le(FILE *f, unsigned int v, int bytes)
+{
+    while (bytes--) {
+        fputc(v & 0xff, f);
+        v >>= 8;
+    }
+}
+
+/** Writes a mono 16 bit WAV file of a sawtooth wave. */
+static int write_clip(const char *filename)
+{
+    FILE *f = fopen(filename, "wb");
+    int i;
+    if (!f)
+        return -1;
+    fputs("RIFF", f);
+    put_le(f, 36 + 2 * CLIP_SAMPLES, 4);
+    fputs("WAVEfmt ", f);
+    put_le(f, 16, 4);
+    put_le(f, 1, 2);             // PCM
+    put_le(f, 1, 2);             // channels
+    put_le(f, CLIP_RATE, 4);
+    put_le(f, 2 * CLIP_RATE, 4); // bytes per second
+    put_le(f, 2, 2);             // block align
+    put_le(f, 16, 2);            // bits per sample
+    fputs("data", f);
+    put_le(f, 2 * CLIP_SAMPLES, 4);
+    for (i = 0; i < CLIP_SAMPLES; i++)
+        put_le(f, (i * 400) & 0xffff, 2);
+    return fclose(f);
+}
+
+static int write_playlist(const char *filename, int nb_items, const char **files, int nb_files)
+{
+    FILE *f = fopen(filename, "w");
+    int i;
+    if (!f)
+        return -1;
+    fputs("#EXTM3U\n", f);
+    for (i = 0; i < nb_items; i++)
+        fprintf(f, "%s\n", files[(int64_t) i * nb_files / nb_items]);
+    return fclose(f);
+}
+
+static int64_t max_rss(void)
+{
+#if HAVE_GETRUSAGE
+    struct rusage rusage;
+    getrusage(RUSAGE_SELF, &rusage);
+    return rusage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+static int run(const char *filename, int nb_items, const char *fflags,
+               int prefetch, int window, int64_t maxpkts, int nb_seeks)
+{
+    AVFormatContext *ic = avformat_alloc_context();
+    AVFormatParameters ap;
+    AVPlaylistContext *pl_ctx = NULL;
+    AVPacket pkt;
+    int64_t t, dt, open_time, read_time;
+    int64_t switch_total = 0, switch_max = 0, seek_total = 0, seek_max = 0;
+    int64_t pktnum = 0, end_ts = 0;
+    int switches = 0, seeks = 0, cur, i, err;
+    const char *name;
+
+    if (!ic)
+        return AVERROR(ENOMEM);
+    if (*fflags && av_set_string3(ic, "fflags", fflags, 1, NULL) < 0) {
+        fprintf(stderr, "invalid fflags '%s'\n", fflags);
+        av_free(ic);
+        return AVERROR(EINVAL);
+    }
+    memset(&ap, 0, sizeof(ap));
+    ap.prealloced_context = 1;
+
+    t = av_gettime();
+    err = av_open_input_file(&ic, filename, NULL, 0, &ap);
+    open_time = av_gettime() - t;
+    if (err < 0) {
+        fprintf(stderr, "av_open_input_file: error %d\n", err);
+        return err;
+    }
+    // long_name is not set with CONFIG_SMALL
+    name = ic->iformat->name;
+    if (!strcmp(name, "concat") || !strcmp(name, "m3u") ||
+        !strcmp(name, "pls")    || !strcmp(name, "xspf"))
+        pl_ctx = ic->priv_data;
+    if (!pl_ctx) {
+        fprintf(stderr, "%s was not opened as a playlist\n", filename);
+        av_close_input_file(ic);
+        return AVERROR(EINVAL);
+    }
+    pl_ctx->prefetch_packets  = prefetch;
+    pl_ctx->open_items_behind = window;
+
+    // the reads that move on to the next item include its opening
+    av_init_packet(&pkt);
+    cur = pl_ctx->pe_curidx;
+    read_time = av_gettime();
+    for (;;) {
+        t = av_gettime();
+        err = av_read_frame(ic, &pkt);
+        dt = av_gettime() - t;
+        if (err < 0)
+            break;
+        if (pl_ctx->pe_curidx != cur) {
+            cur = pl_ctx->pe_curidx;
+            switches++;
+            switch_total += dt;
+            switch_max = FFMAX(switch_max, dt);
+        }
+        if (pkt.pts != AV_NOPTS_VALUE)
+            end_ts = FFMAX(end_ts, av_rescale_q(pkt.pts, ic->streams[pkt.stream_index]->time_base,
+                                                AV_TIME_BASE_Q));
+        av_free_packet(&pkt);
+        if (++pktnum == maxpkts)
+            break;
+    }
+    read_time = av_gettime() - read_time;
+
+    // jump around the part that was read, or the whole playlist if its duration is known
+    if (ic->duration != AV_NOPTS_VALUE && ic->duration > 0 && !maxpkts)
+        end_ts = ic->duration;
+    for (i = 0; i < nb_seeks && end_ts > 0; i++) {
+        int64_t ts = end_ts / nb_seeks * ((i * 7) % nb_seeks);
+        t = av_gettime();
+        if (av_seek_frame(ic, -1, ts, AVSEEK_FLAG_BACKWARD) < 0)
+            continue;
+        if (av_read_frame(ic, &pkt) >= 0)
+            av_free_packet(&pkt);
+        dt = av_gettime() - t;
+        seeks++;
+        seek_total += dt;
+        seek_max = FFMAX(seek_max, dt);
+    }
+
+    printf("items=%d open_us=%"PRId64" packets=%"PRId64" read_us=%"PRId64" pkts_per_sec=%"PRId64
+           " switches=%d switch_avg_us=%"PRId64" switch_max_us=%"PRId64
+           " seeks=%d seek_avg_us=%"PRId64" seek_max_us=%"PRId64" maxrss_kb=%"PRId64"\n",
+           nb_items, open_time, pktnum, read_time,
+           read_time > 0 ? pktnum * 1000000 / read_time : 0,
+           switches, switches ? switch_total / switches : 0, switch_max,
+           seeks, seeks ? seek_total / seeks : 0, seek_max, max_rss());
+    fflush(stdout);
+    av_close_input_file(ic);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char clipname[PATH_MAX], plname[PATH_MAX];
+    const char *dir = ".", *fflags = "plunify";
+    const char **files;
+    int sizes[MAX_SIZES] = { 10, 1000, 10000 };
+    int nb_sizes = 3, nb_files, prefetch = 0, window = -1, nb_seeks = 20;
+    int64_t maxpkts = 0;
+    int i, ret = 0;
+
+    while (argc > 2 && argv[1][0] == '-' && argv[1][1] && !argv[1][2]) {
+        const char *arg = argv[2];
+        char *end;
+        switch (argv[1][1]) {
+        case 's':
+            for (nb_sizes = 0; nb_sizes < MAX_SIZES && *arg; nb_sizes++) {
+                sizes[nb_sizes] = strtol(arg, &end, 10);
+                if (sizes[nb_sizes] <= 0)
+                    return usage(1);
+                arg = end;
+                if (*arg == ',')
+                    arg++;
+            }
+            break;
+        case 'f': fflags   = arg;        break;
+        case 'P': prefetch = atoi(arg);  break;
+        case 'w': window   = atoi(arg);  break;
+        case 'p': maxpkts  = atoll(arg); break;
+        case 'k': nb_seeks = atoi(arg);  break;
+        case 'd': dir      = arg;        break;
+        default:
+            return usage(1);
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc > 1 && argv[1][0] == '-')
+        return usage(1);
+
+    av_register_all();
+
+    snprintf(clipname, sizeof(clipname), "%s/plbench-clip.wav", dir);
+    if (write_clip(clipname) < 0) {
+        fprintf(stderr, "could not write %s\n", clipname);
+        return 1;
+    }
+    nb_files = argc;
+    files = av_malloc(sizeof(*files) * nb_files);
+    if (!files)
+        return 1;
+    for (i = 0; i < argc - 1; i++)
+        files[i] = argv[i + 1];
+    // the clip is given with the path it has from the playlist
+    files[argc - 1] = "plbench-clip.wav";
+
+    for (i = 0; i < nb_sizes && !ret; i++) {
+        snprintf(plname, sizeof(plname), "%s/plbench-%d.m3u", dir, sizes[i]);
+        if (write_playlist(plname, sizes[i], files, nb_files) < 0) {
+            fprintf(stderr, "could not write %s\n", plname);
+            ret = 1;
+            break;
+        }
+        if (run(plname, sizes[i], fflags, prefetch, window, maxpkts, nb_seeks) < 0)
+            ret = 1;
+        unlink(plname);
+    }
+    unlink(clipname);
+    av_free(files);
+    return ret;
+}